@@ -0,0 +1,56 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Times per run of one benchmark, in milliseconds
+struct BenchmarkResult
+{
+	std::string name;
+	size_t iterations{0};
+	double median{0.0};
+	double mean{0.0};
+	double min{0.0};
+	double p95{0.0};
+};
+
+// Runs benchmarks and collects their results for the JSON file. Each body runs once to warm up
+// (caches, lazily created GL objects), then again and again until it ran MinIterations times
+// and MinSeconds long, and every run is timed on its own.
+// The loaders report each file they read, their output goes to the null device while a benchmark runs.
+class BenchmarkSuite
+{
+public:
+	static const size_t MinIterations = 5;
+	static const size_t MaxIterations = 100000;
+	static constexpr double MinSeconds = 0.25;
+
+	// Benchmarks whose name doesn't contain filter are skipped
+	explicit BenchmarkSuite(const std::string & filter = "") : filter_(filter) {}
+
+	bool selected(const std::string & name) const;
+	// Prints the result when done. Names are "what/case", e.g. "loadOBJ/teapot/parse".
+	void run(const std::string & name, const std::function<void()> & body);
+	// Like run, for bodies that time themselves, e.g. on the GPU: they return their milliseconds
+	void measure(const std::string & name, const std::function<double()> & body);
+
+	const std::vector<BenchmarkResult> & results() const { return results_; }
+	// {"benchmarks":[{"name":..., "iterations":..., "median_ms":..., ...}, ...]}
+	bool writeJSON(const char * path) const;
+
+private:
+	std::string filter_;
+	std::vector<BenchmarkResult> results_;
+};
+
+// The names and medians of a file writeJSON wrote, it reads no other JSON
+bool readBenchmarkJSON(const char * path, std::vector<BenchmarkResult> & results);
+
+// Prints each result against the baseline with the same name and returns how many are slower by
+// more than threshold (0.1: 10 %). Medians below a microsecond are too noisy to count.
+size_t compareBenchmarks(const std::vector<BenchmarkResult> & results, const std::vector<BenchmarkResult> & baseline, double threshold);
+
+#endif
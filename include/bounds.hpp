@@ -0,0 +1,24 @@
+#ifndef BOUNDS_HPP
+#define BOUNDS_HPP
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Axis aligned box and a sphere around it, in the space of the vertices they were computed from
+struct Bounds
+{
+	glm::vec3 min{0.0f};
+	glm::vec3 max{0.0f};
+	glm::vec3 center{0.0f};
+	float radius{0.0f};
+};
+
+// The sphere is centered on the box and reaches the farthest vertex
+Bounds computeBounds(const glm::vec3 * positions, size_t count);
+
+// World space sphere (center xyz, radius w) around bounds transformed by model.
+// The radius is scaled by the largest axis scale, so it stays conservative for non-uniform scales.
+glm::vec4 transformSphere(const Bounds & bounds, const glm::mat4 & model);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Ray
+{
+	glm::vec3 origin{0.0f};
+	glm::vec3 direction{0.0f, 0.0f, 1.0f}; // doesn't have to be normalized, t is in units of it
+	float tMin{0.0f};
+	float tMax{std::numeric_limits<float>::infinity()};
+};
+
+struct RayHit
+{
+	uint32_t triangle{~0u}; // index into the triangles the BVH was built from
+	float t{std::numeric_limits<float>::infinity()};
+	float u{0.0f}, v{0.0f}; // barycentrics of the second and third corner
+};
+
+// Bounding volume hierarchy over the triangles of an indexed mesh.
+// Built as a binary tree with the binned surface area heuristic, subtrees in parallel,
+// then collapsed into a tree with four children per node, whose boxes are tested at once with SSE.
+class BVH
+{
+public:
+	static const unsigned int MaxLeafTriangles = 4;
+
+	// threads 0 uses all hardware threads. The vertices are copied, the arrays don't have to stay valid.
+	void build(const glm::vec3 * vertices, const unsigned int * indices, size_t indexCount, unsigned int threads = 0);
+
+	// Closest hit between ray.tMin and ray.tMax
+	bool intersect(const Ray & ray, RayHit & hit) const;
+	// Any hit on the segment, for visibility queries
+	bool intersectSegment(const glm::vec3 & from, const glm::vec3 & to) const;
+
+	size_t nodeCount() const { return nodes_.size(); }
+	size_t triangleCount() const { return triangleIds_.size(); }
+	// Levels of four-wide nodes
+	unsigned int depth() const { return depth_; }
+	bool empty() const { return nodes_.empty(); }
+
+private:
+	// Children i of a node: leaf if count[i] > 0 (triangles child[i] .. child[i] + count[i]),
+	// inner node child[i] if count[i] == 0, unused if child[i] == Empty.
+	// Boxes are stored per axis so one SSE load covers all four children.
+	struct Node
+	{
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4];
+		uint32_t count[4];
+	};
+	static const uint32_t Empty = ~0u;
+
+	// Triangles in BVH order: first corner and the two edges from it, as Moeller-Trumbore needs them
+	struct Triangle
+	{
+		glm::vec3 v0, e1, e2;
+	};
+
+	template <bool AnyHit>
+	bool traverse(const Ray & ray, RayHit & hit) const;
+
+	std::vector<Node> nodes_;
+	std::vector<Triangle> triangles_;
+	std::vector<uint32_t> triangleIds_;
+	unsigned int depth_{0};
+};
+
+#endif
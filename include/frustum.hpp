@@ -0,0 +1,23 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// Planes (normal xyz, distance w) with normals pointing inside, normalized.
+// Order: left, right, bottom, top, near, far.
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann: the planes are sums and differences of the rows of Projection * View
+Frustum extractFrustum(const glm::mat4 & viewProjection);
+
+// Sets visible[i] to 1 if sphere i (center xyz, radius w) is at least partly inside, else 0.
+// Four spheres are tested at once with SSE where available. Returns the number of visible spheres.
+size_t cullSpheres(const Frustum & frustum, const glm::vec4 * spheres, size_t count, uint8_t * visible);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef GLSTATE_HPP
+#define GLSTATE_HPP
+
+#include <GL/glew.h>
+
+// How many state changes were sent to the driver and how many were dropped
+// because the state was already current
+struct GLStateCounters
+{
+	unsigned long programBinds{0}, programSkips{0};
+	unsigned long vertexArrayBinds{0}, vertexArraySkips{0};
+	unsigned long textureBinds{0}, textureSkips{0};
+	unsigned long uniformUploads{0}, uniformSkips{0};
+};
+
+// Shadow copy of the bindings the renderer changes per draw. Everything that binds
+// programs, vertex arrays or textures has to go through here, or call invalidate() afterwards.
+class GLState
+{
+public:
+	GLState() { invalidate(); }
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vertexArray);
+	void activeTexture(GLenum unit);
+	// Binds to the active texture unit
+	void bindTexture(GLenum target, GLuint texture);
+
+	// Forget what is bound, the next call of each kind goes to the driver again
+	void invalidate();
+
+	GLStateCounters & counters() { return counters_; }
+	void resetCounters() { counters_ = GLStateCounters{}; }
+
+private:
+	static const int TextureUnits = 32;
+	static const int TextureTargets = 4;
+	static int targetSlot(GLenum target);
+
+	static const GLuint Unknown = ~0u;
+	GLuint program_;
+	GLuint vertexArray_;
+	GLenum activeUnit_;
+	bool activeUnitKnown_;
+	GLuint textures_[TextureUnits][TextureTargets];
+	GLStateCounters counters_;
+};
+
+// The state of the current context
+GLState & glState();
+
+#endif
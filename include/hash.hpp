@@ -0,0 +1,39 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Fast non-cryptographic 64-bit hash, good enough to notice changed files.
+// Works on 8 bytes at a time, the tail is padded with zeros.
+inline uint64_t hashBytes(const void * data, std::size_t size, uint64_t seed = 0xcbf29ce484222325ull)
+{
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+	std::size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		h = (h ^ word) * 0x100000001B3ull;
+		h ^= h >> 29;
+	}
+	if (i < size)
+	{
+		uint64_t word = 0;
+		std::memcpy(&word, bytes + i, size - i);
+		h = (h ^ word) * 0x100000001B3ull;
+	}
+	h ^= h >> 32;
+	h *= 0xD6E8FEB86659FD93ull;
+	h ^= h >> 32;
+	return h;
+}
+
+inline uint64_t hashString(const char * text, uint64_t seed = 0xcbf29ce484222325ull)
+{
+	return hashBytes(text, std::strlen(text), seed);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+#include <GL/glew.h>
+
+// OpenGL 3.3 core without a window or a display server, for render nodes and CI: a surfaceless
+// EGL context (EGL_MESA_platform_surfaceless, Mesa's llvmpipe has it) that renders into a
+// framebuffer object in place of the window's back buffer.
+// The EGL handles are kept as void pointers, EGL's headers would pull in X11's here.
+class HeadlessContext
+{
+public:
+	HeadlessContext() = default;
+	~HeadlessContext() { close(); }
+
+	HeadlessContext(const HeadlessContext&) = delete;
+	HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+	// Makes the context current, loads the GL functions and binds a width x height framebuffer.
+	// false if there is no EGL display or it can't make such a context.
+	bool open(int width, int height);
+	// Everything else of the context has to be released before
+	void close();
+
+	bool isOpen() const { return context_ != nullptr; }
+	GLuint framebuffer() const { return framebuffer_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+	// In place of the buffer swap: waits for the frame, so the frames don't pile up ahead of the GPU
+	void finishFrame();
+	// The frame as binary PPM, top row first
+	bool writePPM(const char * path) const;
+
+private:
+	void * display_{nullptr}; // EGLDisplay
+	void * context_{nullptr}; // EGLContext
+	GLuint framebuffer_{0};
+	GLuint colorBuffer_{0};
+	GLuint depthBuffer_{0};
+	int width_{0};
+	int height_{0};
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef JOBSYSTEM_HPP
+#define JOBSYSTEM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobCounter;
+
+// function(data, begin, end), e.g. one chunk of a parallel for
+struct Job
+{
+	void (*function)(const void * data, size_t begin, size_t end){nullptr};
+	const void * data{nullptr};
+	size_t begin{0};
+	size_t end{0};
+	JobCounter * counter{nullptr}; // counts the job down when it is done
+};
+
+// Counts the unfinished jobs that were run with it. Wait for it, or run jobs after it: those are
+// held back until its count is zero. Must not be destroyed before it is done, JobSystem::wait makes sure.
+class JobCounter
+{
+public:
+	JobCounter() = default;
+	JobCounter(const JobCounter &) = delete;
+	JobCounter & operator=(const JobCounter &) = delete;
+
+	bool done() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<size_t> pending_{0};
+	std::mutex mutex_;         // the last job holds it while it releases the waiting ones
+	std::vector<Job> waiting_; // run after this counter
+};
+
+// Work stealing scheduler. Each thread has a deque of its own: it pushes and pops jobs at the back,
+// so it goes on with what it queued last while that is still in its cache, and the other threads
+// steal from the front, the oldest and usually biggest piece of work. The deques have a mutex each,
+// which the owner mostly has to itself. Idle workers sleep until jobs are queued.
+// The thread that creates it is thread 0 and works on jobs while it waits for them, run and wait
+// must only be used from that thread and from jobs.
+class JobSystem
+{
+public:
+	// threads includes the calling thread, 0 for one per hardware thread
+	explicit JobSystem(unsigned int threads = 0);
+	~JobSystem();
+	JobSystem(const JobSystem &) = delete;
+	JobSystem & operator=(const JobSystem &) = delete;
+
+	unsigned int threads() const { return threads_; }
+	// Of the calling thread, 0 to threads() - 1, for data kept per thread
+	unsigned int threadIndex() const;
+
+	// Queues function(data, begin, end). counter counts it until it is done, after holds it back until
+	// after is done. data has to stay valid until then.
+	void run(void (*function)(const void *, size_t, size_t), const void * data, size_t begin, size_t end,
+		JobCounter * counter = nullptr, JobCounter * after = nullptr);
+	// f() as a job, f has to stay valid until it ran
+	template <typename F>
+	void run(const F & f, JobCounter * counter = nullptr, JobCounter * after = nullptr)
+	{
+		run([](const void * data, size_t, size_t) { (*static_cast<const F *>(data))(); }, &f, 0, 0, counter, after);
+	}
+
+	// Runs queued jobs, its own and stolen ones, until counter is done
+	void wait(JobCounter & counter);
+
+	// body(begin, end) for chunks of at most grain elements of [0, count), returns when all are done.
+	// With a single chunk, or a single thread, body runs right here.
+	template <typename Body>
+	void parallelFor(size_t count, size_t grain, const Body & body)
+	{
+		grain = std::max(grain, size_t(1));
+		if (count <= grain || threads_ == 1)
+		{
+			if (count)
+				body(size_t(0), count);
+			return;
+		}
+		JobCounter counter;
+		auto chunk = [](const void * data, size_t begin, size_t end) { (*static_cast<const Body *>(data))(begin, end); };
+		for (size_t begin = 0; begin < count; begin += grain)
+			run(chunk, &body, begin, std::min(count, begin + grain), &counter);
+		wait(counter);
+	}
+
+private:
+	struct alignas(64) Deque
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void push(const Job & job);
+	bool take(unsigned int index, Job & job);
+	void execute(const Job & job);
+	void work(unsigned int index);
+
+	unsigned int threads_;
+	std::unique_ptr<Deque[]> deques_;
+	std::vector<std::thread> workers_;
+	std::atomic<size_t> queued_{0};   // jobs in all deques
+	std::atomic<unsigned int> sleeping_{0};
+	std::mutex sleepMutex_;
+	std::condition_variable wake_;
+	bool stopping_{false};            // guarded by sleepMutex_
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+
+// Read-only view of a whole file, mapped into memory instead of read with fread.
+// The mapping lives as long as the object, so pointers into data() must not outlive it.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const char * path) { open(path); }
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool open(const char * path);
+	void close();
+
+	bool isOpen() const { return opened_; }
+	const char * data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+private:
+	const char * data_{nullptr};
+	std::size_t size_{0};
+	bool opened_{false};
+#ifdef _WIN32
+	void * file_{nullptr};
+	void * mapping_{nullptr};
+#endif
+};
+
+#endif
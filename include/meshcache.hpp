@@ -0,0 +1,71 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mappedfile.hpp"
+#include "simplify.hpp"
+
+// Binary copy of an indexed mesh, written the first time an OBJ file is parsed.
+// Later runs map the cache file and hand out pointers straight into the mapping,
+// so the data can go to glBufferData without parsing or copying.
+//
+// A cache file belongs to one source file. It is only used while the source has the
+// same path, size and modification time, or the same content hash if only the time changed.
+//
+// Without a cache file, e.g. in a read-only directory, it can hold the parsed arrays instead.
+class MeshCache
+{
+public:
+	// Maps the cache of sourcePath, fails if there is none or it is out of date
+	bool open(const char * sourcePath);
+	// Takes over arrays laid out like a cache file, indices with all levels of lods
+	void assign(std::vector<unsigned int> indices, std::vector<glm::vec3> vertices, std::vector<glm::vec2> uvs,
+		std::vector<glm::vec3> normals, std::vector<MeshLOD> lods);
+	void close();
+
+	bool isOpen() const { return file_.isOpen() || !indexStorage_.empty(); }
+	std::size_t vertexCount() const { return vertexCount_; }
+	// Indices of the full mesh. indices() continues with the coarser levels, see lods().
+	std::size_t indexCount() const { return indexCount_; }
+	const glm::vec3 * vertices() const { return vertices_; }
+	const glm::vec2 * uvs() const { return uvs_; }
+	const glm::vec3 * normals() const { return normals_; }
+	const unsigned int * indices() const { return indices_; }
+	// Level 0 is the full mesh
+	const std::vector<MeshLOD> & lods() const { return lods_; }
+
+private:
+	MappedFile file_;
+	std::size_t vertexCount_{0};
+	std::size_t indexCount_{0};
+	const glm::vec3 * vertices_{nullptr};
+	const glm::vec2 * uvs_{nullptr};
+	const glm::vec3 * normals_{nullptr};
+	const unsigned int * indices_{nullptr};
+	std::vector<MeshLOD> lods_;
+	// Only without a mapping
+	std::vector<unsigned int> indexStorage_;
+	std::vector<glm::vec3> vertexStorage_;
+	std::vector<glm::vec2> uvStorage_;
+	std::vector<glm::vec3> normalStorage_;
+};
+
+// Writes the cache for sourcePath. Failing to write is not an error, the next run just parses again.
+bool writeMeshCache(
+	const char * sourcePath,
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	const std::vector<MeshLOD> & lods
+);
+
+// Where the cache of sourcePath lives: CACHE_DIR, or next to the source if CACHE_DIR can't be created
+std::string meshCachePath(const char * sourcePath);
+
+#endif
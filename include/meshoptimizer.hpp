@@ -0,0 +1,42 @@
+#ifndef MESHOPTIMIZER_HPP
+#define MESHOPTIMIZER_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Size of the post-transform vertex cache we optimize for and simulate
+const unsigned int VertexCacheSize = 16;
+
+// How well an index buffer uses a FIFO post-transform cache.
+// ACMR: transformed vertices per triangle (0.5 is perfect on large meshes, 3 is no reuse at all).
+// ATVR: transformed vertices per referenced vertex (1 is perfect).
+struct VertexCacheStats
+{
+	float acmr;
+	float atvr;
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize = VertexCacheSize);
+
+// Reorders triangles for post-transform cache locality (Tipsify, Sander et al. 2007).
+// If clusters is given, it receives the first triangle of each run between two dead ends.
+void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize = VertexCacheSize,
+	std::vector<size_t> * clusters = nullptr);
+
+// Splits the clusters further wherever it costs little cache efficiency, then sorts them so
+// that outward facing clusters come first and hide what is behind them. threshold is the
+// ACMR factor a split may cost. Expects the order optimizeVertexCache produced.
+void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices,
+	const std::vector<size_t> & clusters, float threshold = 1.05f, unsigned int cacheSize = VertexCacheSize);
+
+// Renumbers the vertices in the order the triangles first use them and drops unused ones
+void optimizeVertexFetch(std::vector<unsigned int> & indices, std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs, std::vector<glm::vec3> & normals);
+
+// All of the above, in the right order. Prints ACMR and ATVR before and after.
+void optimizeMesh(std::vector<unsigned int> & indices, std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs, std::vector<glm::vec3> & normals);
+
+#endif
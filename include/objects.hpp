@@ -1,8 +1,49 @@
 #ifndef OBJECTS_HPP
 #define OBJECTS_HPP
 
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+#include "procedural.hpp"
+
+struct MeshBuffers;
+
 void drawWireCube(); // Wuerfel mit Kantenlaenge 2 im Drahtmodell
 void drawCube();     // Bunter Wuerfel mit Kantenlaenge 2
 void drawSphere(GLuint slices, GLuint stacks); // Kugel mit radius 1 bzw. Durchmesser 2
+void drawShape(const ShapeParams & shape);     // Generierte Form, siehe procedural.hpp
+
+// Instanced versions: one draw call for count copies, each with its own model matrix.
+// The matrices are read as vertex attributes 3 to 6, see StandardShadingInstanced.vertexshader.
+const GLuint InstanceMatrixAttribute = 3;
+// Layer of the texture array per instance, see texturearray.hpp. Draws without layers of their own
+// leave the attribute disabled, then the value set with glVertexAttribI1i counts for every instance.
+const GLuint InstanceLayerAttribute = 7;
+void drawCubeInstanced(const glm::mat4 * models, GLsizei count);
+void drawSphereInstanced(GLuint slices, GLuint stacks, const glm::mat4 * models, GLsizei count);
+void drawMeshInstanced(const MeshBuffers & mesh, const glm::mat4 * models, GLsizei count);
+
+// What a draw call of an object needs, for code that issues the draws itself (see RenderQueue)
+struct DrawGeometry
+{
+	GLuint vertexArray;
+	GLenum mode;      // GL_TRIANGLES, GL_TRIANGLE_STRIP
+	GLint first;      // first vertex, or first index if indexType is set
+	GLsizei count;    // vertices, or indices if indexType is set
+	GLenum indexType; // 0 for glDrawArrays
+	Bounds bounds;    // in object space
+};
+DrawGeometry cubeGeometry();
+DrawGeometry sphereGeometry(GLuint slices, GLuint stacks);
+// Generated on the first use of the parameters, then cached until deleteShapes
+DrawGeometry shapeGeometry(const ShapeParams & shape);
+void deleteShapes();
+// level selects one of mesh.lods
+DrawGeometry meshGeometry(const MeshBuffers & mesh, size_t level = 0);
+void drawInstanced(const DrawGeometry & geometry, const glm::mat4 * models, GLsizei count, const GLint * layers = nullptr);
+// The instanced draws set up the instance attributes of a vertex array once. Call it when the vertex
+// array is deleted, GL hands out the name again and the new one needs them set up too.
+void forgetInstancedVertexArray(GLuint vertexArray);
 
 #endif
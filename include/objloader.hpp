@@ -8,9 +8,37 @@ bool loadOBJ(
 	std::vector<glm::vec3> & out_normals
 );
 
+// Like loadOBJ, but every distinct (v, vt, vn) combination becomes one vertex
+// and the triangles are returned as 32-bit indices into the vertex arrays
+bool loadOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+// Parses and indexes the OBJ file like loadOBJIndexed, but never touches the mesh cache and
+// skips the vertex cache optimization and the levels of detail: what every cold load starts with
+bool parseOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+class MeshCache;
+
+// Loads through the binary mesh cache and leaves it mapped in mesh, so the
+// arrays can be uploaded without a copy. If the cache can't be written (e.g. a
+// read-only directory), mesh holds the parsed arrays instead (MeshCache::assign).
+// Fails only if the OBJ file can't be read.
+bool loadOBJCached(const char * path, MeshCache & mesh);
+
 bool loadAssImp(
 	const char * path, 
-	std::vector<unsigned short> & indices,
+	std::vector<unsigned int> & indices,
 	std::vector<glm::vec3> & vertices,
 	std::vector<glm::vec2> & uvs,
 	std::vector<glm::vec3> & normals
@@ -0,0 +1,51 @@
+#ifndef PROCEDURAL_HPP
+#define PROCEDURAL_HPP
+
+#include <compare>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Generated shapes, all fit into the cube from -1 to 1 and are closed, indexed triangle meshes
+// with counter clockwise front faces. The axis of the round ones is z.
+enum class ShapeType
+{
+	Cube,
+	Sphere,    // uv sphere, slices around z, stacks from pole to pole
+	Icosphere, // subdivided icosahedron, the same triangle size everywhere
+	Cylinder,  // with caps
+	Cone,      // apex at z = 1, base at z = -1
+	Torus      // around z, tube radius given, the whole torus scaled into the cube
+};
+
+// Which shape with which tessellation. Parameters a shape doesn't use are 0, so equal
+// meshes have equal parameters and the parameters can be the key of a cache (see shapeGeometry).
+struct ShapeParams
+{
+	ShapeType type{ShapeType::Cube};
+	unsigned int slices{0};   // around z; torus: around its center line
+	unsigned int stacks{0};   // along z; torus: around the tube; icosphere: subdivisions
+	float tubeRadius{0.0f};   // torus only, relative to the radius of its center line
+
+	auto operator<=>(const ShapeParams &) const = default;
+};
+
+// These clamp the tessellation to something sensible
+ShapeParams cubeShape();
+ShapeParams sphereShape(unsigned int slices, unsigned int stacks);
+ShapeParams icosphereShape(unsigned int subdivisions);
+ShapeParams cylinderShape(unsigned int slices, unsigned int stacks = 1);
+ShapeParams coneShape(unsigned int slices, unsigned int stacks = 1);
+ShapeParams torusShape(unsigned int slices, unsigned int tubeSlices, float tubeRadius = 0.25f);
+
+struct ShapeMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<unsigned int> indices;
+};
+
+ShapeMesh generateShape(const ShapeParams & shape);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Frame times over the frames the profiler still has, in milliseconds
+struct FrameTimeSummary
+{
+	size_t frames{0};
+	double cpu50{0.0}, cpu95{0.0}, cpu99{0.0};
+	size_t gpuFrames{0}; // with GPU times, the last few are still in flight
+	double gpu50{0.0}, gpu95{0.0}, gpu99{0.0};
+};
+
+// Nested CPU and GPU scopes per frame, on the render thread. CPU scopes read steady_clock, GPU scopes
+// put GL_TIMESTAMP queries around the commands in between, which are read back a few frames later
+// (GpuLatency) once the GPU is done with them, so the profiler never waits for it. A query the GPU
+// still hasn't finished when its slot comes round again is dropped instead.
+// Disabled, and outside of frames, begin() and end() only test a flag, so the scopes can stay in the code.
+class Profiler
+{
+public:
+	// Frames kept for the trace and the summary
+	static const size_t HistoryFrames = 600;
+	// Frames between issuing GPU queries and reading them
+	static const size_t GpuLatency = 4;
+
+	// Needs the GL context for the GPU scopes, without GL_ARB_timer_query there are only CPU scopes
+	Profiler();
+	~Profiler();
+	Profiler(const Profiler &) = delete;
+	Profiler & operator=(const Profiler &) = delete;
+
+	// Takes effect with the next beginFrame, so scopes never end that didn't begin
+	void setEnabled(bool enabled) { enabled_ = enabled; }
+	bool enabled() const { return enabled_; }
+
+	// Around everything of a frame, including the buffer swap. Reads the GPU times that arrived.
+	void beginFrame();
+	void endFrame();
+
+	// name has to outlive the profiler, string literals do
+	void begin(const char * name) { if (recording_) beginScope(name, false); }
+	void end() { if (recording_) endScope(false); }
+	void beginGpu(const char * name) { if (recording_ && gpu_) beginScope(name, true); }
+	void endGpu() { if (recording_ && gpu_) endScope(true); }
+
+	// Chrome's about:tracing / Perfetto JSON of the frames kept, CPU and GPU on a track each
+	bool writeChromeTrace(const char * path) const;
+	FrameTimeSummary summary() const;
+	// The summary and the average of each scope per frame
+	void printSummary() const;
+
+	// Deletes the queries, while the context still exists
+	void release();
+
+private:
+	struct Event
+	{
+		const char * name;
+		int64_t begin, end; // nanoseconds since the profiler was created, GPU ones moved to the CPU clock
+		uint32_t depth;
+	};
+
+	struct Frame
+	{
+		uint64_t index;
+		int64_t begin, end;
+		std::vector<Event> cpu;
+		std::vector<Event> gpu; // empty until read back
+		bool gpuDone{false};
+	};
+
+	// The queries of one frame in flight
+	struct GpuFrame
+	{
+		uint64_t index{0};
+		bool pending{false};
+		std::vector<GLuint> queries;   // two per scope, begin and end
+		std::vector<Event> events;     // begin and end index into queries until read back
+		size_t used{0};                // queries issued
+		std::vector<uint32_t> stack;   // open scopes
+	};
+
+	void beginScope(const char * name, bool gpu);
+	void endScope(bool gpu);
+	int64_t now() const;
+	void calibrate();
+	// false if the GPU isn't done with them yet
+	bool readGpuFrame(GpuFrame & gpuFrame);
+	Frame * findFrame(uint64_t index);
+
+	bool enabled_{true};
+	bool recording_{false}; // in a frame that began enabled
+	bool gpu_{false};
+	std::chrono::steady_clock::time_point start_;
+	int64_t gpuOffset_{0}; // CPU time minus GPU time, in nanoseconds
+	uint64_t frameIndex_{0};
+
+	Frame current_{};
+	std::vector<uint32_t> cpuStack_; // open scopes, indices into the events
+	std::deque<Frame> history_;
+	GpuFrame gpuFrames_[GpuLatency];
+	size_t droppedGpuFrames_{0};
+};
+
+// Begins a CPU scope, and a GPU scope with the same name if gpu is set, and ends them at the end of the block
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler & profiler, const char * name, bool gpu = false) : profiler_(profiler), gpu_(gpu)
+	{
+		profiler_.begin(name);
+		if (gpu_)
+			profiler_.beginGpu(name);
+	}
+	~ProfileScope()
+	{
+		if (gpu_)
+			profiler_.endGpu();
+		profiler_.end();
+	}
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope & operator=(const ProfileScope &) = delete;
+
+private:
+	Profiler & profiler_;
+	bool gpu_;
+};
+
+#endif
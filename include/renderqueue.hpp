@@ -0,0 +1,109 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+#include "objects.hpp"
+#include "shaderpermutation.hpp"
+
+class JobSystem;
+class ShaderProgram;
+struct MeshBuffers;
+
+enum class RenderPass : uint8_t
+{
+	Opaque = 0,
+	Transparent = 1,
+	Overlay = 2
+};
+
+// Packets are executed in ascending key order. From the most significant bit:
+//   Opaque, Overlay: pass 4 | program 12 | material 12 | mesh 12 | depth 24, front to back
+//   Transparent:     pass 4 | depth 24, back to front | program 12 | material 12 | mesh 12
+// program, material and mesh only have to tell draws apart, GL names are fine.
+// depth is the view space distance divided by the far plane and gets clamped to [0, 1].
+uint64_t makeSortKey(RenderPass pass, GLuint program, GLuint material, GLuint mesh, float depth);
+
+// One draw, with everything that has to be bound for it
+struct DrawPacket
+{
+	uint64_t key{0};
+	ShaderProgram * program{nullptr};
+	DrawGeometry geometry{};
+	GLuint texture{0};                 // GL_TEXTURE_2D on unit 0, 0 keeps the current binding
+	GLuint textureArray{0};            // GL_TEXTURE_2D_ARRAY on TextureArrayUnit, 0 keeps the current binding
+	GLint layer{-1};                   // of textureArray for models without a layer of their own, -1 samples texture
+	const MeshBuffers * mesh{nullptr}; // packed meshes get their dequantization uniforms from here
+	bool instanced{false};             // models go to the instance attributes instead of M and MVP
+};
+
+// Uniforms that are the same for every draw of a frame. They are sent when a program
+// is used for the first time in the frame, the value cache of ShaderProgram skips the rest.
+struct FrameUniforms
+{
+	glm::mat4 view{1.0f};
+	glm::mat4 projection{1.0f};
+	glm::vec3 lightPositions[MaxShaderLights]{};
+	unsigned int lightCount{1}; // the programs should be the variants for as many, see shaderLights
+};
+
+struct CullStats
+{
+	size_t visible{0}; // model matrices, an instanced packet counts once per instance
+	size_t culled{0};
+	double milliseconds{0.0};
+};
+
+// Collects the draws of a frame so they can run grouped by program, material and mesh
+// instead of in the order the scene is walked. All storage is reused from frame to frame.
+class RenderQueue
+{
+public:
+	// Copies the packet and the model matrices. A packet that isn't instanced
+	// is drawn once per model matrix. layers, if given, has a texture array layer per model,
+	// so models with different textures of one array can still be one instanced draw.
+	void submit(const DrawPacket & packet, const glm::mat4 * models, GLsizei count = 1, const GLint * layers = nullptr);
+	// Everything submitted to other behind what is already here, to merge the queues
+	// that threads filled each on their own
+	void append(const RenderQueue & other);
+
+	// Drops the model matrices whose bounds are outside the frustum, and packets
+	// that have none left. Call before sort(). With jobs, the bounds of the models
+	// are tested on its threads.
+	CullStats cull(const Frustum & frustum, JobSystem * jobs = nullptr);
+	// Radix sort on the keys, packets with equal keys keep their submission order
+	void sort();
+	// Draws the packets in sorted order (submission order if sort() wasn't called)
+	void execute(const FrameUniforms & frame);
+	void clear();
+
+	size_t size() const { return packets_.size(); }
+
+private:
+	struct Entry
+	{
+		DrawPacket packet;
+		uint32_t firstModel;
+		uint32_t modelCount;
+		bool layered; // its models have their own layers
+	};
+
+	std::vector<Entry> packets_;
+	std::vector<glm::mat4> models_;
+	std::vector<GLint> layers_; // one per model
+	std::vector<uint32_t> order_;
+	// Scratch buffers of the culling
+	std::vector<glm::vec4> spheres_;
+	std::vector<uint8_t> visible_;
+	// Scratch buffers of the sort
+	std::vector<uint64_t> keys_, keysTemp_;
+	std::vector<uint32_t> orderTemp_;
+	bool sorted_{false};
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SCENEGRAPH_HPP
+#define SCENEGRAPH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class JobSystem;
+
+// Transform hierarchy stored as flat arrays. A node can only be added after its parent,
+// so parents always come first and one forward pass updates all world matrices.
+// Only nodes whose local matrix changed since the last update, and their descendants, are recomputed.
+class SceneGraph
+{
+public:
+	typedef uint32_t Node;
+	static const Node NoParent = ~0u;
+
+	Node add(Node parent, const glm::mat4 & local = glm::mat4(1.0f));
+	// Marks the node dirty, unless the matrix is the one it already has
+	void setLocal(Node node, const glm::mat4 & local);
+
+	Node parent(Node node) const { return parents_[node]; }
+	const glm::mat4 & local(Node node) const { return locals_[node]; }
+	// Valid after update()
+	const glm::mat4 & world(Node node) const { return worlds_[node]; }
+	size_t size() const { return parents_.size(); }
+
+	// Recomputes the world matrices of the dirty subtrees, returns how many nodes it touched
+	size_t update();
+	// The same on the threads of jobs. The nodes of one depth only need the depth above,
+	// so the depths go one after the other and the nodes of each are spread over the threads.
+	size_t update(JobSystem & jobs);
+	void clear();
+
+private:
+	std::vector<Node> parents_;
+	std::vector<glm::mat4> locals_;
+	std::vector<glm::mat4> worlds_;
+	std::vector<uint8_t> dirty_;
+	std::vector<uint32_t> depths_;
+	std::vector<std::vector<Node>> levels_; // the nodes of each depth, ascending
+	size_t firstDirty_{0}; // nothing before this index is dirty, size() if nothing is
+};
+
+#endif
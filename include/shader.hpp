@@ -1,6 +1,32 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+#include <string>
+#include <vector>
+
+// Takes the program from the binary cache in CACHE_DIR if it was linked before from the same
+// sources by the same driver, otherwise compiles and links it and stores its binary there.
+// Both shaders go through preprocessShader with the same defines.
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines = nullptr);
+
+// Where the programs of LoadShaders came from and how long it took, for cold and warm starts.
+// LoadShaders may run on several threads with their own contexts, the stats are a copy.
+struct ShaderCacheStats
+{
+	unsigned int loaded{0};   // from the binary cache
+	unsigned int compiled{0}; // from the sources
+	unsigned int rejected{0}; // cached binaries the driver refused, compiled again
+	double milliseconds{0.0};
+};
+ShaderCacheStats shaderCacheStats();
+
+// Off: always compile and write nothing, as on the first start
+void setShaderCacheEnabled(bool enabled);
+
+// The file with every #include "name" line replaced by that file, relative to the including one.
+// A file is included once per shader, later #includes of it are dropped, so there are no include guards.
+// defines ("#define NAME value" lines) go right after the #version line. #line directives keep the
+// line numbers of the messages right, source string number i in them is files[i] (files[0] is path).
+bool preprocessShader(const char * path, const char * defines, std::string & source, std::vector<std::string> * files = nullptr);
 
 #endif
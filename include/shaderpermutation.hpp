@@ -0,0 +1,59 @@
+#ifndef SHADERPERMUTATION_HPP
+#define SHADERPERMUTATION_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "shaderprogram.hpp"
+
+class ShaderReloader;
+
+// What a variant of the StandardShading shaders computes. Each bit is a #define for both shaders
+// (see StandardShading.glsl), so a variant only pays for what its draws need.
+enum ShaderFeature : uint32_t
+{
+	ShaderTexture = 1u << 0,  // TEXTURE: sample the texture (arrays), otherwise MaterialColor
+	ShaderSpecular = 1u << 1, // SPECULAR: specular highlight
+};
+
+// LIGHT_COUNT goes into the bits above the features, 1 to MaxShaderLights
+const unsigned int MaxShaderLights = 4;
+const uint32_t ShaderLightShift = 8;
+inline uint32_t shaderLights(unsigned int count) { return count << ShaderLightShift; }
+
+// The #define lines of a feature mask
+std::string shaderDefines(uint32_t features);
+
+// The variants of one pair of shader files, compiled the first time they are asked for and looked up
+// by their feature mask after that. LoadShaders takes them from the binary cache where it can.
+class ShaderPermutations
+{
+public:
+	// defines go in front of those of the features, for constants like LIGHT_POWER.
+	// setup runs for each new variant, e.g. to assign the sampler units.
+	ShaderPermutations(const char * vertexPath, const char * fragmentPath, const char * defines = nullptr,
+		std::function<void(ShaderProgram &)> setup = {});
+	ShaderPermutations(const ShaderPermutations &) = delete;
+	ShaderPermutations & operator=(const ShaderPermutations &) = delete;
+
+	// Stays at the same address, packets and the reloader can keep pointers to it
+	ShaderProgram & get(uint32_t features);
+
+	// The variants there are and the ones built from now on are rebuilt when their files change
+	void watch(ShaderReloader & reloader);
+
+	size_t size() const { return variants_.size(); }
+
+	// Deletes the programs, while the context still exists
+	void release();
+
+private:
+	std::string vertexPath_, fragmentPath_, defines_;
+	std::function<void(ShaderProgram &)> setup_;
+	ShaderReloader * reloader_{nullptr};
+	std::unordered_map<uint32_t, ShaderProgram> variants_; // nodes don't move
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef SHADERPROGRAM_HPP
+#define SHADERPROGRAM_HPP
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// A linked program together with everything glGetActive* reports about it.
+// The reflection runs once, so drawing never has to ask the driver for locations.
+// Uniform uploads go through set(), which skips values the program already has.
+// The program object itself still belongs to the caller (glDeleteProgram(id())).
+class ShaderProgram
+{
+public:
+	struct Uniform
+	{
+		std::string name; // arrays without the "[0]", their other elements follow as "name[1]" and so on
+		GLint location;   // -1 for uniforms inside blocks
+		GLenum type;
+		GLint size;
+	};
+
+	struct Attribute
+	{
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint size;
+	};
+
+	struct UniformBlock
+	{
+		std::string name;
+		GLuint index;
+		GLint dataSize;
+		GLint binding;
+	};
+
+	// The uniforms the renderer sets per program and per draw. Their locations are looked up once with
+	// the reflection, so the draws pass the slot instead of a name and never compare strings.
+	enum class UniformSlot
+	{
+		M,
+		V,
+		P,
+		VP,
+		MVP,
+		PositionScale,
+		PositionBias,
+		UVScale,
+		UVBias,
+		Light0, // LightPosition_worldspace, one slot per element
+		Light1,
+		Light2,
+		Light3,
+		Count
+	};
+
+	ShaderProgram() { slots_.fill(-1); }
+	explicit ShaderProgram(GLuint programID);
+
+	GLuint id() const { return id_; }
+
+	// Locations, -1 if the program has no such active variable
+	GLint uniform(const char * name) const;
+	GLint uniform(UniformSlot slot) const { return slots_[size_t(slot)]; }
+	GLint attribute(const char * name) const;
+	// Block index, GL_INVALID_INDEX if there is no such block
+	GLuint uniformBlock(const char * name) const;
+
+	const std::vector<Uniform> & uniforms() const { return uniforms_; }
+	const std::vector<Attribute> & attributes() const { return attributes_; }
+	const std::vector<UniformBlock> & uniformBlocks() const { return blocks_; }
+
+	// Make the program current if necessary and upload the value if it changed.
+	// Unknown names and inactive uniforms are ignored, like glUniform* with location -1.
+	// The names are looked up on every call, per draw use the slots or locations.
+	template <typename T>
+	void set(UniformSlot slot, const T & value) { set(uniform(slot), value); }
+	void set(const char * name, GLint value) { set(uniform(name), value); }
+	void set(const char * name, float value) { set(uniform(name), value); }
+	void set(const char * name, const glm::vec2 & value) { set(uniform(name), value); }
+	void set(const char * name, const glm::vec3 & value) { set(uniform(name), value); }
+	void set(const char * name, const glm::vec4 & value) { set(uniform(name), value); }
+	void set(const char * name, const glm::mat4 & value) { set(uniform(name), value); }
+	void set(GLint location, GLint value);
+	void set(GLint location, float value);
+	void set(GLint location, const glm::vec2 & value);
+	void set(GLint location, const glm::vec3 & value);
+	void set(GLint location, const glm::vec4 & value);
+	void set(GLint location, const glm::mat4 & value);
+
+	// Forget the uploaded values, e.g. after the program was changed with glUniform* directly
+	void invalidateValues();
+
+	// Switches to another build of the program, e.g. one compiled from edited sources. The values
+	// uploaded so far are sent to the new program for the uniforms it has with the same name and type.
+	// Returns the old program, which the caller deletes like the first one.
+	GLuint replace(GLuint programID);
+
+private:
+	// Returns true if the value differs from the last one uploaded to location and remembers it
+	bool changed(GLint location, const void * value, size_t size);
+
+	struct CachedValue
+	{
+		bool valid{false};
+		float data[16];
+	};
+
+	GLuint id_{0};
+	std::vector<Uniform> uniforms_;
+	std::vector<Attribute> attributes_;
+	std::vector<UniformBlock> blocks_;
+	std::vector<CachedValue> values_; // indexed by uniform location
+	std::array<GLint, size_t(UniformSlot::Count)> slots_;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SHADERRELOAD_HPP
+#define SHADERRELOAD_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+class ShaderProgram;
+struct GLFWwindow;
+
+// Rebuilds programs whose source files, or files they include, changed while the application runs. The directory is watched
+// with inotify (elsewhere the modification times are polled). A changed program is compiled next to
+// the rendering, by the driver's own threads where GL_KHR_parallel_shader_compile exists, otherwise
+// with LoadShaders on a worker thread with a hidden context that shares the objects of the window.
+// The new build replaces the program only after it linked, a broken edit keeps the old one running.
+class ShaderReloader
+{
+public:
+	// On the render thread, with window's context current
+	ShaderReloader(GLFWwindow * window, const char * directory);
+	~ShaderReloader();
+	ShaderReloader(const ShaderReloader &) = delete;
+	ShaderReloader & operator=(const ShaderReloader &) = delete;
+
+	// The paths and the files they include have to be inside the directory. defines as for LoadShaders.
+	void watch(ShaderProgram & program, const char * vertexPath, const char * fragmentPath, const char * defines = nullptr);
+
+	// Once per frame on the render thread: looks for changed files, starts the builds
+	// and swaps in the finished ones. Never waits for a compile. Returns the programs replaced.
+	unsigned int update();
+
+	bool parallelCompile() const { return parallel_; }
+
+	// Stops the worker and deletes the unfinished builds, while the context still exists
+	void release();
+
+private:
+	struct Program
+	{
+		ShaderProgram * program;
+		std::string vertexPath, fragmentPath, defines;
+		std::vector<std::string> files; // the two and what they include, as of the last build
+		std::vector<long long> times;   // polled modification times of files
+		bool building{false};
+		bool changedAgain{false}; // while building, build once more afterwards
+		// Parallel compile: the objects the driver is still working on
+		GLuint vertexShader{0}, fragmentShader{0}, build{0};
+	};
+
+	void track(Program & program);
+	void changed(const std::string & name);
+	void start(Program & program);
+	bool finished(Program & program, GLuint & build);
+	bool swap(Program & program, GLuint build);
+	void work();
+
+	std::vector<Program> programs_;
+	bool parallel_{false};
+	std::string directory_;
+	int inotify_{-1};
+	double lastPoll_{0.0};
+
+	// Worker with the shared context, when the driver doesn't compile in parallel
+	GLFWwindow * context_{nullptr};
+	std::thread worker_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<size_t> requests_;                  // indices into programs_
+	std::deque<std::pair<size_t, GLuint>> results_;
+	bool stopping_{false};
+};
+
+#endif
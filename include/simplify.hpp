@@ -0,0 +1,41 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// One level of detail, a range of a shared index buffer. All levels use the same vertices.
+struct MeshLOD
+{
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	float error; // how far the surface may be from the full mesh, in object space units
+};
+
+// At most this many levels, the full mesh included
+const size_t MaxLODLevels = 5;
+
+// Greedy edge collapse ordered by quadric error (Garland and Heckbert 1997). Vertices only
+// ever move onto one of their neighbours, so the result indexes the same vertex arrays.
+// Vertices that share a position move together, each onto the neighbour's vertex with the
+// closest uv and normal, and that attribute distance is part of the collapse cost.
+// Returns the new indices; error receives the largest geometric error of the collapses.
+std::vector<unsigned int> simplifyMesh(const std::vector<unsigned int> & indices,
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	size_t targetIndexCount, float & error);
+
+// Appends coarser levels, each with about half the triangles of the one before, to indices
+// and describes all levels including the full mesh in lods. Stops early when a level would
+// be too small or hardly smaller than the previous one.
+void buildLODChain(std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices, const std::vector<glm::vec2> & uvs, const std::vector<glm::vec3> & normals,
+	std::vector<MeshLOD> & lods);
+
+// Coarsest level whose error, projected at the given distance, stays below maxPixelError.
+// pixelsPerUnit is the size in pixels of one world unit at distance 1 (viewport height * P[1][1] / 2),
+// scale the largest scale factor of the model matrix.
+size_t selectLOD(const std::vector<MeshLOD> & lods, float distance, float scale, float pixelsPerUnit, float maxPixelError = 1.0f);
+
+#endif
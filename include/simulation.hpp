@@ -0,0 +1,101 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include "spscqueue.hpp"
+#include "triplebuffer.hpp"
+
+// What the input moves, the scene is placed from it every frame
+struct SimulationState
+{
+	glm::vec3 position{};
+	glm::vec3 angle{};           // of the world around x, y and z
+	glm::vec4 robotModules{};    // joint angles of modules 1 to 3, w turns the whole robot
+};
+
+// What a key does while it is held
+enum class Control : uint8_t
+{
+	MoveUp, MoveDown, MoveLeft, MoveRight, MoveAway, MoveCloser,
+	RotateX, RotateY, RotateZ,
+	TurnRobot,
+	BendJoint // module is the joint that bends
+};
+
+struct InputEvent
+{
+	Control control;
+	bool pressed; // false when the key is released
+	uint8_t module{0};
+};
+
+struct SimulationStats
+{
+	uint64_t ticks{0};
+	uint64_t skippedTicks{0}; // dropped after a stall instead of simulated in a burst
+	uint64_t events{0};
+	uint64_t droppedEvents{0}; // the queue was full
+};
+
+// Runs the state on a thread of its own at a fixed timestep, so it moves at the same speed whatever
+// the frame rate and the key repeat rate. Input arrives through a single producer single consumer
+// queue and is applied at the next tick, each tick publishes the last two states through a triple
+// buffer and the render thread interpolates between them: it shows the state of one tick ago,
+// smoothly, without ever waiting for the simulation or the other way round.
+class Simulation
+{
+public:
+	static constexpr double TickSeconds = 1.0 / 120.0;
+	// Further behind than that, e.g. after a debugger stop, the missed ticks are skipped
+	static const unsigned int MaxCatchUpTicks = 30;
+
+	explicit Simulation(const SimulationState & initial = SimulationState{});
+	~Simulation();
+	Simulation(const Simulation &) = delete;
+	Simulation & operator=(const Simulation &) = delete;
+
+	// From one thread only, the one with the input callbacks. false if the queue is full.
+	bool post(const InputEvent & event);
+
+	// From one thread only, the render thread: the state one tick before now
+	SimulationState sample();
+
+	// Ends the thread, the stats are complete after that
+	void stop();
+	const SimulationStats & stats() const { return stats_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// The two latest ticks, the state at time tick * TickSeconds is current
+	struct Frame
+	{
+		SimulationState previous;
+		SimulationState current;
+		uint64_t tick{0};
+	};
+
+	void run();
+	void apply(const InputEvent & event);
+	void step(SimulationState & state) const;
+
+	Clock::time_point start_;
+	SimulationState initial_;
+	SpscQueue<InputEvent, 256> input_;
+	TripleBuffer<Frame> frames_;
+	std::atomic<bool> stopping_{false};
+	std::atomic<uint64_t> droppedEvents_{0};
+	SimulationStats stats_{};
+	// Simulation thread only
+	uint32_t held_{0}; // a bit per Control
+	uint8_t bending_{0};
+	std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded queue for one thread that pushes and one thread that pops, without locks: each side
+// only writes its own index and reads the other's. Capacity has to be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+public:
+	// Producer only. false if the queue is full, the value isn't queued then.
+	bool push(const T & value)
+	{
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items_[tail & (Capacity - 1)] = value;
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only. false if the queue is empty.
+	bool pop(T & value)
+	{
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return false;
+		value = items_[head & (Capacity - 1)];
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	// On cache lines of their own, or the two threads would keep taking the line from each other
+	alignas(64) std::atomic<size_t> head_{0}; // next to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail_{0}; // next to push, written by the producer
+	alignas(64) T items_[Capacity]{};
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "vertexformat.hpp"
+
+class MeshCache;
+
+struct StreamingStats
+{
+	size_t resources{0};     // finished, failed ones included
+	size_t bytes{0};         // uploaded through the staging buffer
+	size_t maxFrameBytes{0};
+	unsigned long uploadFrames{0}; // frames that uploaded anything
+	unsigned long waitFrames{0};   // frames that skipped uploading because the GPU still read the staging space
+	double maxUpdateMilliseconds{0.0};
+};
+
+// Loads BMP and DDS textures and OBJ meshes in the background. Worker threads read and decode the files,
+// the render thread copies at most a budget of bytes per frame into a staging buffer and lets GL
+// move them into the textures (pixel unpack) and vertex buffers (buffer copy) from there.
+// The staging buffer is persistently mapped where GL_ARB_buffer_storage exists, otherwise mapped
+// unsynchronized each frame. It has one part per frame in flight, each guarded by a fence, so
+// neither side ever waits for the other. Until a resource is complete its placeholder is returned:
+// a grey checker texture or a small sphere.
+class StreamingLoader
+{
+public:
+	typedef size_t Handle;
+
+	static const size_t FramesInFlight = 3;
+
+	// Needs the GL context. stagingBytes is per frame in flight and limits the budget of update.
+	explicit StreamingLoader(unsigned int threads = 2, size_t stagingBytes = 2 * 1024 * 1024);
+	~StreamingLoader();
+	StreamingLoader(const StreamingLoader &) = delete;
+	StreamingLoader & operator=(const StreamingLoader &) = delete;
+
+	// A BMP file gets its mipmaps built on the worker, a 2D .dds file is uploaded with the compressed levels it has
+	Handle requestTexture(const char * path);
+	// onLoaded runs on the worker thread with the mapped mesh, e.g. to build a BVH from it.
+	// Whatever it writes may be used once ready() returns true.
+	Handle requestMesh(const char * path, std::function<void(const MeshCache &)> onLoaded = {});
+
+	// Once per frame on the render thread
+	void update(size_t budgetBytes);
+
+	bool ready(Handle handle) const;
+	bool idle() const; // every request finished or failed
+	GLuint texture(Handle handle) const;
+	const MeshBuffers & mesh(Handle handle) const;
+	const StreamingStats & stats() const { return stats_; }
+
+	// Deletes the GL objects, while the context still exists
+	void release();
+
+private:
+	struct Resource;
+	// One upload out of the staging buffer, recorded while it is mapped and issued afterwards
+	struct Copy
+	{
+		Resource * resource;
+		size_t stagingOffset;
+		size_t size;
+		size_t offset; // into the resource's stream: vertices then indices, or rows of pixels
+	};
+
+	void work();
+	void load(Resource & resource);
+	bool stage(Resource & resource, unsigned char * staging, size_t & used, size_t budget, std::vector<Copy> & copies);
+	void issue(const Copy & copy);
+	void finish(Resource & resource);
+
+	std::vector<std::unique_ptr<Resource>> resources_;
+	std::deque<Resource *> uploading_; // render thread only
+
+	// Handed between the threads
+	mutable std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<Resource *> pending_;
+	std::deque<Resource *> loaded_;
+	bool stopping_{false};
+	std::vector<std::thread> workers_;
+
+	GLuint staging_{0};
+	unsigned char * persistent_{nullptr};
+	size_t stagingBytes_;
+	GLsync fences_[FramesInFlight]{};
+	unsigned long frame_{0};
+
+	GLuint placeholderTexture_{0};
+	MeshBuffers placeholderMesh_;
+	StreamingStats stats_;
+};
+
+#endif
@@ -1,14 +1,70 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
 // Load a .BMP file using our custom loader
 GLuint loadBMP_custom(const char * imagepath);
 
+// Pixels of a 24 bit BMP as stored in the file: bottom row first, BGR, rows padded to 4 bytes
+struct BitmapImage
+{
+	unsigned int width{0};
+	unsigned int height{0};
+	std::vector<unsigned char> data;
+};
+
+// The file part of loadBMP_custom, doesn't touch GL so it can run on any thread
+bool decodeBMP(const char * imagepath, BitmapImage & image);
+
 // Load a .TGA file using GLFW's own loader
 // Geht nicht mehr ab GLFW3
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// Where the levels of a block compressed .DDS file are. Legacy DXT1/3/5 and BC4/5 files and
+// DX10 files with BC1 to BC7, texture arrays and cube maps are understood, 3D textures are not.
+struct DDSLayout
+{
+	GLenum format{0};       // compressed GL internal format
+	size_t blockBytes{0};   // per 4 x 4 block
+	unsigned int width{0};
+	unsigned int height{0};
+	unsigned int levels{1};
+	unsigned int arraySize{1};
+	unsigned int layers{1}; // array size times 6 for cube maps
+	bool cube{false};
+	bool array{false};      // arraySize from a DX10 header larger than 1
+	size_t dataOffset{0};   // of the first level
+
+	size_t levelSize(unsigned int level) const;
+	// Layers are ordered array element first, then cube face
+	size_t levelOffset(unsigned int layer, unsigned int level) const;
+};
+
+// Checks the header and that the file holds every level
+bool parseDDS(const char * data, size_t size, DDSLayout & layout);
+// Whether this GL has the compressed format parseDDS found. Only reads GLEW's flags, any thread can ask.
+bool ddsFormatSupported(GLenum format);
+
+struct DDSTexture
+{
+	GLuint id{0};
+	GLenum target{GL_TEXTURE_2D}; // 2D, 2D array, cube map or cube map array
+	unsigned int width{0};
+	unsigned int height{0};
+	unsigned int layers{1};       // array elements
+	unsigned int levels{0};
+	unsigned int firstLevel{0};   // of the file, the largest levels before it are left out
+};
+
+// Maps the file and uploads the levels from firstLevel on straight from the mapping into immutable
+// texture storage. A large firstLevel gives a quick low resolution texture to show until the full one is loaded.
+DDSTexture loadDDSTexture(const char * imagepath, unsigned int firstLevel = 0);
+
+// Load a .DDS file, as a GL_TEXTURE_2D unless it holds an array or a cube map
 GLuint loadDDS(const char * imagepath);
 
 
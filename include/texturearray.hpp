@@ -0,0 +1,74 @@
+#ifndef TEXTUREARRAY_HPP
+#define TEXTUREARRAY_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+struct RGBAImage;
+
+// The texture arrays are bound here, GL_TEXTURE0 keeps the single textures
+const GLenum TextureArrayUnit = GL_TEXTURE1;
+
+// Where a texture went: which of the arrays and which layer of it
+struct TextureSlot
+{
+	unsigned int array{0};
+	GLint layer{-1};
+
+	bool valid() const { return layer >= 0; }
+};
+
+// Packs textures of the same format, size and number of levels as layers into GL_TEXTURE_2D_ARRAYs.
+// Draws whose textures share an array only differ in the layer, which the shaders get per instance
+// (InstanceLayerAttribute), so differently textured copies of a mesh need no texture bind in between.
+// A full array is replaced with one of twice the layers, the layers it had are copied on the GPU.
+// Past GL_MAX_ARRAY_TEXTURE_LAYERS another array of the same format is started.
+class TextureArrays
+{
+public:
+	// Needs the GL context
+	explicit TextureArrays(unsigned int initialLayers = 4);
+	~TextureArrays();
+	TextureArrays(const TextureArrays &) = delete;
+	TextureArrays & operator=(const TextureArrays &) = delete;
+
+	// Level 0 of image, the smaller levels are generated (see buildMipChain). Stored as RGBA8.
+	TextureSlot add(const RGBAImage & image);
+	TextureSlot addBMP(const char * imagepath);
+	// All levels of the file, in its compressed format. Arrays and cube maps are refused.
+	TextureSlot addDDS(const char * imagepath);
+
+	// The GL name changes when the array grows, so ask again each frame
+	GLuint texture(unsigned int array) const { return arrays_[array].texture; }
+	size_t arrays() const { return arrays_.size(); }
+	unsigned int layers(unsigned int array) const { return arrays_[array].layers; }
+
+	// Deletes the GL objects, while the context still exists
+	void release();
+
+private:
+	struct Array
+	{
+		GLenum format;     // internal format
+		size_t blockBytes; // per 4 x 4 block, 0 for RGBA8
+		unsigned int width, height, levels;
+		GLuint texture;
+		unsigned int layers;   // used
+		unsigned int capacity; // allocated
+	};
+
+	// An array of this kind with a free layer, grown or created if there is none
+	TextureSlot reserve(GLenum format, size_t blockBytes, unsigned int width, unsigned int height, unsigned int levels);
+	GLuint allocate(const Array & array, unsigned int capacity) const;
+	void grow(Array & array, unsigned int capacity);
+	size_t levelSize(const Array & array, unsigned int level) const;
+
+	std::vector<Array> arrays_;
+	unsigned int initialLayers_;
+	unsigned int maxLayers_{256};
+	GLuint copyBuffer_{0}; // for growing without ARB_copy_image
+};
+
+#endif
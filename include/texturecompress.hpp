@@ -0,0 +1,44 @@
+#ifndef TEXTURECOMPRESS_HPP
+#define TEXTURECOMPRESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct BitmapImage;
+
+// The block compressed formats loadDDS reads as DXT1 and DXT5
+enum class BlockFormat
+{
+	BC1, // 8 bytes per 4 x 4 block, colour only
+	BC3  // 16 bytes per block, BC1 colour and a separate alpha block
+};
+
+// 8 bit sRGB colour and linear alpha, rows bottom first like GL expects them
+struct RGBAImage
+{
+	unsigned int width{0};
+	unsigned int height{0};
+	std::vector<uint8_t> pixels;
+};
+
+RGBAImage toRGBA(const BitmapImage & image);
+
+// Level 0 and all smaller levels down to 1 x 1. The box filter averages in linear light, sRGB colours
+// are decoded first and encoded again per level, so the levels don't get darker than the image.
+std::vector<RGBAImage> buildMipChain(const RGBAImage & image);
+
+// Encodes one level, the rows of blocks spread over threads (0: all hardware threads)
+std::vector<uint8_t> compressBlocks(const RGBAImage & image, BlockFormat format, unsigned int threads = 0);
+// How many of those threads compressBlocks starts for a level that high, at most one per row of blocks
+unsigned int compressionThreads(unsigned int height, unsigned int threads);
+size_t compressedSize(unsigned int width, unsigned int height, BlockFormat format);
+
+// DDS with one compressed level per entry, largest first. The rows are stored bottom first, the way
+// loadBMP_custom uploads them, so loadDDS shows the texture the same way (other DDS tools show it flipped).
+bool writeDDS(const char * path, BlockFormat format, unsigned int width, unsigned int height, const std::vector<std::vector<uint8_t>> & levels);
+
+// BMP to DDS with mipmaps, prints how long the steps took
+bool compressBMP(const char * bmpPath, const char * ddsPath, BlockFormat format);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value from one writer thread to one reader thread without locks and without
+// either waiting for the other. The writer fills the back slot and publishes it, the reader takes
+// whatever was published last; values published in between are skipped. The slots are swapped
+// through a single atomic index, the slot data itself is never shared.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Writer only: the slot to fill, then publish() it
+	T & back() { return slots_[back_]; }
+	void publish()
+	{
+		back_ = middle_.exchange(uint8_t(back_ | Fresh), std::memory_order_acq_rel) & Index;
+	}
+
+	// Reader only: makes the last published slot the front one, false if nothing was published since
+	bool update()
+	{
+		if (!(middle_.load(std::memory_order_relaxed) & Fresh))
+			return false;
+		front_ = middle_.exchange(front_, std::memory_order_acq_rel) & Index;
+		return true;
+	}
+	const T & front() const { return slots_[front_]; }
+
+private:
+	static const uint8_t Index = 3;
+	static const uint8_t Fresh = 4; // the middle slot was published and not taken yet
+
+	T slots_[3]{};
+	alignas(64) std::atomic<uint8_t> middle_{1};
+	alignas(64) uint8_t back_{0}; // the writer's
+	alignas(64) uint8_t front_{2}; // the reader's
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef VERTEXFORMAT_HPP
+#define VERTEXFORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+#include "simplify.hpp"
+
+// How the vertices of a mesh are stored on the GPU. Both formats are interleaved in one buffer.
+// Float:  position 3 x float, uv 2 x float, normal 3 x float                         = 32 bytes
+// Packed: position 3 x unorm16 (+ padding), uv 2 x unorm16, normal octahedral 2 x snorm16 = 16 bytes
+// Packed positions and uvs are relative to the bounding box of the mesh, see MeshBuffers.
+enum class VertexFormat
+{
+	Float,
+	Packed
+};
+
+struct FloatVertex
+{
+	glm::vec3 position;
+	glm::vec2 uv;
+	glm::vec3 normal;
+};
+
+struct PackedVertex
+{
+	uint16_t position[4]; // w is padding, keeps the attribute 4 byte aligned
+	uint16_t uv[2];
+	int16_t normal[2];
+};
+
+// A mesh only gets packed if no attribute moves further than this
+struct VertexQuantization
+{
+	float maxPositionError{1.0f / 16384.0f}; // relative to the bounding box diagonal
+	float maxUVError{1.0f / 8192.0f};        // in texture coordinates
+	float maxNormalError{0.002f};            // in radians
+	bool allowPacked{true};
+};
+
+class ShaderProgram;
+
+// Everything needed to draw an uploaded mesh
+struct MeshBuffers
+{
+	GLuint vertexArray{0};
+	GLuint vertexBuffer{0};
+	GLuint indexBuffer{0};
+	GLsizei indexCount{0}; // of the full mesh
+	size_t vertexCount{0};
+	VertexFormat format{VertexFormat::Float};
+	// Packed: decoded position = quantized * positionScale + positionBias, the same for uvs
+	glm::vec3 positionScale{1.0f};
+	glm::vec3 positionBias{0.0f};
+	glm::vec2 uvScale{1.0f};
+	glm::vec2 uvBias{0.0f};
+	Bounds bounds;
+	// Ranges of the index buffer, level 0 is the full mesh
+	std::vector<MeshLOD> lods;
+};
+
+// Chooses the format for the mesh, converts the vertices and uploads them into a new vertex array.
+// With lods, indices holds all levels (see MeshCache) and indexCount is that of the full mesh.
+MeshBuffers uploadMesh(
+	const unsigned int * indices, size_t indexCount,
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	const VertexQuantization & quantization = VertexQuantization{},
+	const std::vector<MeshLOD> & lods = {}
+);
+
+// The CPU half of uploadMesh, for loader threads: the mesh converted into its format, without GL objects
+struct PreparedMesh
+{
+	MeshBuffers mesh;
+	std::vector<unsigned char> vertexData;
+	size_t indexBufferCount{0}; // all levels
+};
+
+// Only converts, the indices go to createMeshBuffers as they are. Prints nothing, it runs on any thread.
+PreparedMesh prepareMesh(
+	size_t indexCount,
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	const VertexQuantization & quantization = VertexQuantization{},
+	const std::vector<MeshLOD> & lods = {}
+);
+
+// The GL half: creates the vertex array and its buffers. Without vertexData and indices
+// the buffers are only allocated, to be filled later (see StreamingLoader).
+void createMeshBuffers(MeshBuffers & mesh, size_t indexBufferCount, const void * vertexData, const unsigned int * indices);
+
+void deleteMesh(MeshBuffers & mesh);
+
+// Reports the format of the mesh and its vertex bytes against the 32 byte float layout.
+// What that saves in vertex fetch time is measured by CGTutorial_bench (vertexFetch/...).
+void printVertexFormat(const MeshBuffers & mesh);
+
+// Sets PositionScale, PositionBias, UVScale and UVBias of the packed vertex shader
+void sendMeshUniforms(ShaderProgram & program, const MeshBuffers & mesh);
+
+size_t vertexSize(VertexFormat format);
+
+#endif
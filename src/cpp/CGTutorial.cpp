@@ -1,243 +1,743 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
 #include <iostream>
-#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <memory>
+#include <string>
 #include <vector>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader.hpp"
+#include "shaderpermutation.hpp"
+#include "shaderprogram.hpp"
+#include "shaderreload.hpp"
+#include "simulation.hpp"
+#include "bvh.hpp"
+#include "frustum.hpp"
+#include "glstate.hpp"
+#include "headless.hpp"
+#include "jobsystem.hpp"
 #include "objects.hpp"
+#include "profiler.hpp"
+#include "renderqueue.hpp"
+#include "scenegraph.hpp"
+#include "simplify.hpp"
+#include "streaming.hpp"
+#include "texturearray.hpp"
+#include "texturecompress.hpp"
 // kuemmert sich um die Pfade zu den Shadern und Texturen
 #include "asset.hpp"
 #include "objloader.hpp"
+#include "meshcache.hpp"
+#include "vertexformat.hpp"
 #include "texture.hpp"
 
-glm::mat4 Projection{glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 100.0f)};
+const int window_width{1024};
+const int window_height{768};
+// Bytes the loader may move into GL per frame
+const size_t upload_budget{256 * 1024};
+const float z_near{0.1f};
+const float z_far{100.0f};
+glm::mat4 Projection{glm::perspective(45.0f, 4.0f / 3.0f, z_near, z_far)};
 glm::mat4 View {glm::lookAt(glm::vec3(0, 0, -5), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0))};
-glm::mat4 Model{};
-glm::vec3 angle{};
-glm::vec4 robot_modules{};
-glm::vec3 pos{};
+glm::vec3 light_position{};
+// The module the key J bends, the simulation moves it
 uint module{3};
+// Key P switches the profiler on and off
+bool profiling{true};
 
 void error_callback(int error, const char *description)
 {
 	std::cerr << error << '\n';
 }
 
+struct Scene;
+
+// What the key and mouse callbacks reach through the window user pointer
+struct InputTargets
+{
+	Simulation* simulation;
+	const Scene* scene;
+	const BVH* teapot; // only complete once the streamed teapot is ready
+	const StreamingLoader* loader;
+	StreamingLoader::Handle teapotMesh;
+};
+
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+	// The keys move things for as long as they are held, the simulation turns that into a speed.
+	// Repeats change nothing then.
+	if (action == GLFW_REPEAT)
+		return;
+	const bool pressed{action == GLFW_PRESS};
+	const InputTargets* targets{static_cast<const InputTargets*>(glfwGetWindowUserPointer(window))};
+	auto post{[&](Control control)
+	{
+		if (targets)
+			targets->simulation->post(InputEvent{control, pressed, uint8_t(module)});
+	}};
 	switch (key)
 	{
 	case GLFW_KEY_ESCAPE:
 		glfwSetWindowShouldClose(window, GL_TRUE);
 		break;
 	case GLFW_KEY_UP:
-		pos.y += 0.1f;
+		post(Control::MoveUp);
 		break;
 	case GLFW_KEY_DOWN:
-		pos.y -= 0.1f;
+		post(Control::MoveDown);
 		break;
 	case GLFW_KEY_LEFT:
-		pos.x += 0.1f;
+		post(Control::MoveLeft);
 		break;
 	case GLFW_KEY_RIGHT:
-		pos.x -= 0.1f;
+		post(Control::MoveRight);
 		break;
 	case GLFW_KEY_0:
-		pos.z += 0.1f;
+		post(Control::MoveAway);
 		break;
 	case GLFW_KEY_9:
-		pos.z -= 0.1f;
+		post(Control::MoveCloser);
 		break;
 	case GLFW_KEY_SPACE:
-		robot_modules.w += 0.05f;
+		post(Control::TurnRobot);
 		break;
 	case GLFW_KEY_1:
-		angle.x += 0.1f;
+		post(Control::RotateX);
 		break;
 	case GLFW_KEY_2:
-		angle.y += 0.1f;
+		post(Control::RotateY);
 		break;
 	case GLFW_KEY_3:
-		angle.z += 0.1f;
+		post(Control::RotateZ);
 		break;
 	case GLFW_KEY_A:
-		module = 1;
-		std::cout << "Modul: " << module << '\n';
+		if (pressed)
+		{
+			module = 1;
+			std::cout << "Modul: " << module << '\n';
+		}
 		break;
 	case GLFW_KEY_S:
-		module = 2;
-		std::cout << "Modul: " << module << '\n';
+		if (pressed)
+		{
+			module = 2;
+			std::cout << "Modul: " << module << '\n';
+		}
 		break;
 	case GLFW_KEY_D:
-		module = 3;
-		std::cout << "Modul: " << module << '\n';
+		if (pressed)
+		{
+			module = 3;
+			std::cout << "Modul: " << module << '\n';
+		}
+		break;
+	case GLFW_KEY_P:
+		if (pressed)
+		{
+			profiling = !profiling;
+			std::cout << "Profiler " << (profiling ? "an" : "aus") << '\n';
+		}
 		break;
 	case GLFW_KEY_J:
-		if (module == 1)
-			robot_modules.x += 0.05f;
-		else if (module == 2)
-			robot_modules.y += 0.05f;
-		else if (module == 3)
-			robot_modules.z += 0.05f;
+		post(Control::BendJoint);
 		break;
 	default:
 		break;
 	}
 }
 
-void sendMVP(GLuint programID)
+// The nodes of the scene. Nodes without a drawable only carry a transform for their children.
+struct Scene
 {
-	glm::mat4 MVP{Projection * View * Model};
-	glUniformMatrix4fv(glGetUniformLocation(programID, "MVP"), 1, GL_FALSE, &MVP[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(programID, "M"), 1, GL_FALSE, &Model[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(programID, "V"), 1, GL_FALSE, &View[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(programID, "P"), 1, GL_FALSE, &Projection[0][0]);
+	SceneGraph graph;
+	SceneGraph::Node world, teapot, axes[3], robot, joints[3], modules[3], light;
+	// Everything drawn with the teapot and the dragon mesh, the teapot above included
+	std::vector<SceneGraph::Node> teapots, dragons;
+};
+
+void build_scene(Scene& scene, float height)
+{
+	float axis_length{10.0f};
+	float axis_width{0.005f};
+	SceneGraph& graph{scene.graph};
+	scene.world = graph.add(SceneGraph::NoParent);
+	glm::mat4 teapot{glm::translate(glm::mat4(1.0f), glm::vec3(1.5, 0.0, 0.0))};
+	scene.teapot = graph.add(scene.world, glm::scale(teapot, glm::vec3(1.0 / 1000.0, 1.0 / 1000.0, 1.0 / 1000.0)));
+	// A row of copies further and further away, to have something for the levels of detail
+	scene.teapots.push_back(scene.teapot);
+	for (int i = 0; i < 6; ++i)
+	{
+		float distance{6.0f + 8.0f * i};
+		glm::mat4 copy{glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 0.0f, distance))};
+		scene.teapots.push_back(graph.add(scene.world, glm::scale(copy, glm::vec3(1.0 / 1000.0, 1.0 / 1000.0, 1.0 / 1000.0))));
+		glm::mat4 dragon{glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.0f, distance))};
+		scene.dragons.push_back(graph.add(scene.world, glm::scale(dragon, glm::vec3(0.5f, 0.5f, 0.5f))));
+	}
+	scene.axes[0] = graph.add(scene.world, glm::scale(glm::mat4(1.0f), glm::vec3(axis_length, axis_width, axis_width)));
+	scene.axes[1] = graph.add(scene.world, glm::scale(glm::mat4(1.0f), glm::vec3(axis_width, axis_length, axis_width)));
+	scene.axes[2] = graph.add(scene.world, glm::scale(glm::mat4(1.0f), glm::vec3(axis_width, axis_width, axis_length)));
+
+	// Each joint hangs 2 * height above the previous one and carries a module centered between them
+	scene.robot = graph.add(scene.world);
+	glm::mat4 module{glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, height))};
+	module = glm::scale(module, glm::vec3(0.2f, 0.2f, height));
+	SceneGraph::Node parent{scene.robot};
+	for (int i = 0; i < 3; ++i)
+	{
+		scene.joints[i] = graph.add(parent);
+		scene.modules[i] = graph.add(scene.joints[i], module);
+		parent = scene.joints[i];
+	}
+	scene.light = graph.add(scene.joints[2], glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 2 * height)));
 }
 
-void save_and_restore(const std::function<void()>& callback)
+// Places the scene as the simulation has it. Unchanged transforms don't mark their subtree dirty.
+void update_scene(Scene& scene, float height, const SimulationState& state, JobSystem& jobs)
 {
-	glm::mat4 Save{Model};
-	callback();
-	Model = Save;
+	SceneGraph& graph{scene.graph};
+	glm::mat4 world{glm::translate(glm::mat4(1.0f), state.position)};
+	world = glm::rotate(world, state.angle.x, glm::vec3(1.0f, 0.0f, 0.0f));
+	world = glm::rotate(world, state.angle.y, glm::vec3(0.0f, 1.0f, 0.0f));
+	world = glm::rotate(world, state.angle.z, glm::vec3(0.0f, 0.0f, 1.0f));
+	graph.setLocal(scene.world, world);
+	graph.setLocal(scene.robot, glm::rotate(glm::mat4(1.0f), state.robotModules.w, glm::vec3(0.0f, 0.0f, 1.0f)));
+
+	float joint_angles[3]{state.robotModules.z, state.robotModules.y, state.robotModules.x};
+	for (int i = 0; i < 3; ++i)
+	{
+		glm::mat4 joint{glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, i ? 2 * height : 0.0f))};
+		graph.setLocal(scene.joints[i], glm::rotate(joint, joint_angles[i], glm::vec3(1.0f, 0.0f, 0.0f)));
+	}
+	graph.update(jobs);
+	light_position = glm::vec3(graph.world(scene.light)[3]);
 }
 
-void draw_coordinate_system(GLuint programID)
+// Position of the model's origin for the depth part of the sort key
+float sort_depth(const glm::mat4& model)
 {
-	auto draw_axis{[programID](const glm::vec3& scale_vector) -> void {
-		save_and_restore([&scale_vector, programID]() -> void {
-			Model = glm::scale(Model, scale_vector);
-			sendMVP(programID);
-			drawCube();
-		});
-	}};
-	float axis_length{10.0f};
-	float axis_width{0.005f};
-	draw_axis(glm::vec3(axis_length, axis_width, axis_width)); // x
-	draw_axis(glm::vec3(axis_width, axis_length, axis_width)); // y
-	draw_axis(glm::vec3(axis_width, axis_width, axis_length)); // z
+	return -(View * model[3]).z / z_far;
 }
 
-void draw_robot(float height, GLuint programID)
+// program is an untextured variant, the cubes need no texture
+void submit_coordinate_system(const Scene& scene, RenderQueue& queue, ShaderProgram& program)
 {
-	auto draw_module{[height, programID]() -> void {
-		save_and_restore([height, programID]() -> void {
-			Model = glm::translate(Model, glm::vec3(0.0f, 0.0f, height));
-			Model = glm::scale(Model, glm::vec3(0.2f, 0.2f, height));
-			sendMVP(programID);
-			drawSphere(10, 10);
-		});
-	}};
-	save_and_restore([&draw_module, height, programID]() -> void {
-		Model = glm::rotate(Model, robot_modules.z, glm::vec3(1.0f, 0.0f, 0.0f));
-		draw_module();
-		Model = glm::translate(Model, glm::vec3(0.0f, 0.0f, 2 * height));
-		Model = glm::rotate(Model, robot_modules.y, glm::vec3(1.0f, 0.0f, 0.0f));
-		draw_module();
-		Model = glm::translate(Model, glm::vec3(0.0f, 0.0f, 2 * height));
-		Model = glm::rotate(Model, robot_modules.x, glm::vec3(1.0f, 0.0f, 0.0f));
-		draw_module();
-		glm::vec4 lightPos{Model * glm::vec4(0.0f, 0.0f, 2 * height, 1.0f)};
-		glUniform3f(glGetUniformLocation(programID, "LightPosition_worldspace"), lightPos.x, lightPos.y, lightPos.z);
-	});
+	glm::mat4 axes[3]{};
+	for (int i = 0; i < 3; ++i)
+		axes[i] = scene.graph.world(scene.axes[i]);
+	DrawPacket packet{};
+	packet.program = &program;
+	packet.geometry = cubeGeometry();
+	packet.instanced = true;
+	packet.key = makeSortKey(RenderPass::Opaque, program.id(), 0, packet.geometry.vertexArray,
+		sort_depth(scene.graph.world(scene.world)));
+	queue.submit(packet, axes, 3);
+}
+
+// program is an untextured variant, like for the coordinate system
+void submit_robot(const Scene& scene, RenderQueue& queue, ShaderProgram& program)
+{
+	glm::mat4 modules[3]{};
+	for (int i = 0; i < 3; ++i)
+		modules[i] = scene.graph.world(scene.modules[i]);
+	DrawPacket packet{};
+	packet.program = &program;
+	packet.geometry = sphereGeometry(10, 10);
+	packet.instanced = true;
+	packet.key = makeSortKey(RenderPass::Opaque, program.id(), 0, packet.geometry.vertexArray, sort_depth(modules[0]));
+	queue.submit(packet, modules, 3);
 }
 
-void write_data(GLuint* buffer_ptr, GLsizeiptr buffer_size, const void* buffer_data, GLuint attrib_array_index)
+// Triangles handed to the render queue, with the selected levels of detail and as if every copy used the full mesh
+struct LODStats
+{
+	unsigned long long submitted{0};
+	unsigned long long full{0};
+};
+
+// Copies of a mesh with the same level of detail and texture array, one instanced draw
+struct MeshBatch
 {
-	glGenBuffers(1, buffer_ptr);
-	glBindBuffer(GL_ARRAY_BUFFER, *buffer_ptr);
-	glBufferData(GL_ARRAY_BUFFER, buffer_size, buffer_data, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(attrib_array_index);
+	size_t level;
+	unsigned int array;
+	std::vector<glm::mat4> models;
+	std::vector<GLint> layers;
+};
 
+// Each copy gets the coarsest level whose error stays below a pixel at its distance.
+// The copies of one level are drawn as instances of one packet, or one per texture array if they have materials.
+// materials, if not empty, has a slot per node, copies with an invalid slot use texture.
+void submit_mesh(const Scene& scene, const std::vector<SceneGraph::Node>& nodes, const MeshBuffers& mesh, RenderQueue& queue,
+	ShaderProgram& instancedProgram, ShaderProgram& packedInstancedProgram, GLuint texture,
+	const TextureArrays& arrays, const std::vector<TextureSlot>& materials, LODStats& stats)
+{
+	std::vector<MeshBatch> batches;
+	float pixels_per_unit{window_height * Projection[1][1] / 2.0f};
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		const glm::mat4& model{scene.graph.world(nodes[n])};
+		glm::vec4 sphere{transformSphere(mesh.bounds, model)};
+		// The nearest point of the bounds decides, the error could be there
+		float distance{glm::length(glm::vec3(View * glm::vec4(glm::vec3(sphere), 1.0f))) - sphere.w};
+		float scale{mesh.bounds.radius > 0.0f ? sphere.w / mesh.bounds.radius : 1.0f};
+		size_t level{selectLOD(mesh.lods, distance, scale, pixels_per_unit)};
+		TextureSlot material{n < materials.size() ? materials[n] : TextureSlot{}};
+		auto batch{std::find_if(batches.begin(), batches.end(), [&](const MeshBatch& b) { return b.level == level && b.array == material.array; })};
+		if (batch == batches.end())
+			batch = batches.insert(batches.end(), MeshBatch{level, material.array, {}, {}});
+		batch->models.push_back(model);
+		batch->layers.push_back(material.layer);
+		stats.submitted += mesh.lods[level].indexCount / 3;
+		stats.full += mesh.lods[0].indexCount / 3;
+	}
+
+	// Packed meshes need the shader variant that decodes them
+	ShaderProgram& program{mesh.format == VertexFormat::Packed ? packedInstancedProgram : instancedProgram};
+	for (const MeshBatch& batch : batches)
+	{
+		DrawPacket packet{};
+		packet.program = &program;
+		packet.geometry = meshGeometry(mesh, batch.level);
+		packet.texture = texture;
+		packet.textureArray = materials.empty() || !arrays.arrays() ? 0 : arrays.texture(batch.array);
+		packet.mesh = &mesh;
+		packet.instanced = true;
+		packet.key = makeSortKey(RenderPass::Opaque, program.id(), packet.textureArray ? packet.textureArray : texture, mesh.vertexArray,
+			sort_depth(batch.models[0]));
+		queue.submit(packet, batch.models.data(), GLsizei(batch.models.size()), materials.empty() ? nullptr : batch.layers.data());
+	}
 }
 
-void draw_teapot(const std::vector<glm::vec3>& vertices, GLuint programID, GLuint VertexArrayIDTeapot)
+// Squares of color and white, for materials that don't need a file
+RGBAImage checker_texture(const glm::vec3& color, unsigned int squares)
 {
-	save_and_restore([VertexArrayIDTeapot, programID, &vertices]() -> void {
-			Model = glm::translate(Model, glm::vec3(1.5, 0.0, 0.0));
-			Model = glm::scale(Model, glm::vec3(1.0 / 1000.0, 1.0 / 1000.0, 1.0 / 1000.0));
-			sendMVP(programID);
-			glBindVertexArray(VertexArrayIDTeapot);
-			glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-			Model = glm::scale(Model, glm::vec3(0.5, 0.5, 0.5));
-			sendMVP(programID);
-		});
+	const unsigned int size{128};
+	RGBAImage image{size, size, std::vector<uint8_t>(size * size * 4, 255)};
+	for (unsigned int y = 0; y < size; ++y)
+		for (unsigned int x = 0; x < size; ++x)
+			if ((x * squares / size + y * squares / size) % 2)
+				for (int c = 0; c < 3; ++c)
+					image.pixels[(y * size + x) * 4 + c] = uint8_t(64 + 191 * color[c]);
+	return image;
 }
 
-int main(void)
+void print_state_counters(unsigned long frames)
 {
-	if (!glfwInit())
+	const GLStateCounters& counters{glState().counters()};
+	double per_frame{frames ? 1.0 / frames : 0.0};
+	printf("GL state per frame over %lu frames (sent / skipped):\n", frames);
+	printf("  glUseProgram      %6.1f / %6.1f\n", counters.programBinds * per_frame, counters.programSkips * per_frame);
+	printf("  glBindVertexArray %6.1f / %6.1f\n", counters.vertexArrayBinds * per_frame, counters.vertexArraySkips * per_frame);
+	printf("  glBindTexture     %6.1f / %6.1f\n", counters.textureBinds * per_frame, counters.textureSkips * per_frame);
+	printf("  glUniform*        %6.1f / %6.1f\n", counters.uniformUploads * per_frame, counters.uniformSkips * per_frame);
+}
+
+// The same ray in the object space of model. The ray parameter t stays the same.
+Ray to_object_space(const Ray& ray, const glm::mat4& model)
+{
+	glm::mat4 inverse{glm::inverse(model)};
+	Ray local{ray};
+	local.origin = glm::vec3(inverse * glm::vec4(ray.origin, 1.0f));
+	local.direction = glm::vec3(inverse * glm::vec4(ray.direction, 0.0f));
+	return local;
+}
+
+// Nearest t where the ray enters the unit sphere, the robot modules are scaled unit spheres
+bool intersect_unit_sphere(const Ray& ray, float& t)
+{
+	float a{glm::dot(ray.direction, ray.direction)};
+	float b{glm::dot(ray.origin, ray.direction)};
+	float c{glm::dot(ray.origin, ray.origin) - 1.0f};
+	float discriminant{b * b - a * c};
+	if (discriminant < 0.0f)
+		return false;
+	t = (-b - std::sqrt(discriminant)) / a;
+	return t >= ray.tMin && t <= ray.tMax;
+}
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+	const InputTargets* targets{static_cast<const InputTargets*>(glfwGetWindowUserPointer(window))};
+	if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS || !targets)
+		return;
+
+	// Ray from the near to the far plane through the cursor
+	double x, y;
+	glfwGetCursorPos(window, &x, &y);
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	float ndc_x{2.0f * float(x) / float(width) - 1.0f};
+	float ndc_y{1.0f - 2.0f * float(y) / float(height)};
+	glm::mat4 inverse_vp{glm::inverse(Projection * View)};
+	glm::vec4 near_point{inverse_vp * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f)};
+	glm::vec4 far_point{inverse_vp * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f)};
+	Ray ray{};
+	ray.origin = glm::vec3(near_point) / near_point.w;
+	ray.direction = glm::vec3(far_point) / far_point.w - ray.origin;
+	ray.tMax = 1.0f;
+
+	const Scene& scene{*targets->scene};
+	int picked_module{0};
+	for (int i = 0; i < 3; ++i)
 	{
-		std::cerr << "Failed to initialize GLFW\n";
-		exit(EXIT_FAILURE);
+		float t;
+		if (intersect_unit_sphere(to_object_space(ray, scene.graph.world(scene.modules[i])), t) && t < ray.tMax)
+		{
+			ray.tMax = t;
+			picked_module = i + 1;
+		}
 	}
-	GLFWwindow *window = glfwCreateWindow(1024, 768, "CGTutorial", NULL, NULL);
-	if (!window)
+	RayHit hit{};
+	if (targets->loader->ready(targets->teapotMesh) && targets->teapot->intersect(to_object_space(ray, scene.graph.world(scene.teapot)), hit))
+	{
+		std::cout << "Teekanne, Dreieck " << hit.triangle << '\n';
+		return;
+	}
+	if (picked_module)
 	{
+		// Selects the module like the keys A, S and D
+		module = picked_module;
+		std::cout << "Modul: " << module << '\n';
+	}
+}
 
-		glfwTerminate();
-		exit(EXIT_FAILURE);
+void print_lod_stats(const LODStats& totals, unsigned long frames)
+{
+	double per_frame{frames ? 1.0 / frames : 0.0};
+	printf("Triangles submitted per frame: %.0f with LOD, %.0f without (%.0f%%)\n",
+		totals.submitted * per_frame, totals.full * per_frame, totals.full ? 100.0 * totals.submitted / totals.full : 100.0);
+}
+
+void print_streaming_stats(const StreamingStats& stats)
+{
+	printf("Streaming: %zu resources, %.1f KB in %lu frames, at most %.1f KB and %.2f ms per frame, %lu frames waited for the GPU\n",
+		stats.resources, stats.bytes / 1024.0, stats.uploadFrames, stats.maxFrameBytes / 1024.0, stats.maxUpdateMilliseconds, stats.waitFrames);
+}
+
+void print_simulation_stats(const SimulationStats& stats, double seconds)
+{
+	printf("Simulation: %llu ticks in %.2f s (%.0f per second), %llu input events, %llu dropped, %llu ticks skipped\n",
+		static_cast<unsigned long long>(stats.ticks), seconds, seconds > 0.0 ? stats.ticks / seconds : 0.0,
+		static_cast<unsigned long long>(stats.events), static_cast<unsigned long long>(stats.droppedEvents),
+		static_cast<unsigned long long>(stats.skippedTicks));
+}
+
+void print_shader_stats(const ShaderCacheStats& stats)
+{
+	printf("Shader programs: %u from the binary cache, %u compiled (%u cached binaries rejected), %.1f ms\n",
+		stats.loaded, stats.compiled, stats.rejected, stats.milliseconds);
+}
+
+void print_cull_stats(const CullStats& totals, unsigned long frames)
+{
+	double per_frame{frames ? 1.0 / frames : 0.0};
+	printf("Frustum culling per frame: %.1f visible, %.1f culled, %.4f ms\n",
+		totals.visible * per_frame, totals.culled * per_frame, totals.milliseconds * per_frame);
+}
+
+// The budget of --headless: "600" is a number of frames, "10s" or "2.5s" a number of seconds
+bool parse_frame_budget(const char* text, unsigned long& frames, double& seconds)
+{
+	std::string budget{text};
+	char* end{nullptr};
+	errno = 0;
+	if (!budget.empty() && budget.back() == 's')
+	{
+		budget.pop_back();
+		double value{std::strtod(budget.c_str(), &end)};
+		if (budget.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(value) || value <= 0.0)
+			return false;
+		seconds = value;
+		return true;
 	}
-	glfwMakeContextCurrent(window);
-	glfwSetKeyCallback(window, key_callback);
+	if (!std::isdigit(static_cast<unsigned char>(text[0])))
+		return false;
+	unsigned long value{std::strtoul(text, &end, 10)};
+	if (*end != '\0' || errno == ERANGE || value == 0)
+		return false;
+	frames = value;
+	return true;
+}
 
-	glfwSetErrorCallback(error_callback);
-	glewExperimental = true;
-	if (glewInit() != GLEW_OK)
+int main(int argc, char *argv[])
+{
+	// CGTutorial [--trace file] [--headless frames|seconds [directory]]
+	// --trace runs as always and writes the profile of the last frames as a Chrome trace at the end.
+	// --headless runs without a window or a display: --headless 600 renders 600 frames, --headless 10s
+	// as many as fit into ten seconds. A directory after that gets each frame as a PPM file.
+	const char* trace_path{nullptr};
+	bool headless_mode{false};
+	unsigned long headless_frames{600};
+	double headless_seconds{0.0};
+	const char* frame_directory{nullptr};
+	for (int i = 1; i < argc; ++i)
 	{
-		std::cerr << "Failed to initialize GLEW\n";
-		return -1;
+		std::string option{argv[i]};
+		bool valid{true};
+		if (option == "--trace" && i + 1 < argc)
+			trace_path = argv[++i];
+		else if (option == "--headless")
+		{
+			headless_mode = true;
+			// Budget and directory are optional, whatever starts with - is the next option
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				valid = parse_frame_budget(argv[++i], headless_frames, headless_seconds);
+			if (valid && i + 1 < argc && argv[i + 1][0] != '-')
+				frame_directory = argv[++i];
+		}
+		else
+			valid = false;
+		if (!valid)
+		{
+			printf("Invalid argument %s\nUsage: %s [--trace file] [--headless frames|seconds [directory]], e.g. --headless 600 or --headless 10s\n",
+				argv[i], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	HeadlessContext headless{};
+	GLFWwindow *window{nullptr};
+	if (headless_mode)
+	{
+		if (!headless.open(window_width, window_height))
+			exit(EXIT_FAILURE);
+	}
+	else
+	{
+		if (!glfwInit())
+		{
+			std::cerr << "Failed to initialize GLFW\n";
+			exit(EXIT_FAILURE);
+		}
+		window = glfwCreateWindow(window_width, window_height, "CGTutorial", NULL, NULL);
+		if (!window)
+		{
+
+			glfwTerminate();
+			exit(EXIT_FAILURE);
+		}
+		glfwMakeContextCurrent(window);
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+		glfwSetErrorCallback(error_callback);
+		glewExperimental = true;
+		if (glewInit() != GLEW_OK)
+		{
+			std::cerr << "Failed to initialize GLEW\n";
+			return -1;
+		}
 	}
 	
-	GLuint programID{LoadShaders(SHADER_DIR "/StandardShading.vertexshader", SHADER_DIR "/StandardShading.fragmentshader")};
-	glUseProgram(programID);
-	GLuint VertexArrayIDTeapot{};
-	glGenVertexArrays(1, &VertexArrayIDTeapot);
-	glBindVertexArray(VertexArrayIDTeapot);
-
-	std::vector<glm::vec3> normals{};
-	GLuint normalbuffer{};
-	std::vector<glm::vec3> vertices{};
-	GLuint vertexbuffer{};
-	std::vector<glm::vec2> uvs{};
-	GLuint uvbuffer{};
-	
-	loadOBJ(RESOURCES_DIR "/teapot.obj", vertices, uvs, normals);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, loadBMP_custom(RESOURCES_DIR "/mandrill.bmp"));
-
-	write_data(&normalbuffer, normals.size() * sizeof(glm::vec3), (const void*)&normals[0], 2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-	write_data(&vertexbuffer, vertices.size() * sizeof(glm::vec3), (const void*)&vertices[0], 0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-	write_data(&uvbuffer, uvs.size() * sizeof(glm::vec2), (const void*)&uvs[0], 1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
-	glUniform1i(glGetUniformLocation(programID, "myTextureSampler"), 0);
+	// Variants of the shaders with only what the draws need. Those that sample take the single
+	// textures from unit 0 and the texture arrays from TextureArrayUnit.
+	auto samplers{[](ShaderProgram& program)
+	{
+		program.set("myTextureSampler", 0);
+		program.set("myTextureArraySampler", 1);
+	}};
+	ShaderPermutations instancedShaders{SHADER_DIR "/StandardShadingInstanced.vertexshader", SHADER_DIR "/StandardShading.fragmentshader",
+		nullptr, samplers};
+	ShaderPermutations packedInstancedShaders{SHADER_DIR "/StandardShadingPackedInstanced.vertexshader", SHADER_DIR "/StandardShading.fragmentshader",
+		nullptr, samplers};
+	// The meshes are textured, the robot is plain, the coordinate system plain and matte.
+	// The variants don't move, so they are looked up once instead of every frame.
+	const uint32_t lights{shaderLights(1)};
+	ShaderProgram& instancedProgram{instancedShaders.get(ShaderTexture | ShaderSpecular | lights)};
+	ShaderProgram& packedInstancedProgram{packedInstancedShaders.get(ShaderTexture | ShaderSpecular | lights)};
+	ShaderProgram& robotProgram{instancedShaders.get(ShaderSpecular | lights)};
+	ShaderProgram& axesProgram{instancedShaders.get(lights)};
+	print_shader_stats(shaderCacheStats());
+
+	// Edit a shader or a file it includes while this runs: the variants using it are rebuilt
+	// in the background and swapped in once they link. Not headless, nobody edits there.
+	std::unique_ptr<ShaderReloader> reloader{};
+	if (window)
+	{
+		reloader.reset(new ShaderReloader{window, SHADER_DIR});
+		instancedShaders.watch(*reloader);
+		packedInstancedShaders.watch(*reloader);
+	}
+
+	// The files are read on worker threads and streamed into GL a little per frame, placeholders stand in until then.
+	// The meshes come from the binary mesh cache, together with their levels of detail, and are
+	// uploaded in the packed vertex format, unless that would move their vertices too far.
+	// The loader goes after the BVH, so it is destroyed first and waits for a build still running.
+	BVH teapotBVH{};
+	StreamingLoader loader{};
+	StreamingLoader::Handle teapotMesh{loader.requestMesh(RESOURCES_DIR "/teapot.obj", [&teapotBVH](const MeshCache& cache)
+	{
+		teapotBVH.build(cache.vertices(), cache.indices(), cache.indexCount());
+	})};
+	StreamingLoader::Handle dragonMesh{loader.requestMesh(RESOURCES_DIR "/dragon.obj")};
+	StreamingLoader::Handle mandrillTexture{loader.requestTexture(RESOURCES_DIR "/mandrill.bmp")};
+
+	// The far teapots get a material each, all layers of one texture array, so each level of detail
+	// stays a single instanced draw. The near one keeps the mandrill texture.
+	TextureArrays materials{};
+	std::vector<TextureSlot> teapot_materials{TextureSlot{}};
+	for (int i = 1; i < 7; ++i)
+		teapot_materials.push_back(materials.add(checker_texture(glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1), 4 + 2 * i)));
+	std::vector<TextureSlot> no_materials{};
 
 	glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
-	while (!glfwWindowShouldClose(window))
-	{
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glEnable(GL_DEPTH_TEST);
-		Model = glm::mat4(1.0f);
-		Model = glm::translate(Model, glm::vec3(pos.x, 0.0f, 0.0f));
-		Model = glm::translate(Model, glm::vec3(0.0f, pos.y, 0.0f));
-		Model = glm::translate(Model, glm::vec3(0.0f, 0.0f, pos.z));
-		Model = glm::rotate(Model, angle.x, glm::vec3(1.0f, 0.0f, 0.0f));
-		Model = glm::rotate(Model, angle.y, glm::vec3(0.0f, 1.0f, 0.0f));
-		Model = glm::rotate(Model, angle.z, glm::vec3(0.0f, 0.0f, 1.0f));
-		draw_teapot(vertices, programID, VertexArrayIDTeapot);
-		draw_coordinate_system(programID);
-		Model = glm::rotate(Model, robot_modules.w, glm::vec3(0.0f, 0.0f, 1.0f));
-		draw_robot(0.5f, programID);
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+	glState().resetCounters();
+	unsigned long frames{0};
+	// The scene functions only submit their draws, they run sorted once everything is known
+	RenderQueue queue{};
+	CullStats cull_totals{};
+	LODStats lod_totals{};
+	// The scene graph, the submits and the culling are spread over the threads. Each thread submits
+	// into a queue of its own, they are merged into queue in thread order before the culling.
+	JobSystem jobs{};
+	std::vector<RenderQueue> thread_queues(jobs.threads());
+	// Created here, the submit jobs must not create GL objects
+	cubeGeometry();
+	sphereGeometry(10, 10);
+	const float robot_height{0.5f};
+	Scene scene{};
+	build_scene(scene, robot_height);
+	// The state the input moves, on a thread of its own at a fixed rate
+	Simulation simulation{};
+	InputTargets input_targets{&simulation, &scene, &teapotBVH, &loader, teapotMesh};
+	if (window)
+		glfwSetWindowUserPointer(window, &input_targets);
+	// CPU time of each step, GPU time of the steps that send GL work. The draws of the
+	// scene all run in execute, sorted by state, so the GPU sees them there and not per object.
+	Profiler profiler{};
+	std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+	auto seconds{[&start]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }};
+	auto running{[&]()
+	{
+		if (window)
+			return !glfwWindowShouldClose(window);
+		return headless_seconds > 0.0 ? seconds() < headless_seconds : frames < headless_frames;
+	}};
+	while (running())
+	{
+		profiler.setEnabled(profiling);
+		profiler.beginFrame();
+		{
+			ProfileScope clear{profiler, "Clear", true};
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glEnable(GL_DEPTH_TEST);
+		}
+		{
+			ProfileScope streaming{profiler, "Streaming", true};
+			loader.update(upload_budget);
+		}
+		{
+			ProfileScope reload{profiler, "Shader reload"};
+			if (reloader)
+				reloader->update();
+		}
+		GLuint mandrill{loader.texture(mandrillTexture)};
+		{
+			ProfileScope update{profiler, "Scene graph"};
+			update_scene(scene, robot_height, simulation.sample(), jobs);
+		}
+		{
+			ProfileScope submit{profiler, "Submit"};
+			const MeshBuffers& teapot{loader.mesh(teapotMesh)};
+			const MeshBuffers& dragon{loader.mesh(dragonMesh)};
+			LODStats teapot_stats{}, dragon_stats{};
+			auto submit_teapots{[&]()
+			{
+				submit_mesh(scene, scene.teapots, teapot, thread_queues[jobs.threadIndex()], instancedProgram, packedInstancedProgram, mandrill,
+					materials, teapot_materials, teapot_stats);
+			}};
+			auto submit_dragons{[&]()
+			{
+				submit_mesh(scene, scene.dragons, dragon, thread_queues[jobs.threadIndex()], instancedProgram, packedInstancedProgram, mandrill,
+					materials, no_materials, dragon_stats);
+			}};
+			auto submit_rest{[&]()
+			{
+				RenderQueue& thread_queue{thread_queues[jobs.threadIndex()]};
+				submit_coordinate_system(scene, thread_queue, axesProgram);
+				submit_robot(scene, thread_queue, robotProgram);
+			}};
+			JobCounter submitted{};
+			jobs.run(submit_teapots, &submitted);
+			jobs.run(submit_dragons, &submitted);
+			jobs.run(submit_rest, &submitted);
+			jobs.wait(submitted);
+			lod_totals.submitted += teapot_stats.submitted + dragon_stats.submitted;
+			lod_totals.full += teapot_stats.full + dragon_stats.full;
+			for (RenderQueue& thread_queue : thread_queues)
+			{
+				queue.append(thread_queue);
+				thread_queue.clear();
+			}
+		}
+		{
+			ProfileScope cull{profiler, "Cull"};
+			CullStats cull_stats{queue.cull(extractFrustum(Projection * View), &jobs)};
+			cull_totals.visible += cull_stats.visible;
+			cull_totals.culled += cull_stats.culled;
+			cull_totals.milliseconds += cull_stats.milliseconds;
+		}
+		{
+			ProfileScope sort{profiler, "Sort"};
+			queue.sort();
+		}
+		{
+			ProfileScope execute{profiler, "Execute", true};
+			queue.execute(FrameUniforms{View, Projection, {light_position}});
+		}
+		queue.clear();
+		if (window)
+		{
+			ProfileScope swap{profiler, "Swap buffers"};
+			glfwSwapBuffers(window);
+		}
+		else
+		{
+			ProfileScope finish{profiler, "Finish frame"};
+			headless.finishFrame();
+		}
+		if (frame_directory)
+		{
+			ProfileScope dump{profiler, "Write frame"};
+			char path[4096];
+			snprintf(path, sizeof(path), "%s/frame-%05lu.ppm", frame_directory, frames);
+			headless.writePPM(path);
+		}
+		++frames;
+		if (window)
+			glfwPollEvents();
+		profiler.endFrame();
 	}
-	glDeleteProgram(programID);
-	glDeleteBuffers(1, &normalbuffer);
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glfwTerminate();
+	double elapsed{seconds()};
+	if (window)
+		glfwSetWindowUserPointer(window, nullptr);
+	simulation.stop();
+	if (!window)
+		printf("Rendered %lu frames headless in %.2f s, %.1f frames per second\n", frames, elapsed, elapsed > 0.0 ? frames / elapsed : 0.0);
+	print_state_counters(frames);
+	print_cull_stats(cull_totals, frames);
+	print_lod_stats(lod_totals, frames);
+	print_streaming_stats(loader.stats());
+	print_simulation_stats(simulation.stats(), elapsed);
+	profiler.printSummary();
+	if (trace_path)
+		profiler.writeChromeTrace(trace_path);
+	profiler.release();
+	if (reloader)
+		reloader->release();
+	instancedShaders.release();
+	packedInstancedShaders.release();
+	loader.release();
+	materials.release();
+	deleteShapes();
+	if (window)
+		glfwTerminate();
+	else
+		headless.close();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,649 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "benchmark.hpp"
+#include "bvh.hpp"
+#include "frustum.hpp"
+#include "glstate.hpp"
+#include "headless.hpp"
+#include "jobsystem.hpp"
+#include "meshcache.hpp"
+#include "objects.hpp"
+#include "procedural.hpp"
+#include "renderqueue.hpp"
+#include "scenegraph.hpp"
+#include "shader.hpp"
+#include "shaderpermutation.hpp"
+#include "shaderprogram.hpp"
+#include "texture.hpp"
+#include "texturecompress.hpp"
+#include "vertexformat.hpp"
+#include "asset.hpp"
+#include "objloader.hpp"
+
+// The size of the tutorial's window, the whole frames render into a framebuffer that large
+const int frame_width{1024};
+const int frame_height{768};
+const size_t transform_count{10000};
+
+// Keeps results the compiler could otherwise drop with the work that computed them
+volatile float sink{};
+
+// The scene's meshes parsed from the OBJ files (cold, what the parser costs) and mapped from the mesh cache (warm)
+void benchmark_loaders(BenchmarkSuite& suite)
+{
+	for (const char* name : {"teapot", "dragon"})
+	{
+		std::string path{std::string(RESOURCES_DIR "/") + name + ".obj"};
+		suite.run(std::string("loadOBJ/") + name + "/parse", [&path]()
+		{
+			std::vector<unsigned int> indices;
+			std::vector<glm::vec3> vertices, normals;
+			std::vector<glm::vec2> uvs;
+			parseOBJIndexed(path.c_str(), indices, vertices, uvs, normals);
+		});
+		// The warm-up run writes the cache if there is none yet
+		suite.run(std::string("loadOBJ/") + name + "/cached", [&path]()
+		{
+			MeshCache mesh;
+			loadOBJCached(path.c_str(), mesh);
+		});
+	}
+}
+
+// The uv spheres drawSphere and sphereGeometry are made of, at tessellations from the robot's to far too fine
+void benchmark_spheres(BenchmarkSuite& suite)
+{
+	for (unsigned int slices : {8u, 16u, 32u, 64u, 128u, 256u})
+	{
+		suite.run("generateShape/sphere-" + std::to_string(slices), [slices]()
+		{
+			ShapeMesh mesh{generateShape(sphereShape(slices, slices))};
+			sink = mesh.positions.back().x;
+		});
+	}
+}
+
+// What the model matrices cost per frame: the scene graph updating its world matrices,
+// and MVP = P * V * M for every object like sendMVP did once per draw
+void benchmark_transforms(BenchmarkSuite& suite)
+{
+	SceneGraph graph{};
+	std::vector<SceneGraph::Node> nodes;
+	for (size_t i = 0; i < transform_count; ++i)
+	{
+		// A chain of eight levels per root, like the robot's joints and modules
+		SceneGraph::Node parent{i % 8 ? nodes.back() : SceneGraph::NoParent};
+		nodes.push_back(graph.add(parent, glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.5f)), 0.1f, glm::vec3(1.0f, 0.0f, 0.0f))));
+	}
+	graph.update();
+	float angle{0.0f};
+	std::string count{std::to_string(transform_count)};
+	suite.run("sceneGraph/update-all-" + count, [&]()
+	{
+		angle += 0.01f;
+		for (size_t i = 0; i < nodes.size(); i += 8)
+			graph.setLocal(nodes[i], glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 0.0f, 1.0f)));
+		graph.update();
+	});
+	suite.run("sceneGraph/update-16-chains-" + count, [&]()
+	{
+		angle += 0.01f;
+		for (size_t i = 0; i < 16; ++i)
+			graph.setLocal(nodes[(i * 8 * 97) % nodes.size()], glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 0.0f, 1.0f)));
+		graph.update();
+	});
+
+	glm::mat4 projection{glm::perspective(45.0f, 4.0f / 3.0f, 0.1f, 100.0f)};
+	glm::mat4 view{glm::lookAt(glm::vec3(0, 0, -5), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0))};
+	std::vector<glm::mat4> mvps(nodes.size());
+	suite.run("transform/mvp-" + count, [&]()
+	{
+		for (size_t i = 0; i < nodes.size(); ++i)
+			mvps[i] = projection * view * graph.world(nodes[i]);
+		sink = mvps.back()[3][2];
+	});
+}
+
+// A random hierarchy whose parents are picked among the last few hundred nodes, which gives a deep, bushy tree:
+// updates with everything dirty, with 16 changed subtrees and with nothing dirty, against the recursive
+// traversal through std::function that the tutorial did before and that recomputes everything
+void benchmark_scene_graph(BenchmarkSuite& suite)
+{
+	const size_t node_count{100000};
+	std::mt19937 random{42};
+	std::uniform_real_distribution<float> unit{-1.0f, 1.0f};
+	SceneGraph graph{};
+	std::vector<std::vector<SceneGraph::Node>> children(node_count);
+	for (size_t i = 0; i < node_count; ++i)
+	{
+		SceneGraph::Node parent{SceneGraph::NoParent};
+		if (i > 0)
+			parent = SceneGraph::Node(i - 1 - std::uniform_int_distribution<size_t>{0, std::min<size_t>(i - 1, 255)}(random));
+		glm::mat4 local{glm::translate(glm::mat4(1.0f), glm::vec3(unit(random), unit(random), unit(random)))};
+		graph.add(parent, glm::rotate(local, unit(random), glm::vec3(0.0f, 0.0f, 1.0f)));
+		if (parent != SceneGraph::NoParent)
+			children[parent].push_back(SceneGraph::Node(i));
+	}
+	graph.update();
+
+	std::string prefix{"sceneGraph/random-" + std::to_string(node_count)};
+	suite.run(prefix + "-all-dirty", [&]()
+	{
+		graph.setLocal(0, glm::rotate(graph.local(0), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+		graph.update();
+	});
+	suite.run(prefix + "-16-subtrees", [&]()
+	{
+		for (int change = 0; change < 16; ++change)
+		{
+			SceneGraph::Node node{SceneGraph::Node(std::uniform_int_distribution<size_t>{node_count / 2, node_count - 1}(random))};
+			graph.setLocal(node, glm::rotate(graph.local(node), 0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+		}
+		graph.update();
+	});
+	suite.run(prefix + "-clean", [&]()
+	{
+		graph.update();
+	});
+	std::vector<glm::mat4> worlds(node_count);
+	suite.run(prefix + "-recursive", [&]()
+	{
+		std::function<void(SceneGraph::Node, const glm::mat4&)> visit;
+		visit = [&](SceneGraph::Node node, const glm::mat4& parent_world)
+		{
+			worlds[node] = parent_world * graph.local(node);
+			for (SceneGraph::Node child : children[node])
+				visit(child, worlds[node]);
+		};
+		visit(0, glm::mat4(1.0f));
+		sink = worlds.back()[3][2];
+	});
+}
+
+// The BVH of the scene's meshes built with one and with all threads, and rays from a sphere around
+// each mesh towards random points inside its box: closest hits and segments that only ask for any hit
+void benchmark_bvh(BenchmarkSuite& suite)
+{
+	const size_t ray_count{1 << 16};
+	unsigned int hardware_threads{std::max(1u, std::thread::hardware_concurrency())};
+	for (const char* name : {"dragon", "teapot"})
+	{
+		std::string prefix{std::string("bvh/") + name};
+		std::string count{std::to_string(ray_count)};
+		const std::string names[]{prefix + "-build-threads-1", prefix + "-build-threads-" + std::to_string(hardware_threads),
+			prefix + "-closest-hit-" + count, prefix + "-any-hit-" + count};
+		if (std::none_of(std::begin(names), std::end(names), [&suite](const std::string& n) { return suite.selected(n); }))
+			continue;
+		MeshCache mesh;
+		if (!loadOBJCached((std::string(RESOURCES_DIR "/") + name + ".obj").c_str(), mesh))
+			continue;
+		BVH bvh;
+		std::vector<unsigned int> thread_counts{1};
+		if (hardware_threads > 1)
+			thread_counts.push_back(hardware_threads);
+		for (unsigned int threads : thread_counts)
+			suite.run(prefix + "-build-threads-" + std::to_string(threads), [&]()
+			{
+				bvh.build(mesh.vertices(), mesh.indices(), mesh.indexCount(), threads);
+			});
+		if (bvh.empty())
+			bvh.build(mesh.vertices(), mesh.indices(), mesh.indexCount());
+
+		glm::vec3 low{mesh.vertices()[0]}, high{low};
+		for (size_t i = 1; i < mesh.vertexCount(); ++i)
+		{
+			low = glm::min(low, mesh.vertices()[i]);
+			high = glm::max(high, mesh.vertices()[i]);
+		}
+		glm::vec3 center{(low + high) * 0.5f};
+		float radius{glm::length(high - low)};
+		std::mt19937 random{7};
+		std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+		std::normal_distribution<float> normal{};
+		std::vector<Ray> rays(ray_count);
+		for (Ray& ray : rays)
+		{
+			glm::vec3 direction{normal(random), normal(random), normal(random)};
+			ray.origin = center + glm::normalize(direction) * radius;
+			glm::vec3 target{low + (high - low) * glm::vec3(unit(random), unit(random), unit(random))};
+			ray.direction = target - ray.origin;
+		}
+
+		auto closest_hits{[&]()
+		{
+			size_t hits{0};
+			RayHit hit;
+			for (const Ray& ray : rays)
+				hits += bvh.intersect(ray, hit);
+			return hits;
+		}};
+		auto blocked_segments{[&]()
+		{
+			size_t blocked{0};
+			for (const Ray& ray : rays)
+				blocked += bvh.intersectSegment(ray.origin, ray.origin + ray.direction);
+			return blocked;
+		}};
+		suite.run(prefix + "-closest-hit-" + count, [&]() { sink = float(closest_hits()); });
+		suite.run(prefix + "-any-hit-" + count, [&]() { sink = float(blocked_segments()); });
+		printf("BVH of %s: %zu triangles, %zu nodes, depth %u, %.0f%% of the rays hit, %.0f%% of the segments blocked\n", name,
+			bvh.triangleCount(), bvh.nodeCount(), bvh.depth(), 100.0 * closest_hits() / ray_count, 100.0 * blocked_segments() / ray_count);
+	}
+}
+
+// 24 bit BMP, for the scaled up test textures
+bool write_bmp(const std::string& path, const RGBAImage& image)
+{
+	FILE* file{fopen(path.c_str(), "wb")};
+	if (!file)
+		return false;
+	size_t row_size{(size_t(image.width) * 3 + 3) & ~size_t(3)};
+	uint32_t image_size{uint32_t(row_size * image.height)};
+	unsigned char header[54]{'B', 'M'};
+	auto put32{[&header](int offset, uint32_t value) { std::memcpy(header + offset, &value, 4); }};
+	put32(0x02, 54 + image_size);
+	put32(0x0A, 54);
+	put32(0x0E, 40);
+	put32(0x12, image.width);
+	put32(0x16, image.height);
+	header[0x1A] = 1;  // planes
+	header[0x1C] = 24; // bits per pixel
+	put32(0x22, image_size);
+	fwrite(header, 1, sizeof(header), file);
+	std::vector<unsigned char> row(row_size, 0);
+	for (unsigned int y = 0; y < image.height; ++y)
+	{
+		const uint8_t* source{&image.pixels[size_t(y) * image.width * 4]};
+		for (unsigned int x = 0; x < image.width; ++x)
+		{
+			row[x * 3] = source[x * 4 + 2];
+			row[x * 3 + 1] = source[x * 4 + 1];
+			row[x * 3 + 2] = source[x * 4];
+		}
+		fwrite(row.data(), 1, row_size, file);
+	}
+	return fclose(file) == 0;
+}
+
+// Bilinear in sRGB, only to get larger test textures
+RGBAImage scale_up(const RGBAImage& image, unsigned int size)
+{
+	RGBAImage scaled{size, size, std::vector<uint8_t>(size_t(size) * size * 4)};
+	auto texel{[&image](unsigned int x, unsigned int y, int c) { return float(image.pixels[(size_t(y) * image.width + x) * 4 + c]); }};
+	for (unsigned int y = 0; y < size; ++y)
+	{
+		float sy{std::max((y + 0.5f) * image.height / size - 0.5f, 0.0f)};
+		unsigned int y0{std::min(unsigned(sy), image.height - 1)}, y1{std::min(y0 + 1, image.height - 1)};
+		float fy{sy - y0};
+		for (unsigned int x = 0; x < size; ++x)
+		{
+			float sx{std::max((x + 0.5f) * image.width / size - 0.5f, 0.0f)};
+			unsigned int x0{std::min(unsigned(sx), image.width - 1)}, x1{std::min(x0 + 1, image.width - 1)};
+			float fx{sx - x0};
+			for (int c = 0; c < 4; ++c)
+			{
+				float top{texel(x0, y0, c) * (1.0f - fx) + texel(x1, y0, c) * fx};
+				float bottom{texel(x0, y1, c) * (1.0f - fx) + texel(x1, y1, c) * fx};
+				scaled.pixels[(size_t(y) * size + x) * 4 + c] = uint8_t(std::lround(top * (1.0f - fy) + bottom * fy));
+			}
+		}
+	}
+	return scaled;
+}
+
+// The mandrill and two larger textures scaled up from it, as BMP with generated mipmaps and as DDS
+// with compressed ones. Needs the GL context, the times include the upload.
+void benchmark_textures(BenchmarkSuite& suite)
+{
+	struct Source
+	{
+		std::string name, path;
+		unsigned int width, height;
+		std::vector<std::string> benchmarks; // loadBMP_custom, then loadDDS per format
+	};
+	const std::pair<BlockFormat, const char*> formats[]{{BlockFormat::BC1, "bc1"}, {BlockFormat::BC3, "bc3"}};
+	const char* mandrill{RESOURCES_DIR "/mandrill.bmp"};
+	std::vector<Source> sources{{"mandrill", mandrill, 0, 0, {}}};
+	for (unsigned int size : {2048u, 4096u})
+	{
+		std::string name{"scaled-" + std::to_string(size)};
+		sources.push_back({name, std::string(CACHE_DIR "/bench-") + name + ".bmp", size, size, {}});
+	}
+	bool any_selected{false};
+	for (Source& source : sources)
+	{
+		source.benchmarks.push_back("loadBMP_custom/" + source.name);
+		for (const auto& format : formats)
+			source.benchmarks.push_back("loadDDS/" + source.name + "-" + format.second);
+		for (const std::string& name : source.benchmarks)
+			any_selected = any_selected || suite.selected(name);
+	}
+	BitmapImage bitmap;
+	if (!any_selected || !decodeBMP(mandrill, bitmap))
+		return;
+	RGBAImage image{toRGBA(bitmap)};
+	sources[0].width = image.width;
+	sources[0].height = image.height;
+	std::error_code error;
+	std::filesystem::create_directories(CACHE_DIR, error);
+
+	printf("%-16s %11s %10s %10s %10s\n", "Texture", "Size", "RGBA8 KB", "BC1 KB", "BC3 KB");
+	size_t rgba_total{0}, bc1_total{0}, bc3_total{0};
+	for (const Source& source : sources)
+	{
+		// Drivers keep RGB textures as RGBA8, the DDS files hold the compressed levels
+		size_t rgba_bytes{0}, bc1_bytes{0}, bc3_bytes{0};
+		for (unsigned int w = source.width, h = source.height;; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u))
+		{
+			rgba_bytes += size_t(w) * h * 4;
+			bc1_bytes += compressedSize(w, h, BlockFormat::BC1);
+			bc3_bytes += compressedSize(w, h, BlockFormat::BC3);
+			if (w == 1 && h == 1)
+				break;
+		}
+		std::string size{std::to_string(source.width) + "x" + std::to_string(source.height)};
+		printf("%-16s %11s %10.0f %10.0f %10.0f\n", source.name.c_str(), size.c_str(), rgba_bytes / 1024.0, bc1_bytes / 1024.0, bc3_bytes / 1024.0);
+		rgba_total += rgba_bytes;
+		bc1_total += bc1_bytes;
+		bc3_total += bc3_bytes;
+	}
+	printf("VRAM with mipmaps: BC1 saves %.1f%%, BC3 %.1f%% against RGBA8. BMP load times include glGenerateMipmap.\n",
+		100.0 * (1.0 - double(bc1_total) / rgba_total), 100.0 * (1.0 - double(bc3_total) / rgba_total));
+
+	for (const Source& source : sources)
+	{
+		if (std::none_of(source.benchmarks.begin(), source.benchmarks.end(), [&suite](const std::string& name) { return suite.selected(name); }))
+			continue;
+		if (source.path != mandrill && !write_bmp(source.path, scale_up(image, source.width)))
+			continue;
+
+		suite.run(source.benchmarks[0], [&source]()
+		{
+			GLuint texture{loadBMP_custom(source.path.c_str())};
+			glFinish();
+			glDeleteTextures(1, &texture);
+		});
+		for (size_t i = 0; i < std::size(formats); ++i)
+		{
+			const std::string& name{source.benchmarks[i + 1]};
+			if (!suite.selected(name))
+				continue;
+			std::string dds{std::string(CACHE_DIR "/bench-") + source.name + "-" + formats[i].second + ".dds"};
+			if (!compressBMP(source.path.c_str(), dds.c_str(), formats[i].first))
+				continue;
+			suite.run(name, [&dds]()
+			{
+				GLuint texture{loadDDS(dds.c_str())};
+				glFinish();
+				glDeleteTextures(1, &texture);
+			});
+		}
+	}
+}
+
+// The textured variant of the scene's programs in both vertex formats, compiled from the sources
+// and taken from the binary cache
+void benchmark_shaders(BenchmarkSuite& suite)
+{
+	std::string defines{shaderDefines(ShaderTexture | ShaderSpecular | shaderLights(1))};
+	auto load{[&defines]()
+	{
+		for (const char* vertex : {SHADER_DIR "/StandardShadingInstanced.vertexshader", SHADER_DIR "/StandardShadingPackedInstanced.vertexshader"})
+			glDeleteProgram(LoadShaders(vertex, SHADER_DIR "/StandardShading.fragmentshader", defines.c_str()));
+	}};
+	setShaderCacheEnabled(false);
+	suite.run("LoadShaders/cold", load);
+	setShaderCacheEnabled(true);
+	suite.run("LoadShaders/warm", load);
+}
+
+// What the packed vertex format saves in vertex fetch: the scene's meshes in both formats, many instances
+// drawn into a tiny viewport so the vertices and not the pixels decide, timed on the GPU.
+// drawInstanced uploads the instance matrices once, the timed draws reuse them.
+void benchmark_vertex_fetch(BenchmarkSuite& suite)
+{
+	const GLsizei instances{512};
+	ShaderPermutations floatShaders{SHADER_DIR "/StandardShadingInstanced.vertexshader", SHADER_DIR "/StandardShading.fragmentshader"};
+	ShaderPermutations packedShaders{SHADER_DIR "/StandardShadingPackedInstanced.vertexshader", SHADER_DIR "/StandardShading.fragmentshader"};
+	glm::mat4 projection{glm::perspective(45.0f, 1.0f, 0.1f, 100.0f)};
+	glm::mat4 view{glm::lookAt(glm::vec3(0, 0, -40), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0))};
+	GLuint query{0};
+	glGenQueries(1, &query);
+	glViewport(0, 0, 8, 8);
+
+	for (const char* name : {"teapot", "dragon"})
+	{
+		std::string path{std::string(RESOURCES_DIR "/") + name + ".obj"};
+		MeshCache cache;
+		if (!loadOBJCached(path.c_str(), cache))
+			continue;
+		for (bool packed : {false, true})
+		{
+			std::string bench{std::string("vertexFetch/") + name + (packed ? "-packed" : "-float")};
+			if (!suite.selected(bench))
+				continue;
+			VertexQuantization quantization{};
+			quantization.allowPacked = packed;
+			MeshBuffers mesh{uploadMesh(cache.indices(), cache.indexCount(), cache.vertices(), cache.uvs(), cache.normals(),
+				cache.vertexCount(), quantization, cache.lods())};
+			if (mesh.format != (packed ? VertexFormat::Packed : VertexFormat::Float))
+			{
+				printf("%s doesn't pack within the error bounds\n", name);
+				deleteMesh(mesh);
+				continue;
+			}
+			// A grid of copies the size of one unit
+			std::vector<glm::mat4> models(instances);
+			float scale{mesh.bounds.radius > 0.0f ? 1.0f / mesh.bounds.radius : 1.0f};
+			for (GLsizei i = 0; i < instances; ++i)
+			{
+				glm::mat4 model{glm::translate(glm::mat4(1.0f), glm::vec3(float(i % 32) - 15.5f, float(i / 32) - 7.5f, 0.0f))};
+				models[i] = glm::translate(glm::scale(model, glm::vec3(scale)), -mesh.bounds.center);
+			}
+			ShaderProgram& program{(packed ? packedShaders : floatShaders).get(ShaderSpecular | shaderLights(1))};
+			program.set(ShaderProgram::UniformSlot::V, view);
+			program.set(ShaderProgram::UniformSlot::VP, projection * view);
+			if (packed)
+				sendMeshUniforms(program, mesh);
+			DrawGeometry geometry{meshGeometry(mesh)};
+			glState().useProgram(program.id());
+			drawInstanced(geometry, models.data(), instances);
+			suite.measure(bench, [&]()
+			{
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				glDrawElementsInstanced(geometry.mode, geometry.count, geometry.indexType, (void*)(geometry.first * sizeof(GLuint)), instances);
+				glEndQuery(GL_TIME_ELAPSED);
+				GLuint64 nanoseconds{0};
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+				return nanoseconds / 1e6;
+			});
+			deleteMesh(mesh);
+		}
+	}
+	glViewport(0, 0, frame_width, frame_height);
+	glDeleteQueries(1, &query);
+	floatShaders.release();
+	packedShaders.release();
+}
+
+// The draws one thread lists on its own, merged into the frame's queue in thread order
+struct ThreadDrawList
+{
+	RenderQueue queue;
+	std::vector<glm::mat4> spheres, cubes;
+};
+
+// A frame of a grid of many objects, half of them behind the camera, with the work spread over the threads
+// of a job system: the scene graph turns the grid, each thread lists the draws of the chunks of objects it
+// gets, and the merged lists are culled and sorted. That is the CPU part (frameCPU), the part that scales
+// with the threads. The whole frame also executes the queue and waits for the GPU.
+void benchmark_frames(BenchmarkSuite& suite, HeadlessContext& headless)
+{
+	const size_t list_grain{256};
+	ShaderPermutations shaders{SHADER_DIR "/StandardShadingInstanced.vertexshader", SHADER_DIR "/StandardShading.fragmentshader"};
+	ShaderProgram& program{shaders.get(ShaderSpecular | shaderLights(1))};
+	glm::mat4 projection{glm::perspective(45.0f, float(frame_width) / frame_height, 0.1f, 100.0f)};
+	glm::mat4 view{glm::lookAt(glm::vec3(0, 0, -5), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0))};
+	Frustum frustum{extractFrustum(projection * view)};
+	glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
+	glEnable(GL_DEPTH_TEST);
+	// Made here, the threads listing the draws must not create GL objects
+	DrawGeometry sphere{sphereGeometry(10, 10)};
+	DrawGeometry cube{cubeGeometry()};
+	std::vector<unsigned int> thread_counts{1, 2, 4, std::max(1u, std::thread::hardware_concurrency())};
+	std::sort(thread_counts.begin(), thread_counts.end());
+	thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()), thread_counts.end());
+
+	for (size_t objects : {size_t(1000), size_t(10000)})
+	{
+		// The objects hang below 64 groups under the root
+		SceneGraph graph{};
+		SceneGraph::Node root{graph.add(SceneGraph::NoParent)};
+		std::vector<SceneGraph::Node> groups, nodes;
+		for (int i = 0; i < 64; ++i)
+			groups.push_back(graph.add(root));
+		size_t side{size_t(std::ceil(std::sqrt(double(objects))))};
+		for (size_t i = 0; i < objects; ++i)
+		{
+			glm::vec3 position{(float(i % side) / side - 0.5f) * 40.0f, 0.0f, (float(i / side) / side - 0.5f) * 40.0f};
+			nodes.push_back(graph.add(groups[i % groups.size()], glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.2f))));
+		}
+		RenderQueue queue{};
+		float angle{0.0f};
+		for (bool draw : {false, true})
+		{
+			for (unsigned int threads : thread_counts)
+			{
+				std::string name{std::string(draw ? "frame" : "frameCPU") + "/objects-" + std::to_string(objects) + "/threads-" + std::to_string(threads)};
+				if (!suite.selected(name))
+					continue;
+				JobSystem jobs{threads};
+				std::vector<ThreadDrawList> lists(jobs.threads());
+				suite.run(name, [&]()
+				{
+					angle += 0.01f;
+					graph.setLocal(root, glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f)));
+					graph.update(jobs);
+					jobs.parallelFor(nodes.size(), list_grain, [&](size_t begin, size_t end)
+					{
+						ThreadDrawList& list{lists[jobs.threadIndex()]};
+						list.spheres.clear();
+						list.cubes.clear();
+						for (size_t i = begin; i < end; ++i)
+							(i % 2 ? list.spheres : list.cubes).push_back(graph.world(nodes[i]));
+						DrawPacket packet{};
+						packet.program = &program;
+						packet.instanced = true;
+						packet.geometry = sphere;
+						packet.key = makeSortKey(RenderPass::Opaque, program.id(), 0, sphere.vertexArray, 0.0f);
+						if (!list.spheres.empty())
+							list.queue.submit(packet, list.spheres.data(), GLsizei(list.spheres.size()));
+						packet.geometry = cube;
+						packet.key = makeSortKey(RenderPass::Opaque, program.id(), 0, cube.vertexArray, 0.0f);
+						if (!list.cubes.empty())
+							list.queue.submit(packet, list.cubes.data(), GLsizei(list.cubes.size()));
+					});
+					for (ThreadDrawList& list : lists)
+					{
+						queue.append(list.queue);
+						list.queue.clear();
+					}
+					queue.cull(frustum, &jobs);
+					queue.sort();
+					if (draw)
+					{
+						glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+						queue.execute(FrameUniforms{view, projection, {glm::vec3(4.0f, 4.0f, -4.0f)}});
+						headless.finishFrame();
+					}
+					queue.clear();
+				});
+			}
+		}
+	}
+	shaders.release();
+}
+
+int main(int argc, char *argv[])
+{
+	// CGTutorial_bench [--filter text] [--json file] [--baseline file] [--threshold percent]
+	std::string filter{};
+	const char* json_path{"CGTutorial_bench.json"};
+	const char* baseline_path{nullptr};
+	double threshold{0.10};
+	for (int i = 1; i < argc; i += 2)
+	{
+		std::string option{argv[i]};
+		const char* value{i + 1 < argc ? argv[i + 1] : nullptr};
+		bool valid{true};
+		if (!value)
+			valid = false;
+		else if (option == "--filter")
+			filter = value;
+		else if (option == "--json")
+			json_path = value;
+		else if (option == "--baseline")
+			baseline_path = value;
+		else if (option == "--threshold")
+		{
+			char* end{nullptr};
+			errno = 0;
+			double percent{std::strtod(value, &end)};
+			valid = end != value && *end == '\0' && errno != ERANGE && std::isfinite(percent) && percent >= 0.0;
+			threshold = percent / 100.0;
+		}
+		else
+			valid = false;
+		if (!valid)
+		{
+			printf("Invalid option %s%s%s\nUsage: %s [--filter text] [--json file] [--baseline file] [--threshold percent]\n",
+				argv[i], value ? " " : "", value ? value : "", argv[0]);
+			return 2;
+		}
+	}
+
+	BenchmarkSuite suite{filter};
+	benchmark_loaders(suite);
+	benchmark_spheres(suite);
+	benchmark_transforms(suite);
+	benchmark_scene_graph(suite);
+	benchmark_bvh(suite);
+
+	// The rest needs GL, without a display as well, so always headless
+	HeadlessContext headless{};
+	if (headless.open(frame_width, frame_height))
+	{
+		benchmark_textures(suite);
+		benchmark_shaders(suite);
+		benchmark_vertex_fetch(suite);
+		benchmark_frames(suite, headless);
+		deleteShapes();
+		headless.close();
+	}
+	else
+		printf("No headless GL context, only the benchmarks without GL ran\n");
+
+	if (!suite.writeJSON(json_path))
+		return 2;
+	if (!baseline_path)
+		return 0;
+	std::vector<BenchmarkResult> baseline;
+	if (!readBenchmarkJSON(baseline_path, baseline))
+		return 2;
+	return compareBenchmarks(suite.results(), baseline, threshold) ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "benchmark.hpp"
+
+namespace {
+
+// Sends stdout to the null device for as long as it exists
+class QuietStdout
+{
+public:
+	QuietStdout()
+	{
+		fflush(stdout);
+		saved_ = dup(fileno(stdout));
+#ifdef _WIN32
+		int null = open("NUL", O_WRONLY);
+#else
+		int null = open("/dev/null", O_WRONLY);
+#endif
+		if (saved_ >= 0 && null >= 0)
+			dup2(null, fileno(stdout));
+		if (null >= 0)
+			close(null);
+	}
+	~QuietStdout()
+	{
+		fflush(stdout);
+		if (saved_ >= 0)
+		{
+			dup2(saved_, fileno(stdout));
+			close(saved_);
+		}
+	}
+	QuietStdout(const QuietStdout &) = delete;
+	QuietStdout & operator=(const QuietStdout &) = delete;
+
+private:
+	int saved_{-1};
+};
+
+// Nearest rank of sorted values
+double percentile(const std::vector<double> & sorted, double p)
+{
+	size_t rank = size_t(std::ceil(p * sorted.size()));
+	return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+// Names as JSON strings, only " and \ need escaping in them
+std::string escapeJSON(const std::string & text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+} // namespace
+
+bool BenchmarkSuite::selected(const std::string & name) const
+{
+	return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+void BenchmarkSuite::run(const std::string & name, const std::function<void()> & body)
+{
+	measure(name, [&body]()
+	{
+		std::chrono::steady_clock::time_point begin{std::chrono::steady_clock::now()};
+		body();
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	});
+}
+
+void BenchmarkSuite::measure(const std::string & name, const std::function<double()> & body)
+{
+	if (!selected(name))
+		return;
+	typedef std::chrono::steady_clock Clock;
+	std::vector<double> times;
+	{
+		QuietStdout quiet;
+		body();
+		Clock::time_point start{Clock::now()};
+		while (times.size() < MaxIterations && (times.size() < MinIterations || std::chrono::duration<double>(Clock::now() - start).count() < MinSeconds))
+			times.push_back(body());
+	}
+
+	BenchmarkResult result{};
+	result.name = name;
+	result.iterations = times.size();
+	for (double time : times)
+		result.mean += time;
+	result.mean /= times.size();
+	std::sort(times.begin(), times.end());
+	result.median = percentile(times, 0.5);
+	result.p95 = percentile(times, 0.95);
+	result.min = times.front();
+	results_.push_back(result);
+	printf("%-36s %10.4f ms median %10.4f ms min %10.4f ms p95 (%zu runs)\n", name.c_str(), result.median, result.min, result.p95, result.iterations);
+}
+
+bool BenchmarkSuite::writeJSON(const char * path) const
+{
+	FILE * file = fopen(path, "w");
+	if (!file)
+	{
+		printf("Impossible to write %s\n", path);
+		return false;
+	}
+	// One benchmark per line, readBenchmarkJSON depends on it
+	fprintf(file, "{\"benchmarks\":[\n");
+	for (size_t i = 0; i < results_.size(); ++i)
+	{
+		const BenchmarkResult & result = results_[i];
+		fprintf(file, "{\"name\":\"%s\",\"iterations\":%zu,\"median_ms\":%.6f,\"mean_ms\":%.6f,\"min_ms\":%.6f,\"p95_ms\":%.6f}%s\n",
+			escapeJSON(result.name).c_str(), result.iterations, result.median, result.mean, result.min, result.p95, i + 1 < results_.size() ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	bool written = !ferror(file);
+	fclose(file);
+	if (written)
+		printf("Wrote %zu benchmark results to %s\n", results_.size(), path);
+	return written;
+}
+
+bool readBenchmarkJSON(const char * path, std::vector<BenchmarkResult> & results)
+{
+	FILE * file = fopen(path, "r");
+	if (!file)
+	{
+		printf("Impossible to open %s\n", path);
+		return false;
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), file))
+	{
+		const char * name = strstr(line, "\"name\":\"");
+		const char * median = strstr(line, "\"median_ms\":");
+		if (!name || !median)
+			continue;
+		BenchmarkResult result{};
+		const char * nameEnd = name + strlen("\"name\":\"");
+		for (; *nameEnd && *nameEnd != '"'; ++nameEnd)
+		{
+			if (*nameEnd == '\\' && nameEnd[1])
+				++nameEnd;
+			result.name += *nameEnd;
+		}
+		if (*nameEnd != '"')
+			continue;
+		result.median = strtod(median + strlen("\"median_ms\":"), nullptr);
+		results.push_back(result);
+	}
+	fclose(file);
+	return true;
+}
+
+size_t compareBenchmarks(const std::vector<BenchmarkResult> & results, const std::vector<BenchmarkResult> & baseline, double threshold)
+{
+	const double NoiseMilliseconds = 0.001;
+	size_t regressions = 0;
+	printf("Against the baseline, median times, slower by more than %.0f %% is a regression:\n", threshold * 100.0);
+	for (const BenchmarkResult & result : results)
+	{
+		auto found = std::find_if(baseline.begin(), baseline.end(), [&result](const BenchmarkResult & old) { return old.name == result.name; });
+		if (found == baseline.end())
+		{
+			printf("  %-36s %10.4f ms   (new)\n", result.name.c_str(), result.median);
+			continue;
+		}
+		double change = found->median > 0.0 ? result.median / found->median - 1.0 : 0.0;
+		bool regressed = change > threshold && result.median > NoiseMilliseconds;
+		regressions += regressed;
+		printf("  %-36s %10.4f ms %10.4f ms %+7.1f %%%s\n", result.name.c_str(), found->median, result.median, change * 100.0,
+			regressed ? "  REGRESSION" : "");
+	}
+	printf("%zu regressions\n", regressions);
+	return regressions;
+}
@@ -0,0 +1,38 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+
+Bounds computeBounds(const glm::vec3 * positions, size_t count)
+{
+	Bounds bounds{};
+	if (!count)
+		return bounds;
+	bounds.min = bounds.max = positions[0];
+	for (size_t i = 1; i < count; ++i)
+	{
+		bounds.min = glm::min(bounds.min, positions[i]);
+		bounds.max = glm::max(bounds.max, positions[i]);
+	}
+	bounds.center = (bounds.min + bounds.max) * 0.5f;
+	float radiusSquared{0.0f};
+	for (size_t i = 0; i < count; ++i)
+	{
+		glm::vec3 offset{positions[i] - bounds.center};
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	bounds.radius = std::sqrt(radiusSquared);
+	return bounds;
+}
+
+glm::vec4 transformSphere(const Bounds & bounds, const glm::mat4 & model)
+{
+	glm::vec4 center{model * glm::vec4(bounds.center, 1.0f)};
+	float scaleSquared{std::max(std::max(
+		glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+		glm::dot(glm::vec3(model[1]), glm::vec3(model[1]))),
+		glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))};
+	return glm::vec4(glm::vec3(center), bounds.radius * std::sqrt(scaleSquared));
+}
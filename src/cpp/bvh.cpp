@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+const int SAHBins = 16;
+// Ranges smaller than this are not worth a thread of their own
+const size_t MinParallelTriangles = 16384;
+const float Infinity = std::numeric_limits<float>::infinity();
+
+struct Box
+{
+	glm::vec3 min{Infinity};
+	glm::vec3 max{-Infinity};
+
+	void grow(const glm::vec3 & point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+	void grow(const Box & box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+	float area() const
+	{
+		glm::vec3 extent{max - min};
+		if (extent.x < 0.0f)
+			return 0.0f;
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+};
+
+// Node of the binary tree, before it is collapsed into four-wide nodes
+struct BinaryNode
+{
+	Box box;
+	uint32_t left, right; // inner nodes
+	uint32_t first, count; // leaves, count 0 for inner nodes
+};
+
+struct Builder
+{
+	std::vector<Box> boxes;          // per triangle
+	std::vector<glm::vec3> centroids; // per triangle
+	std::vector<uint32_t> ids;        // gets partitioned into the leaf order
+};
+
+// Builds the subtree over ids[begin, end) into out and returns the index of its root.
+// While parallelDepth > 0 the right half goes to a thread of its own, with a node array of its own.
+uint32_t buildRecursive(Builder & builder, uint32_t begin, uint32_t end, std::vector<BinaryNode> & out, int parallelDepth)
+{
+	uint32_t index{uint32_t(out.size())};
+	out.push_back(BinaryNode{});
+	Box box, centroidBox;
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		box.grow(builder.boxes[builder.ids[i]]);
+		centroidBox.grow(builder.centroids[builder.ids[i]]);
+	}
+	out[index].box = box;
+	uint32_t count{end - begin};
+	if (count <= BVH::MaxLeafTriangles)
+	{
+		out[index].first = begin;
+		out[index].count = count;
+		return index;
+	}
+
+	// Binned SAH: sort the centroids into bins along each axis and evaluate the planes between them
+	int bestAxis{-1}, bestSplit{0};
+	float bestCost{Infinity};
+	glm::vec3 extent{centroidBox.max - centroidBox.min};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (extent[axis] <= 0.0f)
+			continue;
+		Box bins[SAHBins];
+		uint32_t binCounts[SAHBins]{};
+		float scale{SAHBins / extent[axis]};
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			uint32_t id{builder.ids[i]};
+			int bin{std::min(SAHBins - 1, int((builder.centroids[id][axis] - centroidBox.min[axis]) * scale))};
+			bins[bin].grow(builder.boxes[id]);
+			++binCounts[bin];
+		}
+		// Sweep from the right, then from the left
+		float rightArea[SAHBins];
+		uint32_t rightCount[SAHBins];
+		Box sweep;
+		uint32_t sweepCount{0};
+		for (int bin = SAHBins - 1; bin > 0; --bin)
+		{
+			sweep.grow(bins[bin]);
+			sweepCount += binCounts[bin];
+			rightArea[bin] = sweep.area();
+			rightCount[bin] = sweepCount;
+		}
+		sweep = Box{};
+		sweepCount = 0;
+		for (int split = 1; split < SAHBins; ++split)
+		{
+			sweep.grow(bins[split - 1]);
+			sweepCount += binCounts[split - 1];
+			if (!sweepCount || !rightCount[split])
+				continue;
+			float cost{sweep.area() * sweepCount + rightArea[split] * rightCount[split]};
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	uint32_t middle;
+	if (bestAxis >= 0)
+	{
+		float scale{SAHBins / extent[bestAxis]};
+		float low{centroidBox.min[bestAxis]};
+		uint32_t * split{std::partition(&builder.ids[begin], &builder.ids[0] + end, [&](uint32_t id) -> bool {
+			return std::min(SAHBins - 1, int((builder.centroids[id][bestAxis] - low) * scale)) < bestSplit;
+		})};
+		middle = uint32_t(split - &builder.ids[0]);
+	}
+	else
+	{
+		// All centroids in one point, any split is as good as another
+		middle = begin + count / 2;
+	}
+
+	uint32_t left, right;
+	if (parallelDepth > 0 && count >= MinParallelTriangles)
+	{
+		// The ranges are disjoint, so both halves can partition builder.ids at the same time
+		std::vector<BinaryNode> rightNodes;
+		std::thread thread([&]() {
+			buildRecursive(builder, middle, end, rightNodes, parallelDepth - 1);
+		});
+		left = buildRecursive(builder, begin, middle, out, parallelDepth - 1);
+		thread.join();
+		uint32_t offset{uint32_t(out.size())};
+		for (BinaryNode node : rightNodes)
+		{
+			if (!node.count)
+			{
+				node.left += offset;
+				node.right += offset;
+			}
+			out.push_back(node);
+		}
+		right = offset;
+	}
+	else
+	{
+		left = buildRecursive(builder, begin, middle, out, parallelDepth);
+		right = buildRecursive(builder, middle, end, out, parallelDepth);
+	}
+	out[index].left = left;
+	out[index].right = right;
+	out[index].count = 0;
+	return index;
+}
+
+inline bool intersectTriangle(const glm::vec3 & v0, const glm::vec3 & e1, const glm::vec3 & e2,
+	const Ray & ray, float tMax, float & t, float & u, float & v)
+{
+	glm::vec3 p{glm::cross(ray.direction, e2)};
+	float determinant{glm::dot(e1, p)};
+	if (std::fabs(determinant) < 1e-12f)
+		return false;
+	float inverse{1.0f / determinant};
+	glm::vec3 s{ray.origin - v0};
+	u = glm::dot(s, p) * inverse;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q{glm::cross(s, e1)};
+	v = glm::dot(ray.direction, q) * inverse;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	t = glm::dot(e2, q) * inverse;
+	return t >= ray.tMin && t <= tMax;
+}
+
+} // namespace
+
+void BVH::build(const glm::vec3 * vertices, const unsigned int * indices, size_t indexCount, unsigned int threads)
+{
+	nodes_.clear();
+	triangles_.clear();
+	triangleIds_.clear();
+	depth_ = 0;
+	size_t triangleCount{indexCount / 3};
+	if (!triangleCount)
+		return;
+
+	Builder builder;
+	builder.boxes.resize(triangleCount);
+	builder.centroids.resize(triangleCount);
+	builder.ids.resize(triangleCount);
+	for (size_t i = 0; i < triangleCount; ++i)
+	{
+		Box box;
+		for (int corner = 0; corner < 3; ++corner)
+			box.grow(vertices[indices[3 * i + corner]]);
+		builder.boxes[i] = box;
+		builder.centroids[i] = (box.min + box.max) * 0.5f;
+		builder.ids[i] = uint32_t(i);
+	}
+
+	if (!threads)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	int parallelDepth{0};
+	while ((1u << parallelDepth) < threads)
+		++parallelDepth;
+	std::vector<BinaryNode> binary;
+	binary.reserve(2 * triangleCount / MaxLeafTriangles + 1);
+	buildRecursive(builder, 0, uint32_t(triangleCount), binary, parallelDepth);
+
+	// Triangles in leaf order, so a leaf reads one contiguous range
+	triangles_.resize(triangleCount);
+	triangleIds_ = builder.ids;
+	for (size_t i = 0; i < triangleCount; ++i)
+	{
+		const unsigned int * corners{&indices[3 * triangleIds_[i]]};
+		glm::vec3 v0{vertices[corners[0]]};
+		triangles_[i] = Triangle{v0, vertices[corners[1]] - v0, vertices[corners[2]] - v0};
+	}
+
+	// Collapse: each four-wide node takes the children of its binary node and keeps
+	// opening the inner child with the largest surface until it has four
+	struct Pending
+	{
+		uint32_t binary;
+		uint32_t node; // four-wide
+		unsigned int depth;
+	};
+	std::vector<Pending> pending{{0u, 0u, 1u}};
+	nodes_.push_back(Node{});
+	while (!pending.empty())
+	{
+		uint32_t binaryIndex{pending.back().binary};
+		uint32_t nodeIndex{pending.back().node};
+		unsigned int depth{pending.back().depth};
+		pending.pop_back();
+		depth_ = std::max(depth_, depth);
+
+		uint32_t children[4];
+		int childCount{0};
+		if (binary[binaryIndex].count)
+			children[childCount++] = binaryIndex; // the root is a leaf
+		else
+		{
+			children[childCount++] = binary[binaryIndex].left;
+			children[childCount++] = binary[binaryIndex].right;
+		}
+		while (childCount < 4)
+		{
+			int largest{-1};
+			float largestArea{-1.0f};
+			for (int i = 0; i < childCount; ++i)
+			{
+				const BinaryNode & child{binary[children[i]]};
+				if (!child.count && child.box.area() > largestArea)
+				{
+					largest = i;
+					largestArea = child.box.area();
+				}
+			}
+			if (largest < 0)
+				break;
+			const BinaryNode & opened{binary[children[largest]]};
+			children[largest] = opened.left;
+			children[childCount++] = opened.right;
+		}
+
+		Node node;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (i >= childCount)
+			{
+				// Inverted box, never hit
+				node.minX[i] = node.minY[i] = node.minZ[i] = Infinity;
+				node.maxX[i] = node.maxY[i] = node.maxZ[i] = -Infinity;
+				node.child[i] = Empty;
+				node.count[i] = 0;
+				continue;
+			}
+			const BinaryNode & child{binary[children[i]]};
+			node.minX[i] = child.box.min.x;
+			node.minY[i] = child.box.min.y;
+			node.minZ[i] = child.box.min.z;
+			node.maxX[i] = child.box.max.x;
+			node.maxY[i] = child.box.max.y;
+			node.maxZ[i] = child.box.max.z;
+			if (child.count)
+			{
+				node.child[i] = child.first;
+				node.count[i] = child.count;
+			}
+			else
+			{
+				node.child[i] = uint32_t(nodes_.size());
+				node.count[i] = 0;
+				pending.push_back({children[i], uint32_t(nodes_.size()), depth + 1});
+				nodes_.push_back(Node{});
+			}
+		}
+		nodes_[nodeIndex] = node;
+	}
+}
+
+template <bool AnyHit>
+bool BVH::traverse(const Ray & ray, RayHit & hit) const
+{
+	if (nodes_.empty())
+		return false;
+	glm::vec3 inverse{1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z};
+	bool found{false};
+	float tMax{std::min(ray.tMax, hit.t)};
+
+	struct Entry
+	{
+		uint32_t node;
+		float tNear;
+	};
+	// Each node takes its entry off and puts at most four on, so the depth bounds the stack.
+	// Usual trees fit the one on the stack, a degenerate one gets a bigger one.
+	const size_t LocalStack{256};
+	size_t stackCapacity{3 * size_t(depth_) + 1};
+	Entry local[LocalStack];
+	std::vector<Entry> heap;
+	Entry * stack{local};
+	if (stackCapacity > LocalStack)
+	{
+		heap.resize(stackCapacity);
+		stack = heap.data();
+	}
+	size_t stackSize{0};
+	stack[stackSize++] = Entry{0, ray.tMin};
+
+#ifdef BVH_SSE
+	const __m128 originX{_mm_set1_ps(ray.origin.x)}, originY{_mm_set1_ps(ray.origin.y)}, originZ{_mm_set1_ps(ray.origin.z)};
+	const __m128 inverseX{_mm_set1_ps(inverse.x)}, inverseY{_mm_set1_ps(inverse.y)}, inverseZ{_mm_set1_ps(inverse.z)};
+	const __m128 rayMin{_mm_set1_ps(ray.tMin)};
+#endif
+
+	while (stackSize)
+	{
+		Entry entry{stack[--stackSize]};
+		if (entry.tNear > tMax)
+			continue;
+		const Node & node{nodes_[entry.node]};
+
+		// Slab test against the four child boxes
+		float tNear[4];
+		int hitMask{0};
+#ifdef BVH_SSE
+		__m128 t0x{_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX)};
+		__m128 t1x{_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX)};
+		__m128 t0y{_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY)};
+		__m128 t1y{_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY)};
+		__m128 t0z{_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ)};
+		__m128 t1z{_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ)};
+		__m128 enter{_mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), rayMin))};
+		__m128 leave{_mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)))};
+		hitMask = _mm_movemask_ps(_mm_cmple_ps(enter, leave));
+		_mm_storeu_ps(tNear, enter);
+#else
+		for (int i = 0; i < 4; ++i)
+		{
+			float t0x{(node.minX[i] - ray.origin.x) * inverse.x}, t1x{(node.maxX[i] - ray.origin.x) * inverse.x};
+			float t0y{(node.minY[i] - ray.origin.y) * inverse.y}, t1y{(node.maxY[i] - ray.origin.y) * inverse.y};
+			float t0z{(node.minZ[i] - ray.origin.z) * inverse.z}, t1z{(node.maxZ[i] - ray.origin.z) * inverse.z};
+			float enter{std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), ray.tMin))};
+			float leave{std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tMax))};
+			tNear[i] = enter;
+			if (enter <= leave)
+				hitMask |= 1 << i;
+		}
+#endif
+
+		// Visit the hit children near to far: leaves right away, inner nodes go on the stack far first
+		int order[4];
+		int hitCount{0};
+		for (int i = 0; i < 4; ++i)
+			if ((hitMask >> i) & 1 && node.child[i] != Empty)
+				order[hitCount++] = i;
+		std::sort(order, order + hitCount, [&tNear](int a, int b) { return tNear[a] < tNear[b]; });
+
+		for (int k = 0; k < hitCount; ++k)
+		{
+			int i{order[k]};
+			if (!node.count[i] || tNear[i] > tMax)
+				continue;
+			for (uint32_t triangle = node.child[i]; triangle < node.child[i] + node.count[i]; ++triangle)
+			{
+				const Triangle & candidate{triangles_[triangle]};
+				float t, u, v;
+				if (!intersectTriangle(candidate.v0, candidate.e1, candidate.e2, ray, tMax, t, u, v))
+					continue;
+				found = true;
+				tMax = t;
+				hit = RayHit{triangleIds_[triangle], t, u, v};
+				if (AnyHit)
+					return true;
+			}
+		}
+		for (int k = hitCount - 1; k >= 0; --k)
+		{
+			int i{order[k]};
+			if (!node.count[i] && tNear[i] <= tMax)
+			{
+				assert(stackSize < stackCapacity);
+				stack[stackSize++] = Entry{node.child[i], tNear[i]};
+			}
+		}
+	}
+	return found;
+}
+
+bool BVH::intersect(const Ray & ray, RayHit & hit) const
+{
+	hit = RayHit{};
+	return traverse<false>(ray, hit);
+}
+
+bool BVH::intersectSegment(const glm::vec3 & from, const glm::vec3 & to) const
+{
+	Ray ray;
+	ray.origin = from;
+	ray.direction = to - from;
+	ray.tMin = 0.0f;
+	ray.tMax = 1.0f;
+	RayHit hit;
+	return traverse<true>(ray, hit);
+}
@@ -0,0 +1,82 @@
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE 1
+#include <xmmintrin.h>
+#endif
+
+Frustum extractFrustum(const glm::mat4 & viewProjection)
+{
+	// glm is column major, m[column][row]
+	const glm::mat4 & m{viewProjection};
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; ++row)
+		rows[row] = glm::vec4(m[0][row], m[1][row], m[2][row], m[3][row]);
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // left
+	frustum.planes[1] = rows[3] - rows[0]; // right
+	frustum.planes[2] = rows[3] + rows[1]; // bottom
+	frustum.planes[3] = rows[3] - rows[1]; // top
+	frustum.planes[4] = rows[3] + rows[2]; // near
+	frustum.planes[5] = rows[3] - rows[2]; // far
+	for (glm::vec4 & plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+	return frustum;
+}
+
+static bool sphereVisible(const Frustum & frustum, const glm::vec4 & sphere)
+{
+	for (const glm::vec4 & plane : frustum.planes)
+		if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w)
+			return false;
+	return true;
+}
+
+size_t cullSpheres(const Frustum & frustum, const glm::vec4 * spheres, size_t count, uint8_t * visible)
+{
+	size_t visibleCount{0};
+	size_t i{0};
+#ifdef FRUSTUM_SSE
+	// Planes broadcast once, spheres transposed to x x x x, y y y y, ... so each plane is three multiply-adds for four spheres
+	__m128 planes[6][4];
+	for (int p = 0; p < 6; ++p)
+		for (int c = 0; c < 4; ++c)
+			planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x{_mm_loadu_ps(&spheres[i][0])};
+		__m128 y{_mm_loadu_ps(&spheres[i + 1][0])};
+		__m128 z{_mm_loadu_ps(&spheres[i + 2][0])};
+		__m128 r{_mm_loadu_ps(&spheres[i + 3][0])};
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+		__m128 negativeRadius{_mm_sub_ps(_mm_setzero_ps(), r)};
+
+		__m128 outside{_mm_setzero_ps()};
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 distance{_mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]))};
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+		}
+		int outsideMask{_mm_movemask_ps(outside)};
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			visible[i + lane] = (outsideMask >> lane) & 1 ? 0 : 1;
+			visibleCount += visible[i + lane];
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		visible[i] = sphereVisible(frustum, spheres[i]) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
@@ -0,0 +1,86 @@
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+
+GLState & glState()
+{
+	static GLState state;
+	return state;
+}
+
+int GLState::targetSlot(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D:       return 0;
+	case GL_TEXTURE_2D_ARRAY: return 1;
+	case GL_TEXTURE_CUBE_MAP: return 2;
+	case GL_TEXTURE_3D:       return 3;
+	default:                  return -1;
+	}
+}
+
+void GLState::useProgram(GLuint program)
+{
+	if (program == program_)
+	{
+		++counters_.programSkips;
+		return;
+	}
+	glUseProgram(program);
+	program_ = program;
+	++counters_.programBinds;
+}
+
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+	if (vertexArray == vertexArray_)
+	{
+		++counters_.vertexArraySkips;
+		return;
+	}
+	glBindVertexArray(vertexArray);
+	vertexArray_ = vertexArray;
+	++counters_.vertexArrayBinds;
+}
+
+void GLState::activeTexture(GLenum unit)
+{
+	if (activeUnitKnown_ && unit == activeUnit_)
+		return;
+	glActiveTexture(unit);
+	activeUnit_ = unit;
+	activeUnitKnown_ = true;
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+	int unit = activeUnitKnown_ ? static_cast<int>(activeUnit_ - GL_TEXTURE0) : -1;
+	int slot = targetSlot(target);
+	if (unit < 0 || unit >= TextureUnits || slot < 0)
+	{
+		// Not tracked, always goes to the driver
+		glBindTexture(target, texture);
+		++counters_.textureBinds;
+		return;
+	}
+	if (textures_[unit][slot] == texture)
+	{
+		++counters_.textureSkips;
+		return;
+	}
+	glBindTexture(target, texture);
+	textures_[unit][slot] = texture;
+	++counters_.textureBinds;
+}
+
+void GLState::invalidate()
+{
+	program_ = Unknown;
+	vertexArray_ = Unknown;
+	activeUnit_ = GL_TEXTURE0;
+	activeUnitKnown_ = false;
+	for (int unit = 0; unit < TextureUnits; ++unit)
+		for (int slot = 0; slot < TextureTargets; ++slot)
+			textures_[unit][slot] = Unknown;
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "headless.hpp"
+
+bool HeadlessContext::open(int width, int height)
+{
+	close();
+
+	// Surfaceless needs neither X nor Wayland nor a GPU. Without it the default display may still do, e.g. on a headless driver.
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	if (getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		printf("No EGL display (error 0x%x)\n", eglGetError());
+		return false;
+	}
+	display_ = display;
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		printf("EGL %d.%d has no desktop OpenGL\n", major, minor);
+		close();
+		return false;
+	}
+
+	// There is no surface, any config that renders OpenGL does. Without one EGL_KHR_no_config_context has to.
+	const EGLint configAttributes[]{EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	EGLConfig config;
+	EGLint configs = 0;
+	if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs == 0)
+		config = EGL_NO_CONFIG_KHR;
+	const EGLint contextAttributes[]{
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT)
+	{
+		printf("No OpenGL 3.3 core context from EGL %d.%d (error 0x%x)\n", major, minor, eglGetError());
+		close();
+		return false;
+	}
+	context_ = context;
+	// EGL_KHR_surfaceless_context: current without a surface, the framebuffer object is all there is to draw to
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		printf("The EGL context can't be made current without a surface (error 0x%x)\n", eglGetError());
+		close();
+		return false;
+	}
+
+	// GLEW built for GLX loads the functions and then misses the X display, there is none here
+	glewExperimental = true;
+	GLenum glew = glewInit();
+	if (glew != GLEW_OK && glew != GLEW_ERROR_NO_GLX_DISPLAY)
+	{
+		printf("Failed to initialize GLEW\n");
+		close();
+		return false;
+	}
+
+	glGenFramebuffers(1, &framebuffer_);
+	glGenRenderbuffers(1, &colorBuffer_);
+	glGenRenderbuffers(1, &depthBuffer_);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer_);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer_);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer_);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer_);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("The %dx%d framebuffer is incomplete (0x%x)\n", width, height, status);
+		close();
+		return false;
+	}
+	// A window sets the viewport to its size when the context is first made current, without a surface it is empty
+	glViewport(0, 0, width, height);
+	width_ = width;
+	height_ = height;
+	printf("Rendering headless into a %dx%d framebuffer: %s, %s\n", width, height,
+		reinterpret_cast<const char *>(glGetString(GL_RENDERER)), reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+	return true;
+}
+
+void HeadlessContext::close()
+{
+	if (context_)
+	{
+		if (framebuffer_)
+			glDeleteFramebuffers(1, &framebuffer_);
+		if (colorBuffer_)
+			glDeleteRenderbuffers(1, &colorBuffer_);
+		if (depthBuffer_)
+			glDeleteRenderbuffers(1, &depthBuffer_);
+		eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(display_, context_);
+	}
+	if (display_)
+		eglTerminate(display_);
+	framebuffer_ = colorBuffer_ = depthBuffer_ = 0;
+	context_ = nullptr;
+	display_ = nullptr;
+	width_ = height_ = 0;
+}
+
+void HeadlessContext::finishFrame()
+{
+	glFinish();
+}
+
+bool HeadlessContext::writePPM(const char * path) const
+{
+	if (!framebuffer_)
+		return false;
+	size_t row = size_t(width_) * 3;
+	std::vector<unsigned char> pixels(row * height_);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width_, height_, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+	FILE * file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Impossible to write %s\n", path);
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width_, height_);
+	// GL's rows go upwards
+	for (int y = height_ - 1; y >= 0; --y)
+		fwrite(pixels.data() + y * row, 1, row, file);
+	bool written = !ferror(file);
+	fclose(file);
+	return written;
+}
@@ -0,0 +1,152 @@
+#include "jobsystem.hpp"
+
+namespace {
+
+// Which job system the calling thread works for and its index there
+thread_local const JobSystem * currentSystem = nullptr;
+thread_local unsigned int currentIndex = 0;
+
+} // namespace
+
+JobSystem::JobSystem(unsigned int threads)
+	: threads_(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+	deques_(new Deque[threads_])
+{
+	for (unsigned int index = 1; index < threads_; ++index)
+		workers_.emplace_back(&JobSystem::work, this, index);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+		stopping_ = true;
+	}
+	wake_.notify_all();
+	for (std::thread & worker : workers_)
+		worker.join();
+}
+
+unsigned int JobSystem::threadIndex() const
+{
+	return currentSystem == this ? currentIndex : 0;
+}
+
+void JobSystem::run(void (*function)(const void *, size_t, size_t), const void * data, size_t begin, size_t end,
+	JobCounter * counter, JobCounter * after)
+{
+	Job job{function, data, begin, end, counter};
+	if (counter)
+		counter->pending_.fetch_add(1, std::memory_order_relaxed);
+	if (after)
+	{
+		// The last job of after takes the lock before it counts down, so it either sees this one or this sees zero
+		std::lock_guard<std::mutex> lock(after->mutex_);
+		if (after->pending_.load(std::memory_order_acquire) > 0)
+		{
+			after->waiting_.push_back(job);
+			return;
+		}
+	}
+	push(job);
+}
+
+void JobSystem::push(const Job & job)
+{
+	Deque & deque = deques_[threadIndex()];
+	{
+		std::lock_guard<std::mutex> lock(deque.mutex);
+		deque.jobs.push_back(job);
+	}
+	queued_.fetch_add(1);
+	// A worker going to sleep counts itself before it looks at queued_ a last time, so one of the two sees the other.
+	// Taking the mutex makes sure it is waiting by the time it is notified.
+	if (sleeping_.load() > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex_);
+		}
+		wake_.notify_one();
+	}
+}
+
+bool JobSystem::take(unsigned int index, Job & job)
+{
+	if (queued_.load(std::memory_order_relaxed) == 0)
+		return false;
+	// The newest of its own jobs first, then the oldest of someone else's
+	for (unsigned int i = 0; i < threads_; ++i)
+	{
+		unsigned int victim = (index + i) % threads_;
+		Deque & deque = deques_[victim];
+		std::lock_guard<std::mutex> lock(deque.mutex);
+		if (deque.jobs.empty())
+			continue;
+		if (i == 0)
+		{
+			job = deque.jobs.back();
+			deque.jobs.pop_back();
+		}
+		else
+		{
+			job = deque.jobs.front();
+			deque.jobs.pop_front();
+		}
+		queued_.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void JobSystem::execute(const Job & job)
+{
+	job.function(job.data, job.begin, job.end);
+	JobCounter * counter = job.counter;
+	if (!counter)
+		return;
+	std::vector<Job> released;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex_);
+		if (counter->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			released.swap(counter->waiting_);
+	}
+	// Not a member of the counter any more, its owner may be gone
+	for (const Job & next : released)
+		push(next);
+}
+
+void JobSystem::wait(JobCounter & counter)
+{
+	unsigned int index = threadIndex();
+	while (!counter.done())
+	{
+		Job job;
+		if (take(index, job))
+			execute(job);
+		else
+			std::this_thread::yield();
+	}
+	// The job that counted down to zero may still hold the lock
+	std::lock_guard<std::mutex> lock(counter.mutex_);
+}
+
+void JobSystem::work(unsigned int index)
+{
+	currentSystem = this;
+	currentIndex = index;
+	for (;;)
+	{
+		Job job;
+		if (take(index, job))
+		{
+			execute(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex_);
+		sleeping_.fetch_add(1);
+		wake_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+		sleeping_.fetch_sub(1);
+		if (stopping_)
+			break;
+	}
+}
@@ -0,0 +1,134 @@
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.hpp"
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		std::swap(opened_, other.opened_);
+#ifdef _WIN32
+		std::swap(file_, other.file_);
+		std::swap(mapping_, other.mapping_);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char * path)
+{
+	close();
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	file_ = file;
+	opened_ = true;
+	size_ = static_cast<std::size_t>(size.QuadPart);
+	if (size_ == 0)
+		return true; // empty files can't be mapped, but they are valid
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+	{
+		close();
+		return false;
+	}
+	mapping_ = mapping;
+	data_ = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data_)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data_)
+		UnmapViewOfFile(data_);
+	if (mapping_)
+		CloseHandle(mapping_);
+	if (file_)
+		CloseHandle(file_);
+	data_ = nullptr;
+	mapping_ = nullptr;
+	file_ = nullptr;
+	size_ = 0;
+	opened_ = false;
+}
+
+#else
+
+bool MappedFile::open(const char * path)
+{
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	opened_ = true;
+	size_ = static_cast<std::size_t>(info.st_size);
+	if (size_ == 0)
+	{
+		::close(fd);
+		return true; // empty files can't be mapped, but they are valid
+	}
+
+	void * mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	::close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		size_ = 0;
+		opened_ = false;
+		return false;
+	}
+	madvise(mapping, size_, MADV_SEQUENTIAL);
+	data_ = static_cast<const char *>(mapping);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data_)
+		munmap(const_cast<char *>(data_), size_);
+	data_ = nullptr;
+	size_ = 0;
+	opened_ = false;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+#include "asset.hpp"
+#include "hash.hpp"
+#include "mappedfile.hpp"
+#include "meshcache.hpp"
+
+namespace {
+
+// Bump whenever the layout below or the processing of the mesh changes, old files are then ignored and rewritten.
+// 2: triangles and vertices are reordered by optimizeMesh
+// 3: simplified levels of detail follow the indices
+// 4: normals computed from the faces for files without vn lines
+const uint32_t MeshCacheVersion = 4;
+const char MeshCacheMagic[4] = {'C', 'G', 'M', 'C'};
+
+// Every array starts at a multiple of this, relative to the start of the file
+const uint64_t MeshCacheAlignment = 16;
+
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t pathHash;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t sourceHash;
+	uint64_t vertexCount;
+	uint64_t indexCount; // all levels
+	uint64_t lodCount;
+	uint64_t verticesOffset;
+	uint64_t uvsOffset;
+	uint64_t normalsOffset;
+	uint64_t indicesOffset;
+	uint64_t lodsOffset;
+};
+
+// What identifies the state of a source file on disk
+struct SourceKey
+{
+	uint64_t pathHash;
+	uint64_t size;
+	int64_t time;
+};
+
+bool sourceKey(const char * sourcePath, SourceKey & key)
+{
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::absolute(sourcePath, error);
+	if (error)
+		return false;
+	key.size = std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+	key.time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	if (error)
+		return false;
+	key.pathHash = hashString(path.generic_string().c_str());
+	return true;
+}
+
+uint64_t hashSource(const char * sourcePath)
+{
+	MappedFile source(sourcePath);
+	return hashBytes(source.data(), source.size());
+}
+
+inline uint64_t alignUp(uint64_t offset)
+{
+	return (offset + MeshCacheAlignment - 1) / MeshCacheAlignment * MeshCacheAlignment;
+}
+
+// Whether count elements of elementSize bytes at offset are inside the file, written so nothing can overflow
+inline bool arrayInFile(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+{
+	return offset % MeshCacheAlignment == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+} // namespace
+
+std::string meshCachePath(const char * sourcePath)
+{
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::absolute(sourcePath, error);
+	char name[32];
+	snprintf(name, sizeof(name), "-%016llx.mesh", static_cast<unsigned long long>(hashString(path.generic_string().c_str())));
+
+	std::filesystem::path directory(CACHE_DIR);
+	std::filesystem::create_directories(directory, error);
+	if (error || !std::filesystem::is_directory(directory, error))
+		return path.string() + ".mesh";
+	return (directory / (path.stem().string() + name)).string();
+}
+
+bool MeshCache::open(const char * sourcePath)
+{
+	close();
+	SourceKey key;
+	if (!sourceKey(sourcePath, key))
+		return false;
+	std::string cachePath = meshCachePath(sourcePath);
+	if (!file_.open(cachePath.c_str()))
+		return false;
+
+	MeshCacheHeader header;
+	if (file_.size() < sizeof(header))
+	{
+		close();
+		return false;
+	}
+	memcpy(&header, file_.data(), sizeof(header));
+	if (memcmp(header.magic, MeshCacheMagic, 4) != 0 || header.version != MeshCacheVersion
+		|| header.pathHash != key.pathHash || header.sourceSize != key.size)
+	{
+		close();
+		return false;
+	}
+	// A truncated or corrupted file must not hand out pointers past the mapping or indices past the vertices
+	uint64_t fileSize = file_.size();
+	if (!arrayInFile(header.verticesOffset, header.vertexCount, sizeof(glm::vec3), fileSize)
+		|| !arrayInFile(header.uvsOffset, header.vertexCount, sizeof(glm::vec2), fileSize)
+		|| !arrayInFile(header.normalsOffset, header.vertexCount, sizeof(glm::vec3), fileSize)
+		|| !arrayInFile(header.indicesOffset, header.indexCount, sizeof(unsigned int), fileSize)
+		|| header.lodCount == 0 || !arrayInFile(header.lodsOffset, header.lodCount, sizeof(MeshLOD), fileSize))
+	{
+		close();
+		return false;
+	}
+	const MeshLOD * lods = reinterpret_cast<const MeshLOD *>(file_.data() + header.lodsOffset);
+	lods_.assign(lods, lods + header.lodCount);
+	for (const MeshLOD & lod : lods_)
+	{
+		if (uint64_t(lod.firstIndex) + lod.indexCount > header.indexCount)
+		{
+			close();
+			return false;
+		}
+	}
+	const unsigned int * indices = reinterpret_cast<const unsigned int *>(file_.data() + header.indicesOffset);
+	for (uint64_t i = 0; i < header.indexCount; ++i)
+	{
+		if (indices[i] >= header.vertexCount)
+		{
+			close();
+			return false;
+		}
+	}
+
+	// A touched but unchanged file (checkout, copy) still hits. It costs one pass over the source,
+	// once: the new time is stamped into the cache. If that fails the next run just hashes again.
+	if (header.sourceTime != key.time)
+	{
+		if (header.sourceHash != hashSource(sourcePath))
+		{
+			close();
+			return false;
+		}
+		std::fstream stamp(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+		stamp.seekp(offsetof(MeshCacheHeader, sourceTime));
+		stamp.write(reinterpret_cast<const char *>(&key.time), sizeof(key.time));
+	}
+
+	vertexCount_ = header.vertexCount;
+	indexCount_ = lods_[0].indexCount;
+	vertices_ = reinterpret_cast<const glm::vec3 *>(file_.data() + header.verticesOffset);
+	uvs_ = reinterpret_cast<const glm::vec2 *>(file_.data() + header.uvsOffset);
+	normals_ = reinterpret_cast<const glm::vec3 *>(file_.data() + header.normalsOffset);
+	indices_ = reinterpret_cast<const unsigned int *>(file_.data() + header.indicesOffset);
+	return true;
+}
+
+void MeshCache::assign(std::vector<unsigned int> indices, std::vector<glm::vec3> vertices, std::vector<glm::vec2> uvs,
+	std::vector<glm::vec3> normals, std::vector<MeshLOD> lods)
+{
+	close();
+	if (lods.empty() || indices.empty())
+		return;
+	indexStorage_ = std::move(indices);
+	vertexStorage_ = std::move(vertices);
+	uvStorage_ = std::move(uvs);
+	normalStorage_ = std::move(normals);
+	lods_ = std::move(lods);
+
+	vertexCount_ = vertexStorage_.size();
+	indexCount_ = lods_[0].indexCount;
+	vertices_ = vertexStorage_.data();
+	uvs_ = uvStorage_.data();
+	normals_ = normalStorage_.data();
+	indices_ = indexStorage_.data();
+}
+
+void MeshCache::close()
+{
+	file_.close();
+	vertexCount_ = indexCount_ = 0;
+	vertices_ = nullptr;
+	uvs_ = nullptr;
+	normals_ = nullptr;
+	indices_ = nullptr;
+	lods_.clear();
+	indexStorage_.clear();
+	vertexStorage_.clear();
+	uvStorage_.clear();
+	normalStorage_.clear();
+}
+
+bool writeMeshCache(
+	const char * sourcePath,
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	const std::vector<MeshLOD> & lods
+){
+	SourceKey key;
+	if (!sourceKey(sourcePath, key))
+		return false;
+
+	MeshCacheHeader header{};
+	memcpy(header.magic, MeshCacheMagic, 4);
+	header.version = MeshCacheVersion;
+	header.pathHash = key.pathHash;
+	header.sourceSize = key.size;
+	header.sourceTime = key.time;
+	header.sourceHash = hashSource(sourcePath);
+	header.vertexCount = vertices.size();
+	header.indexCount = indices.size();
+	header.lodCount = lods.size();
+	header.verticesOffset = alignUp(sizeof(header));
+	header.uvsOffset = alignUp(header.verticesOffset + vertices.size() * sizeof(glm::vec3));
+	header.normalsOffset = alignUp(header.uvsOffset + uvs.size() * sizeof(glm::vec2));
+	header.indicesOffset = alignUp(header.normalsOffset + normals.size() * sizeof(glm::vec3));
+	header.lodsOffset = alignUp(header.indicesOffset + indices.size() * sizeof(unsigned int));
+
+	// Write next to the final file and rename, so a crash never leaves a half written cache behind
+	std::string cachePath = meshCachePath(sourcePath);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		auto writeAt = [&out](uint64_t offset, const void * data, size_t size) {
+			static const char padding[MeshCacheAlignment] = {};
+			out.write(padding, offset - static_cast<uint64_t>(out.tellp()));
+			out.write(static_cast<const char *>(data), size);
+		};
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		writeAt(header.verticesOffset, vertices.data(), vertices.size() * sizeof(glm::vec3));
+		writeAt(header.uvsOffset, uvs.data(), uvs.size() * sizeof(glm::vec2));
+		writeAt(header.normalsOffset, normals.data(), normals.size() * sizeof(glm::vec3));
+		writeAt(header.indicesOffset, indices.data(), indices.size() * sizeof(unsigned int));
+		writeAt(header.lodsOffset, lods.data(), lods.size() * sizeof(MeshLOD));
+		if (!out)
+		{
+			out.close();
+			std::error_code error;
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+	return !error;
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "meshoptimizer.hpp"
+
+namespace {
+
+// FIFO cache simulation with time stamps: a vertex is still cached if fewer than
+// cacheSize vertices have been transformed since it was
+struct CacheSimulation
+{
+	std::vector<unsigned int> stamps;
+	unsigned int time;
+	unsigned int cacheSize;
+
+	CacheSimulation(size_t vertexCount, unsigned int size) : stamps(vertexCount, 0), time(size + 1), cacheSize(size) {}
+
+	// Returns true on a miss
+	bool access(unsigned int vertex)
+	{
+		if (time - stamps[vertex] > cacheSize)
+		{
+			stamps[vertex] = time++;
+			return true;
+		}
+		return false;
+	}
+
+	unsigned int accessTriangle(const unsigned int * triangle)
+	{
+		return access(triangle[0]) + access(triangle[1]) + access(triangle[2]);
+	}
+
+	// Forget everything that is cached
+	void flush()
+	{
+		time += cacheSize + 1;
+	}
+};
+
+// Triangles using each vertex, as one array with an offset per vertex
+struct Adjacency
+{
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> triangles;
+
+	Adjacency(const std::vector<unsigned int> & indices, size_t vertexCount) : offsets(vertexCount + 1, 0), triangles(indices.size())
+	{
+		for (unsigned int index : indices)
+			++offsets[index + 1];
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)
+			triangles[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+	}
+};
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize)
+{
+	CacheSimulation cache(vertexCount, cacheSize);
+	std::vector<bool> used(vertexCount, false);
+	size_t misses = 0;
+	size_t usedCount = 0;
+	for (unsigned int index : indices)
+	{
+		misses += cache.access(index);
+		if (!used[index])
+		{
+			used[index] = true;
+			++usedCount;
+		}
+	}
+	size_t triangles = indices.size() / 3;
+	return VertexCacheStats{
+		triangles ? static_cast<float>(misses) / triangles : 0.0f,
+		usedCount ? static_cast<float>(misses) / usedCount : 0.0f
+	};
+}
+
+void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize, std::vector<size_t> * clusters)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (clusters)
+		clusters->clear();
+	if (triangleCount == 0)
+		return;
+
+	Adjacency adjacency(indices, vertexCount);
+	std::vector<unsigned int> live(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+
+	std::vector<unsigned int> stamps(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEnds;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	long long fanning = indices[0];
+	if (clusters)
+		clusters->push_back(0);
+
+	while (fanning >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (unsigned int a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a)
+		{
+			unsigned int triangle = adjacency.triangles[a];
+			if (emitted[triangle])
+				continue;
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				unsigned int v = indices[3 * triangle + corner];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - stamps[v] > cacheSize)
+					stamps[v] = time++;
+			}
+			emitted[triangle] = true;
+		}
+
+		// Next fanning vertex: the candidate that will still be in the cache after its
+		// remaining triangles were emitted, and of those the one that entered it first
+		fanning = -1;
+		long long best = -1;
+		for (unsigned int v : candidates)
+		{
+			if (live[v] == 0)
+				continue;
+			long long priority = 0;
+			if (time - stamps[v] + 2 * live[v] <= cacheSize)
+				priority = time - stamps[v];
+			if (priority > best)
+			{
+				best = priority;
+				fanning = v;
+			}
+		}
+		if (fanning >= 0)
+			continue;
+
+		// Dead end: try the recently used vertices, then just the next vertex with triangles left
+		while (!deadEnds.empty() && fanning < 0)
+		{
+			unsigned int v = deadEnds.back();
+			deadEnds.pop_back();
+			if (live[v] > 0)
+				fanning = v;
+		}
+		while (fanning < 0 && cursor < vertexCount)
+		{
+			if (live[cursor] > 0)
+				fanning = static_cast<long long>(cursor);
+			++cursor;
+		}
+		if (fanning >= 0 && clusters)
+			clusters->push_back(output.size() / 3);
+	}
+
+	indices.swap(output);
+}
+
+namespace {
+
+// Soft boundaries: inside every hard cluster, start a new one wherever the ACMR
+// since the last split is already close to that of the whole cluster
+std::vector<size_t> splitClusters(const std::vector<unsigned int> & indices, size_t vertexCount,
+	const std::vector<size_t> & clusters, float threshold, unsigned int cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+	std::vector<size_t> soft;
+	CacheSimulation cache(vertexCount, cacheSize);
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		size_t begin = clusters[c];
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+		cache.flush();
+		size_t clusterMisses = 0;
+		for (size_t t = begin; t < end; ++t)
+			clusterMisses += cache.accessTriangle(&indices[3 * t]);
+		float target = threshold * clusterMisses / static_cast<float>(end - begin);
+
+		cache.flush();
+		soft.push_back(begin);
+		size_t misses = 0;
+		for (size_t t = begin; t < end; ++t)
+		{
+			misses += cache.accessTriangle(&indices[3 * t]);
+			size_t triangles = t + 1 - soft.back();
+			if (t + 1 < end && misses <= target * triangles)
+			{
+				soft.push_back(t + 1);
+				misses = 0;
+				cache.flush();
+			}
+		}
+	}
+	return soft;
+}
+
+// Sorts the clusters by how much they face away from the center of the mesh
+std::vector<unsigned int> sortClusters(const std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices,
+	const std::vector<size_t> & clusters)
+{
+	size_t triangleCount = indices.size() / 3;
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> centers(clusters.size());
+	std::vector<glm::vec3> normals(clusters.size());
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[c]; t < end; ++t)
+		{
+			const glm::vec3 & a = vertices[indices[3 * t + 0]];
+			const glm::vec3 & b = vertices[indices[3 * t + 1]];
+			const glm::vec3 & d = vertices[indices[3 * t + 2]];
+			glm::vec3 n = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(n);
+			center += (a + b + d) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		meshCenter += center;
+		meshArea += area;
+		centers[c] = area > 0.0f ? center / area : vertices[indices[3 * clusters[c]]];
+		float normalLength = glm::length(normal);
+		normals[c] = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f);
+	}
+	if (meshArea > 0.0f)
+		meshCenter /= meshArea;
+
+	std::vector<float> sortKeys(clusters.size());
+	for (size_t c = 0; c < clusters.size(); ++c)
+		sortKeys[c] = glm::dot(centers[c] - meshCenter, normals[c]);
+	std::vector<size_t> order(clusters.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (size_t c : order)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		output.insert(output.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * end);
+	}
+	return output;
+}
+
+} // namespace
+
+void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices,
+	const std::vector<size_t> & clusters, float threshold, unsigned int cacheSize)
+{
+	if (indices.empty() || clusters.empty())
+		return;
+	float limit = threshold * analyzeVertexCache(indices, vertices.size(), cacheSize).acmr;
+
+	// Cold starts at the new boundaries can cost more than the estimate, so fall back to
+	// the hard clusters alone and then to the input order if the limit is exceeded
+	std::vector<unsigned int> sorted = sortClusters(indices, vertices, splitClusters(indices, vertices.size(), clusters, threshold, cacheSize));
+	if (analyzeVertexCache(sorted, vertices.size(), cacheSize).acmr > limit)
+		sorted = sortClusters(indices, vertices, clusters);
+	if (analyzeVertexCache(sorted, vertices.size(), cacheSize).acmr <= limit)
+		indices.swap(sorted);
+}
+
+void optimizeVertexFetch(std::vector<unsigned int> & indices, std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs, std::vector<glm::vec3> & normals)
+{
+	const unsigned int Unused = ~0u;
+	std::vector<unsigned int> remap(vertices.size(), Unused);
+	unsigned int next = 0;
+	for (unsigned int & index : indices)
+	{
+		if (remap[index] == Unused)
+			remap[index] = next++;
+		index = remap[index];
+	}
+
+	std::vector<glm::vec3> newVertices(next);
+	std::vector<glm::vec2> newUVs(next);
+	std::vector<glm::vec3> newNormals(next);
+	for (size_t v = 0; v < remap.size(); ++v)
+	{
+		if (remap[v] == Unused)
+			continue;
+		newVertices[remap[v]] = vertices[v];
+		newUVs[remap[v]] = uvs[v];
+		newNormals[remap[v]] = normals[v];
+	}
+	vertices.swap(newVertices);
+	uvs.swap(newUVs);
+	normals.swap(newNormals);
+}
+
+void optimizeMesh(std::vector<unsigned int> & indices, std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs, std::vector<glm::vec3> & normals)
+{
+	VertexCacheStats before = analyzeVertexCache(indices, vertices.size());
+
+	std::vector<size_t> clusters;
+	optimizeVertexCache(indices, vertices.size(), VertexCacheSize, &clusters);
+	optimizeOverdraw(indices, vertices, clusters);
+	optimizeVertexFetch(indices, vertices, uvs, normals);
+
+	VertexCacheStats after = analyzeVertexCache(indices, vertices.size());
+	printf("Vertex cache (%u entries): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+		VertexCacheSize, before.acmr, after.acmr, before.atvr, after.atvr);
+}
@@ -1,12 +1,19 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
-#define _USE_MATH_DEFINES
-#include <math.h>
 #include <vector>
+#include <map>
+#include <algorithm>
 
 // Include GLEW
 #include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+#include "glstate.hpp"
+#include "objects.hpp"
+#include "procedural.hpp"
+#include "vertexformat.hpp"
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -19,7 +26,7 @@ static void createWireCube()
 {
 	// Vertexarrays kapseln ab OpenGL3 Eckpunkte, Texturen und Normalen
 	glGenVertexArrays(1, &VertexArrayIDWireCube);
-	glBindVertexArray(VertexArrayIDWireCube);
+	glState().bindVertexArray(VertexArrayIDWireCube);
 
 	// Our vertices. Tree consecutive floats give a 3D vertex; Three consecutive vertices give a triangle.
 	// A cube has 6 faces with 2 triangles each, so this makes 6*2=12 triangles, and 12*3 vertices
@@ -55,7 +62,7 @@ static void createWireCube()
 			(void*)0            // array buffer offset
 	);
 
-	glBindVertexArray(0);
+	glState().bindVertexArray(0);
 }
 
 void drawWireCube()
@@ -65,7 +72,7 @@ void drawWireCube()
 		createWireCube();
 	}
 
-	glBindVertexArray(VertexArrayIDWireCube);
+	glState().bindVertexArray(VertexArrayIDWireCube);
 	glDrawArrays(GL_LINES, 0, 24); // 12 Linien haben 24 Punkte
 }
 
@@ -74,6 +81,7 @@ void drawWireCube()
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 GLuint VertexArrayIDSolidCube = 0;
+Bounds CubeBounds;
 
 static void createCube()
 {
@@ -81,7 +89,7 @@ static void createCube()
 	GLuint colorbuffer;
 	
 	glGenVertexArrays(1, &VertexArrayIDSolidCube);
-	glBindVertexArray(VertexArrayIDSolidCube);
+	glState().bindVertexArray(VertexArrayIDSolidCube);
 
 	// Our vertices. Tree consecutive floats give a 3D vertex; Three consecutive vertices give a triangle.
 	// A cube has 6 faces with 2 triangles each, so this makes 6*2=12 triangles, and 12*3 vertices
@@ -103,6 +111,7 @@ static void createCube()
 	glGenBuffers(1, &vertexbuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+	CubeBounds = computeBounds(reinterpret_cast<const glm::vec3 *>(g_vertex_buffer_data), 12*3);
 
 	// One color for each vertex. They were generated randomly.
 	static const GLfloat g_color_buffer_data[] = { 
@@ -147,7 +156,7 @@ static void createCube()
 			(void*)0                          // array buffer offset
 	);
 	
-	glBindVertexArray(0);
+	glState().bindVertexArray(0);
 }
 
 void drawCube()
@@ -158,7 +167,7 @@ void drawCube()
 	}
 
 	// Draw the triangles !
-	glBindVertexArray(VertexArrayIDSolidCube);
+	glState().bindVertexArray(VertexArrayIDSolidCube);
 	glDrawArrays(GL_TRIANGLES, 0, 12*3); // 12*3 indices starting at 0 -> 12 triangles
 }
 
@@ -167,104 +176,163 @@ void drawCube()
 ////    Kugel-Objekt
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-GLuint VertexArrayIDSphere = 0;
-GLuint lats;
-GLuint longs;
+// Jede Tessellierung wird nur einmal erzeugt und hochgeladen, dann bleibt sie im Cache
+std::map<ShapeParams, MeshBuffers> Shapes;
 
+DrawGeometry shapeGeometry(const ShapeParams & shape)
+{
+	std::map<ShapeParams, MeshBuffers>::iterator found = Shapes.find(shape);
+	if (found == Shapes.end())
+	{
+		ShapeMesh mesh{generateShape(shape)};
+		// Drawn with the float shaders like the cube, and too small for packing to matter
+		VertexQuantization quantization{};
+		quantization.allowPacked = false;
+		found = Shapes.emplace(shape, uploadMesh(mesh.indices.data(), mesh.indices.size(),
+			mesh.positions.data(), mesh.uvs.data(), mesh.normals.data(), mesh.positions.size(), quantization)).first;
+	}
+	return meshGeometry(found->second);
+}
 
-// Dieser Code  basiert auf http://ozark.hendrix.edu/~burch/cs/490/sched/feb8/
-static void createSphere()
+void deleteShapes()
 {
-	glGenVertexArrays(1, &VertexArrayIDSphere);
-	glBindVertexArray(VertexArrayIDSphere);
+	for (std::pair<const ShapeParams, MeshBuffers> & shape : Shapes)
+		deleteMesh(shape.second);
+	Shapes.clear();
+}
 
-	static GLuint sphereVertexBuffer = 0;
-	static GLfloat* sphereVertexBufferData = NULL;
-	static GLfloat* sphereNormalBufferData = NULL;
+void drawShape(const ShapeParams & shape)
+{
+	DrawGeometry geometry{shapeGeometry(shape)};
+	glState().bindVertexArray(geometry.vertexArray);
+	glDrawElements(geometry.mode, geometry.count, geometry.indexType, (void*)(geometry.first * sizeof(GLuint)));
+}
 
-	sphereVertexBufferData = new GLfloat [6 * (lats + 1) * (longs + 1)];
-	sphereNormalBufferData = new GLfloat [6 * (lats + 1) * (longs + 1)];
-	int index = 0;
+void drawSphere(GLuint slices, GLuint stacks)
+{
+	drawShape(sphereShape(slices, stacks));
+}
 
-    for (int i = 0; i <= lats; i++) 
-	{
-          GLfloat lat0 = (GLfloat) M_PI * ((GLfloat) -0.5 + (GLfloat) (i - 1) / (GLfloat) lats);
-          GLfloat z0  = sin(lat0);
-          GLfloat zr0 =  cos(lat0);
-    
-          GLfloat lat1 = (GLfloat) M_PI * ((GLfloat) -0.5 + (GLfloat) i / (GLfloat) lats);
-          GLfloat z1 = sin(lat1);
-          GLfloat zr1 = cos(lat1);
-    
-		  for (int j = 0; j <= longs; j++)
-		  {
-              GLfloat lng = (GLfloat) 2 * (GLfloat) M_PI * (GLfloat) (j - 1) / (GLfloat) longs;
-              GLfloat x = cos(lng);
-              GLfloat y = sin(lng);
-
-			  sphereNormalBufferData[index] = x * zr0;
-			  sphereVertexBufferData[index++] = x * zr0;
-			  sphereNormalBufferData[index] = y * zr0;
-			  sphereVertexBufferData[index++] = y * zr0;
-			  sphereNormalBufferData[index] = z0;
-			  sphereVertexBufferData[index++] = z0;
-			  sphereNormalBufferData[index] = x * zr1;
-			  sphereVertexBufferData[index++] = x * zr1;
-			  sphereNormalBufferData[index] = y * zr1;
-			  sphereVertexBufferData[index++] = y * zr1;
-			  sphereNormalBufferData[index] = z1;
-			  sphereVertexBufferData[index++] = z1;
-          }
-     }
 
-	GLuint vertexbuffer;
-	GLuint normalbuffer;
-	
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * (lats + 1) * (longs + 1), sphereVertexBufferData, GL_STATIC_DRAW);
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Instanzen
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * (lats + 1) * (longs + 1), sphereNormalBufferData, GL_STATIC_DRAW);
+// One buffer holds the model matrices of the current instanced draw, for all vertex arrays
+GLuint InstanceBuffer = 0;
+// Vertex arrays whose attributes 3 to 6 already read from InstanceBuffer
+std::vector<GLuint> InstancedVertexArrays;
+// The texture array layers of the instances, and the vertex arrays whose attribute 7 reads from it
+GLuint InstanceLayerBuffer = 0;
+std::vector<GLuint> LayeredVertexArrays;
 
-	glEnableVertexAttribArray(0); // Kein Disable ausfhren !
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glVertexAttribPointer(
-			0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-	);
+static void uploadInstances(GLuint vertexArray, const glm::mat4 * models, GLsizei count)
+{
+	glState().bindVertexArray(vertexArray);
+	if (!InstanceBuffer)
+	{
+		glGenBuffers(1, &InstanceBuffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, InstanceBuffer);
+	// Orphan the old storage, so the driver doesn't have to wait for draws still reading it
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), models);
 
-	// 2nd attribute buffer : normals
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glEnableVertexAttribArray(2); // Kein Disable ausfhren !
-	glVertexAttribPointer(
-			2,                                // attribute. No particular reason for 2, but must match the layout in the shader.
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-	);
+	if (std::find(InstancedVertexArrays.begin(), InstancedVertexArrays.end(), vertexArray) == InstancedVertexArrays.end())
+	{
+		// A mat4 attribute takes four locations, one per column
+		for (GLuint column = 0; column < 4; ++column)
+		{
+			glEnableVertexAttribArray(InstanceMatrixAttribute + column);
+			glVertexAttribPointer(
+					InstanceMatrixAttribute + column,        // attribute
+					4,                                        // size
+					GL_FLOAT,                                 // type
+					GL_FALSE,                                 // normalized?
+					sizeof(glm::mat4),                        // stride
+					(void*)(column * sizeof(glm::vec4))       // array buffer offset
+			);
+			glVertexAttribDivisor(InstanceMatrixAttribute + column, 1); // advance once per instance
+		}
+		InstancedVertexArrays.push_back(vertexArray);
+	}
+}
+
+// Attribute 7 reads the layers while they are given, otherwise it stays at its current value
+static void uploadLayers(GLuint vertexArray, const GLint * layers, GLsizei count)
+{
+	bool layered = std::find(LayeredVertexArrays.begin(), LayeredVertexArrays.end(), vertexArray) != LayeredVertexArrays.end();
+	if (!layers)
+	{
+		if (layered)
+			glDisableVertexAttribArray(InstanceLayerAttribute);
+		LayeredVertexArrays.erase(std::remove(LayeredVertexArrays.begin(), LayeredVertexArrays.end(), vertexArray), LayeredVertexArrays.end());
+		return;
+	}
+	if (!InstanceLayerBuffer)
+	{
+		glGenBuffers(1, &InstanceLayerBuffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, InstanceLayerBuffer);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(GLint), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GLint), layers);
+	if (!layered)
+	{
+		glEnableVertexAttribArray(InstanceLayerAttribute);
+		glVertexAttribIPointer(InstanceLayerAttribute, 1, GL_INT, sizeof(GLint), (void*)0);
+		glVertexAttribDivisor(InstanceLayerAttribute, 1);
+		LayeredVertexArrays.push_back(vertexArray);
+	}
+}
 
-	glBindVertexArray(0);
+void forgetInstancedVertexArray(GLuint vertexArray)
+{
+	InstancedVertexArrays.erase(std::remove(InstancedVertexArrays.begin(), InstancedVertexArrays.end(), vertexArray), InstancedVertexArrays.end());
+	LayeredVertexArrays.erase(std::remove(LayeredVertexArrays.begin(), LayeredVertexArrays.end(), vertexArray), LayeredVertexArrays.end());
 }
 
-// Nur die Angabe bei der ersten Kugel ist relevant
-void drawSphere(GLuint slats, GLuint slongs)
+void drawInstanced(const DrawGeometry & geometry, const glm::mat4 * models, GLsizei count, const GLint * layers)
 {
-	if (!VertexArrayIDSphere)
+	uploadInstances(geometry.vertexArray, models, count);
+	uploadLayers(geometry.vertexArray, layers, count);
+	if (geometry.indexType)
+		glDrawElementsInstanced(geometry.mode, geometry.count, geometry.indexType, (void*)(geometry.first * sizeof(GLuint)), count);
+	else
+		glDrawArraysInstanced(geometry.mode, geometry.first, geometry.count, count);
+}
+
+DrawGeometry cubeGeometry()
+{
+	if (!VertexArrayIDSolidCube)
 	{
-		lats = slats;
-		longs = slongs;
-		createSphere();
+		createCube();
 	}
 
-	glBindVertexArray(VertexArrayIDSphere);
-	// Draw the triangles !
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 2 * (lats + 1) * (longs + 1)); 
-}
\ No newline at end of file
+	return DrawGeometry{VertexArrayIDSolidCube, GL_TRIANGLES, 0, 12*3, 0, CubeBounds};
+}
+
+DrawGeometry sphereGeometry(GLuint slices, GLuint stacks)
+{
+	return shapeGeometry(sphereShape(slices, stacks));
+}
+
+DrawGeometry meshGeometry(const MeshBuffers & mesh, size_t level)
+{
+	const MeshLOD & lod = mesh.lods[std::min(level, mesh.lods.size() - 1)];
+	return DrawGeometry{mesh.vertexArray, GL_TRIANGLES, GLint(lod.firstIndex), GLsizei(lod.indexCount), GL_UNSIGNED_INT, mesh.bounds};
+}
+
+void drawCubeInstanced(const glm::mat4 * models, GLsizei count)
+{
+	drawInstanced(cubeGeometry(), models, count);
+}
+
+void drawSphereInstanced(GLuint slats, GLuint slongs, const glm::mat4 * models, GLsizei count)
+{
+	drawInstanced(sphereGeometry(slats, slongs), models, count);
+}
+
+void drawMeshInstanced(const MeshBuffers & mesh, const glm::mat4 * models, GLsizei count)
+{
+	drawInstanced(meshGeometry(mesh), models, count);
+}
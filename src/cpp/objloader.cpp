@@ -2,10 +2,20 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <thread>
+#include <utility>
 
 #include <glm/glm.hpp>
 
 #include "objloader.hpp"
+#include "mappedfile.hpp"
+#include "meshcache.hpp"
+#include "meshoptimizer.hpp"
+#include "simplify.hpp"
 
 // Very, VERY simple OBJ loader.
 // Here is a short list of features a real function would provide : 
@@ -17,113 +27,568 @@
 // - More secure. Change another line and you can inject code.
 // - Loading from memory, stream, etc
 
-bool loadOBJ(
-	const char * path, 
-	std::vector<glm::vec3> & out_vertices, 
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
-){
-	printf("Loading OBJ file %s...\n", path);
+namespace {
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices; 
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
+// Every face corner references one position, one uv and one normal. 0 means "not given".
+struct Corner
+{
+	int v, vt, vn;
+};
 
+// What the counting pass found in a chunk
+struct ChunkCounts
+{
+	size_t vertices{0}, uvs{0}, normals{0}, corners{0};
+};
 
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
-		return false;
+struct Chunk
+{
+	const char * begin;
+	const char * end;
+	ChunkCounts count{};
+	ChunkCounts base{}; // where the results of this chunk go in the merged arrays
+	bool ok{true};
+};
+
+// Chunks smaller than this aren't worth a thread of their own
+const size_t MinChunkSize = 256 * 1024;
+
+inline bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char * skipBlanks(const char * p, const char * end)
+{
+	while (p < end && isBlank(*p))
+		++p;
+	return p;
+}
+
+inline const char * nextLine(const char * p, const char * end)
+{
+	const char * nl = static_cast<const char *>(memchr(p, '\n', end - p));
+	return nl ? nl + 1 : end;
+}
+
+enum class Keyword { Other, Vertex, UV, Normal, Face };
+
+// Reads the first word of the line and moves p behind it
+inline Keyword readKeyword(const char *& p, const char * end)
+{
+	p = skipBlanks(p, end);
+	const char * word = p;
+	while (p < end && !isBlank(*p) && *p != '\n')
+		++p;
+	size_t length = p - word;
+	if (length == 1 && word[0] == 'v')
+		return Keyword::Vertex;
+	if (length == 1 && word[0] == 'f')
+		return Keyword::Face;
+	if (length == 2 && word[0] == 'v' && word[1] == 't')
+		return Keyword::UV;
+	if (length == 2 && word[0] == 'v' && word[1] == 'n')
+		return Keyword::Normal;
+	return Keyword::Other;
+}
+
+// Number of whitespace separated tokens up to the end of the line
+inline size_t countTokens(const char * p, const char * end)
+{
+	size_t tokens = 0;
+	while (true)
+	{
+		p = skipBlanks(p, end);
+		if (p >= end || *p == '\n' || *p == '#')
+			return tokens;
+		++tokens;
+		while (p < end && !isBlank(*p) && *p != '\n')
+			++p;
 	}
+}
+
+inline bool parseFloat(const char *& p, const char * end, float & value)
+{
+	p = skipBlanks(p, end);
+	if (p < end && *p == '+') // from_chars doesn't accept an explicit plus sign
+		++p;
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		return false;
+	p = result.ptr;
+	return true;
+}
 
-	while( 1 ){
+inline bool parseIndex(const char *& p, const char * end, int & value)
+{
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		return false;
+	p = result.ptr;
+	return true;
+}
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+// OBJ indices are 1-based, negative ones count back from the last element read so far
+inline int resolveIndex(int index, size_t readSoFar)
+{
+	return index < 0 ? static_cast<int>(readSoFar) + index + 1 : index;
+}
 
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y );
+// Parses one "v", "v/vt", "v//vn" or "v/vt/vn" face corner
+inline bool parseCorner(const char *& p, const char * end, const ChunkCounts & read, Corner & corner)
+{
+	corner = Corner{0, 0, 0};
+	if (!parseIndex(p, end, corner.v))
+		return false;
+	if (p < end && *p == '/')
+	{
+		++p;
+		if (p < end && *p != '/' && !parseIndex(p, end, corner.vt))
+			return false;
+		if (p < end && *p == '/')
+		{
+			++p;
+			if (!parseIndex(p, end, corner.vn))
+				return false;
+		}
+	}
+	corner.v = resolveIndex(corner.v, read.vertices);
+	corner.vt = resolveIndex(corner.vt, read.uvs);
+	corner.vn = resolveIndex(corner.vn, read.normals);
+	return true;
+}
+
+void countChunk(Chunk & chunk)
+{
+	for (const char * line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end))
+	{
+		const char * p = line;
+		switch (readKeyword(p, chunk.end))
+		{
+		case Keyword::Vertex: ++chunk.count.vertices; break;
+		case Keyword::UV:     ++chunk.count.uvs; break;
+		case Keyword::Normal: ++chunk.count.normals; break;
+		case Keyword::Face:
+		{
+			// Polygons get fan-triangulated, so n corners make n-2 triangles
+			size_t corners = countTokens(p, chunk.end);
+			if (corners >= 3)
+				chunk.count.corners += 3 * (corners - 2);
+			break;
+		}
+		default: break;
+		}
+	}
+}
+
+void parseChunk(
+	Chunk & chunk,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	std::vector<Corner> & corners
+){
+	// Counted over the whole file, so negative indices resolve across chunk borders
+	ChunkCounts read{chunk.base};
+	for (const char * line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end))
+	{
+		const char * p = line;
+		switch (readKeyword(p, chunk.end))
+		{
+		case Keyword::Vertex:
+		{
+			glm::vec3 & vertex = vertices[read.vertices++];
+			chunk.ok &= parseFloat(p, chunk.end, vertex.x) && parseFloat(p, chunk.end, vertex.y) && parseFloat(p, chunk.end, vertex.z);
+			break;
+		}
+		case Keyword::UV:
+		{
+			glm::vec2 & uv = uvs[read.uvs++];
+			chunk.ok &= parseFloat(p, chunk.end, uv.x) && parseFloat(p, chunk.end, uv.y);
 			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				// Der folgende Code wurde eingefgt, um die Teddy-obj-Dateien lesen zu knnen, TJ !!!!!!!!!!!!!
-				if (matches == 1)
+			break;
+		}
+		case Keyword::Normal:
+		{
+			glm::vec3 & normal = normals[read.normals++];
+			chunk.ok &= parseFloat(p, chunk.end, normal.x) && parseFloat(p, chunk.end, normal.y) && parseFloat(p, chunk.end, normal.z);
+			break;
+		}
+		case Keyword::Face:
+		{
+			size_t count = countTokens(p, chunk.end);
+			if (count < 3)
+				break;
+			Corner first{}, previous{}, current{};
+			for (size_t i = 0; i < count; ++i)
+			{
+				p = skipBlanks(p, chunk.end);
+				if (!parseCorner(p, chunk.end, read, current))
+				{
+					// Keep filling the pre-sized output, the result is thrown away anyway
+					chunk.ok = false;
+					current = Corner{0, 0, 0};
+					while (p < chunk.end && !isBlank(*p) && *p != '\n')
+						++p;
+				}
+				if (i == 0)
+					first = current;
+				else if (i >= 2)
 				{
-					matches = fscanf(file, "%d %d\n", &vertexIndex[1], &vertexIndex[2] );
-
-					if (matches != 2)
-					{
-						printf("File can't be read by our simple parser (%d matches) :-( Try exporting with other options\n", matches);
-						return false;
-					}
-					else
-					{
-						uvIndex[0] = uvIndex[1] = uvIndex[2] = normalIndex[0] = normalIndex[1] = normalIndex[2] = 0;
- 					}
+					corners[read.corners++] = first;
+					corners[read.corners++] = previous;
+					corners[read.corners++] = current;
 				}
+				previous = current;
 			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+			break;
+		}
+		default: break;
 		}
+	}
+}
+
+// Runs job(i) for every i in [0, count), the last one on the calling thread
+template <typename Job>
+void runParallel(size_t count, const Job & job)
+{
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i + 1 < count; ++i)
+		threads.emplace_back(job, i);
+	if (count > 0)
+		job(count - 1);
+	for (std::thread & thread : threads)
+		thread.join();
+}
+
+// Everything an OBJ file contains, before the face corners are turned into vertices
+struct ParsedOBJ
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<Corner> corners;
+	size_t threads{1};
+};
+
+bool parseOBJ(const char * path, ParsedOBJ & obj)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	MappedFile file(path);
+	if( !file.isOpen() ){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		return false;
+	}
+	const char * data = file.data();
+	const char * end = data + file.size();
 
+	// Split the file into line-aligned chunks, one per thread
+	size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	size_t chunkCount = std::clamp<size_t>(file.size() / MinChunkSize, 1, threadCount);
+	std::vector<Chunk> chunks;
+	const char * chunkBegin = data;
+	for (size_t i = 1; i <= chunkCount && chunkBegin < end; ++i)
+	{
+		const char * chunkEnd = end;
+		if (i < chunkCount)
+			chunkEnd = nextLine(std::max(chunkBegin, data + file.size() * i / chunkCount), end);
+		chunks.push_back(Chunk{chunkBegin, chunkEnd});
+		chunkBegin = chunkEnd;
 	}
+	obj.threads = std::max<size_t>(chunks.size(), 1);
 
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+	// Counting pass, so every array is sized once and every chunk knows where its results go
+	runParallel(chunks.size(), [&chunks](size_t i) { countChunk(chunks[i]); });
+	ChunkCounts total;
+	for (Chunk & chunk : chunks)
+	{
+		chunk.base = total;
+		total.vertices += chunk.count.vertices;
+		total.uvs      += chunk.count.uvs;
+		total.normals  += chunk.count.normals;
+		total.corners  += chunk.count.corners;
+	}
 
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
+	obj.vertices.resize(total.vertices);
+	obj.uvs.resize(total.uvs);
+	obj.normals.resize(total.normals);
+	obj.corners.resize(total.corners);
+	runParallel(chunks.size(), [&](size_t i) { parseChunk(chunks[i], obj.vertices, obj.uvs, obj.normals, obj.corners); });
 
-	    // Fr Teddy-Obj-import ohne Normalen und UVs, TJ !!!!!!!!!!!!!!!!!!!!!
-		// glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-		glm::vec2 uv = uvIndex ? temp_uvs[ uvIndex-1 ] : glm::vec2(0.0, 0.0);
-		
-		// glm::vec3 normal = temp_normals[ normalIndex-1 ];
-		glm::vec3 normal = normalIndex ? temp_normals[ normalIndex-1 ] : glm::vec3(0.0, 0.0, 0.0);
+	for (const Chunk & chunk : chunks)
+	{
+		if (!chunk.ok)
+		{
+			printf("File can't be read by our simple parser :-( Try exporting with other options\n");
+			return false;
+		}
+	}
+	for (const Corner & corner : obj.corners)
+	{
+		if (corner.v < 1 || static_cast<size_t>(corner.v) > total.vertices
+			|| corner.vt < 0 || static_cast<size_t>(corner.vt) > total.uvs
+			|| corner.vn < 0 || static_cast<size_t>(corner.vn) > total.normals)
+		{
+			printf("File references a vertex that doesn't exist :-( Try exporting with other options\n");
+			return false;
+		}
+	}
 
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double megabytes = file.size() / (1024.0 * 1024.0);
+	printf("Parsed %zu triangles, %.2f MB in %.2f ms (%.1f MB/s, %zu threads)\n",
+		obj.corners.size() / 3, megabytes, seconds * 1000.0, seconds > 0.0 ? megabytes / seconds : 0.0, obj.threads);
+	return true;
+}
+
+// Attributes of one face corner. Missing uvs become zero, missing normals are
+// taken from the faces around the position (computeNormals).
+// Fr Teddy-Obj-import ohne Normalen und UVs, TJ !!!!!!!!!!!!!!!!!!!!!
+inline glm::vec2 cornerUV(const ParsedOBJ & obj, const Corner & corner)
+{
+	return corner.vt ? obj.uvs[corner.vt - 1] : glm::vec2(0.0, 0.0);
+}
+
+inline glm::vec3 cornerNormal(const ParsedOBJ & obj, const std::vector<glm::vec3> & computed, const Corner & corner)
+{
+	return corner.vn ? obj.normals[corner.vn - 1] : computed[corner.v - 1];
+}
+
+// One normal per position for the corners without vn: the sum of the cross products of the triangles
+// around it, which weights each face by its area. Empty if every corner has a normal.
+std::vector<glm::vec3> computeNormals(const ParsedOBJ & obj)
+{
+	std::vector<glm::vec3> normals;
+	if (std::all_of(obj.corners.begin(), obj.corners.end(), [](const Corner & corner) { return corner.vn != 0; }))
+		return normals;
+	normals.assign(obj.vertices.size(), glm::vec3(0.0f));
+	for (size_t i = 0; i + 2 < obj.corners.size(); i += 3)
+	{
+		const glm::vec3 & a = obj.vertices[obj.corners[i].v - 1];
+		const glm::vec3 & b = obj.vertices[obj.corners[i + 1].v - 1];
+		const glm::vec3 & c = obj.vertices[obj.corners[i + 2].v - 1];
+		glm::vec3 face = glm::cross(b - a, c - a);
+		for (size_t k = 0; k < 3; ++k)
+			normals[obj.corners[i + k].v - 1] += face;
 	}
+	// Positions only on degenerate triangles get some unit normal rather than a zero one
+	for (glm::vec3 & normal : normals)
+	{
+		float length = glm::length(normal);
+		normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+	return normals;
+}
 
+inline size_t hashCorner(const Corner & corner)
+{
+	// The three indices are mixed with large odd constants, then folded
+	uint64_t h = static_cast<uint32_t>(corner.v) * 0x9E3779B97F4A7C15ull;
+	h ^= static_cast<uint32_t>(corner.vt) * 0xC2B2AE3D27D4EB4Full;
+	h ^= static_cast<uint32_t>(corner.vn) * 0x165667B19E3779F9ull;
+	return static_cast<size_t>(h ^ (h >> 29));
+}
+
+// Turns every distinct (v, vt, vn) combination into one vertex
+void indexOBJ(
+	const ParsedOBJ & obj,
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals
+){
+	// Open addressing table from (v, vt, vn) to the vertex created for it. At most half full.
+	const unsigned int Empty = ~0u;
+	size_t capacity = 16;
+	while (capacity < 2 * obj.corners.size())
+		capacity *= 2;
+	std::vector<unsigned int> table(capacity, Empty);
+	std::vector<Corner> unique;
+	unique.reserve(obj.corners.size() / 2);
+
+	indices.resize(obj.corners.size());
+	for (size_t i = 0; i < obj.corners.size(); ++i)
+	{
+		const Corner & corner = obj.corners[i];
+		size_t slot = hashCorner(corner) & (capacity - 1);
+		while (table[slot] != Empty)
+		{
+			const Corner & other = unique[table[slot]];
+			if (other.v == corner.v && other.vt == corner.vt && other.vn == corner.vn)
+				break;
+			slot = (slot + 1) & (capacity - 1);
+		}
+		if (table[slot] == Empty)
+		{
+			table[slot] = static_cast<unsigned int>(unique.size());
+			unique.push_back(corner);
+		}
+		indices[i] = table[slot];
+	}
+
+	std::vector<glm::vec3> computed = computeNormals(obj);
+	vertices.resize(unique.size());
+	uvs     .resize(unique.size());
+	normals .resize(unique.size());
+	for (size_t i = 0; i < unique.size(); ++i)
+	{
+		vertices[i] = obj.vertices[unique[i].v - 1];
+		uvs     [i] = cornerUV(obj, unique[i]);
+		normals [i] = cornerNormal(obj, computed, unique[i]);
+	}
+}
+
+// An indexed mesh, either pointing into a mapped cache file or into freshly parsed arrays
+struct IndexedMesh
+{
+	MeshCache cache;
+	std::vector<unsigned int> indexStorage;
+	std::vector<glm::vec3> vertexStorage;
+	std::vector<glm::vec2> uvStorage;
+	std::vector<glm::vec3> normalStorage;
+	std::vector<MeshLOD> lods; // only when parsed
+
+	const unsigned int * indices{nullptr};
+	const glm::vec3 * vertices{nullptr};
+	const glm::vec2 * uvs{nullptr};
+	const glm::vec3 * normals{nullptr};
+	size_t indexCount{0};
+	size_t vertexCount{0};
+};
+
+// Common path of all loaders: map the binary cache if it is up to date, otherwise parse the OBJ file and write the cache
+bool loadIndexedMesh(const char * path, IndexedMesh & mesh)
+{
+	printf("Loading OBJ file %s...\n", path);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool cached = mesh.cache.open(path);
+	if (cached)
+	{
+		mesh.indices = mesh.cache.indices();
+		mesh.vertices = mesh.cache.vertices();
+		mesh.uvs = mesh.cache.uvs();
+		mesh.normals = mesh.cache.normals();
+		mesh.indexCount = mesh.cache.indexCount();
+		mesh.vertexCount = mesh.cache.vertexCount();
+	}
+	else
+	{
+		ParsedOBJ obj;
+		if (!parseOBJ(path, obj))
+			return false;
+		indexOBJ(obj, mesh.indexStorage, mesh.vertexStorage, mesh.uvStorage, mesh.normalStorage);
+		// Done once here, the cache keeps the optimized order and the levels of detail
+		optimizeMesh(mesh.indexStorage, mesh.vertexStorage, mesh.uvStorage, mesh.normalStorage);
+		std::vector<MeshLOD> & lods = mesh.lods;
+		buildLODChain(mesh.indexStorage, mesh.vertexStorage, mesh.uvStorage, mesh.normalStorage, lods);
+		if (!writeMeshCache(path, mesh.indexStorage, mesh.vertexStorage, mesh.uvStorage, mesh.normalStorage, lods))
+			printf("Could not write mesh cache %s\n", meshCachePath(path).c_str());
+		mesh.indices = mesh.indexStorage.data();
+		mesh.vertices = mesh.vertexStorage.data();
+		mesh.uvs = mesh.uvStorage.data();
+		mesh.normals = mesh.normalStorage.data();
+		// The coarser levels follow, but the loaders only hand out the full mesh
+		mesh.indexCount = lods[0].indexCount;
+		mesh.vertexCount = mesh.vertexStorage.size();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%s load: %zu vertices, %zu indices in %.2f ms\n", cached ? "Warm (mesh cache)" : "Cold (OBJ parse)",
+		mesh.vertexCount, mesh.indexCount, seconds * 1000.0);
+	return true;
+}
+
+} // namespace
+
+bool loadOBJ(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	IndexedMesh mesh;
+	if (!loadIndexedMesh(path, mesh))
+		return false;
+
+	// For each vertex of each triangle, put the attributes in buffers
+	size_t offset = out_vertices.size();
+	out_vertices.resize(offset + mesh.indexCount);
+	out_uvs     .resize(offset + mesh.indexCount);
+	out_normals .resize(offset + mesh.indexCount);
+	size_t threads = std::clamp<size_t>(mesh.indexCount / (MinChunkSize / 4), 1, std::max(1u, std::thread::hardware_concurrency()));
+	runParallel(threads, [&](size_t chunk) {
+		size_t first = mesh.indexCount * chunk / threads;
+		size_t last = mesh.indexCount * (chunk + 1) / threads;
+		for (size_t i = first; i < last; ++i)
+		{
+			unsigned int index = mesh.indices[i];
+			out_vertices[offset + i] = mesh.vertices[index];
+			out_uvs     [offset + i] = mesh.uvs[index];
+			out_normals [offset + i] = mesh.normals[index];
+		}
+	});
+
+	return true;
+}
+
+bool loadOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	IndexedMesh mesh;
+	if (!loadIndexedMesh(path, mesh))
+		return false;
+
+	unsigned int offset = static_cast<unsigned int>(out_vertices.size());
+	out_vertices.insert(out_vertices.end(), mesh.vertices, mesh.vertices + mesh.vertexCount);
+	out_uvs     .insert(out_uvs.end(), mesh.uvs, mesh.uvs + mesh.vertexCount);
+	out_normals .insert(out_normals.end(), mesh.normals, mesh.normals + mesh.vertexCount);
+	out_indices.reserve(out_indices.size() + mesh.indexCount);
+	for (size_t i = 0; i < mesh.indexCount; ++i)
+		out_indices.push_back(offset + mesh.indices[i]);
+
+	return true;
+}
+
+bool parseOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	ParsedOBJ obj;
+	if (!parseOBJ(path, obj))
+		return false;
+	indexOBJ(obj, out_indices, out_vertices, out_uvs, out_normals);
+	return true;
+}
+
+bool loadOBJCached(const char * path, MeshCache & mesh)
+{
+	if (mesh.open(path))
+	{
+		printf("Mapped mesh cache of %s: %zu vertices, %zu indices\n", path, mesh.vertexCount(), mesh.indexCount());
+		return true;
+	}
+	// Parses and writes the cache, which is then mapped like on any later run
+	IndexedMesh parsed;
+	if (!loadIndexedMesh(path, parsed))
+		return false;
+	if (mesh.open(path))
+		return true;
+	// No cache to map, e.g. in a read-only directory: the parsed mesh serves this run
+	if (parsed.lods.empty())
+	{
+		printf("Mesh cache of %s is not available\n", path);
+		return false;
+	}
+	printf("Mesh cache of %s is not available, keeping the parsed mesh in memory\n", path);
+	mesh.assign(std::move(parsed.indexStorage), std::move(parsed.vertexStorage), std::move(parsed.uvStorage),
+		std::move(parsed.normalStorage), std::move(parsed.lods));
 	return true;
 }
 
@@ -137,7 +602,7 @@ bool loadOBJ(
 
 bool loadAssImp(
 	const char * path, 
-	std::vector<unsigned short> & indices,
+	std::vector<unsigned int> & indices,
 	std::vector<glm::vec3> & vertices,
 	std::vector<glm::vec2> & uvs,
 	std::vector<glm::vec3> & normals
@@ -148,7 +613,6 @@ bool loadAssImp(
 	const aiScene* scene = importer.ReadFile(path, 0/*aiProcess_JoinIdenticalVertices | aiProcess_SortByPType*/);
 	if( !scene) {
 		fprintf( stderr, importer.GetErrorString());
-		getchar();
 		return false;
 	}
 	const aiMesh* mesh = scene->mMeshes[0]; // In this simple example code we always use the 1rst mesh (in OBJ files there is often only one anyway)
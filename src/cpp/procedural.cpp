@@ -0,0 +1,327 @@
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+#include "procedural.hpp"
+
+// Cube and icosahedron don't have parameters, their vertices are built by the compiler
+
+struct CubeData
+{
+	float positions[24][3];
+	float uvs[24][2];
+	float normals[24][3];
+	unsigned int indices[36];
+};
+
+// Four vertices per face, so every face gets its own normal and the whole texture
+static constexpr CubeData makeCube()
+{
+	CubeData cube{};
+	for (int face = 0; face < 6; ++face)
+	{
+		int axis = face / 2;
+		float sign = face % 2 ? -1.0f : 1.0f;
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			float cu = corner == 1 || corner == 2 ? 1.0f : -1.0f;
+			float cv = corner >= 2 ? 1.0f : -1.0f;
+			int vertex = face * 4 + corner;
+			cube.positions[vertex][axis] = sign;
+			cube.positions[vertex][u] = cu * sign; // mirrored on the negative faces, keeps them counter clockwise from outside
+			cube.positions[vertex][v] = cv;
+			cube.normals[vertex][axis] = sign;
+			cube.uvs[vertex][0] = (cu + 1.0f) / 2.0f;
+			cube.uvs[vertex][1] = (cv + 1.0f) / 2.0f;
+		}
+		const unsigned int quad[6]{0, 1, 2, 0, 2, 3};
+		for (int i = 0; i < 6; ++i)
+			cube.indices[face * 6 + i] = face * 4 + quad[i];
+	}
+	return cube;
+}
+
+static constexpr CubeData Cube{makeCube()};
+static_assert(Cube.positions[23][2] == -1.0f && Cube.indices[35] == 23, "cube layout");
+
+// (0, +-1, +-phi) and its cyclic permutations, divided by their length sqrt(1 + phi^2)
+static constexpr float IcoA = 0.525731112119133606f;
+static constexpr float IcoB = 0.850650808352039932f;
+static constexpr float Icosahedron[12][3]{
+	{-IcoA, IcoB, 0.0f}, {IcoA, IcoB, 0.0f}, {-IcoA, -IcoB, 0.0f}, {IcoA, -IcoB, 0.0f},
+	{0.0f, -IcoA, IcoB}, {0.0f, IcoA, IcoB}, {0.0f, -IcoA, -IcoB}, {0.0f, IcoA, -IcoB},
+	{IcoB, 0.0f, -IcoA}, {IcoB, 0.0f, IcoA}, {-IcoB, 0.0f, -IcoA}, {-IcoB, 0.0f, IcoA}
+};
+static constexpr unsigned int IcosahedronFaces[20][3]{
+	{0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+	{1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+	{3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+	{4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
+};
+
+// Enough triangles for any screen, 20 * 4^7 = 327680
+static const unsigned int MaxIcosphereSubdivisions = 7;
+static const unsigned int MaxSlices = 1024;
+
+ShapeParams cubeShape()
+{
+	return ShapeParams{ShapeType::Cube, 0, 0, 0.0f};
+}
+
+ShapeParams sphereShape(unsigned int slices, unsigned int stacks)
+{
+	return ShapeParams{ShapeType::Sphere, std::clamp(slices, 3u, MaxSlices), std::clamp(stacks, 2u, MaxSlices), 0.0f};
+}
+
+ShapeParams icosphereShape(unsigned int subdivisions)
+{
+	return ShapeParams{ShapeType::Icosphere, 0, std::min(subdivisions, MaxIcosphereSubdivisions), 0.0f};
+}
+
+ShapeParams cylinderShape(unsigned int slices, unsigned int stacks)
+{
+	return ShapeParams{ShapeType::Cylinder, std::clamp(slices, 3u, MaxSlices), std::clamp(stacks, 1u, MaxSlices), 0.0f};
+}
+
+ShapeParams coneShape(unsigned int slices, unsigned int stacks)
+{
+	return ShapeParams{ShapeType::Cone, std::clamp(slices, 3u, MaxSlices), std::clamp(stacks, 1u, MaxSlices), 0.0f};
+}
+
+ShapeParams torusShape(unsigned int slices, unsigned int tubeSlices, float tubeRadius)
+{
+	return ShapeParams{ShapeType::Torus, std::clamp(slices, 3u, MaxSlices), std::clamp(tubeSlices, 3u, MaxSlices),
+		std::clamp(tubeRadius, 0.01f, 1.0f)};
+}
+
+// cos and sin of first + i * (last - first) / segments for i = 0 .. segments, computed once per mesh
+// instead of once per vertex. A full circle ends exactly where it started, so the seam has no crack.
+struct TrigTable
+{
+	std::vector<float> cos, sin;
+};
+
+static TrigTable trigTable(unsigned int segments, double first, double last)
+{
+	TrigTable table;
+	table.cos.resize(segments + 1);
+	table.sin.resize(segments + 1);
+	for (unsigned int i = 0; i <= segments; ++i)
+	{
+		double angle = first + (last - first) * i / segments;
+		table.cos[i] = float(std::cos(angle));
+		table.sin[i] = float(std::sin(angle));
+	}
+	if (last - first == 2.0 * M_PI)
+	{
+		table.cos[segments] = table.cos[0];
+		table.sin[segments] = table.sin[0];
+	}
+	return table;
+}
+
+// One point of the outline that gets rotated around z, with its normal in the same plane
+struct ProfilePoint
+{
+	float radius, z;
+	float normalRadius, normalZ;
+	float v;
+};
+
+// Rotates the profile around z. Profile points go upwards along the surface (seen from outside).
+// Rings of radius 0 (poles, apex) still get a vertex per slice for their uvs and normals,
+// but the triangles that would collapse there are left out.
+static void lathe(ShapeMesh & mesh, const std::vector<ProfilePoint> & profile, const TrigTable & slices)
+{
+	unsigned int sliceCount = unsigned(slices.cos.size()) - 1;
+	unsigned int base = unsigned(mesh.positions.size());
+	for (const ProfilePoint & point : profile)
+	{
+		for (unsigned int i = 0; i <= sliceCount; ++i)
+		{
+			mesh.positions.push_back(glm::vec3(point.radius * slices.cos[i], point.radius * slices.sin[i], point.z));
+			mesh.normals.push_back(glm::vec3(point.normalRadius * slices.cos[i], point.normalRadius * slices.sin[i], point.normalZ));
+			mesh.uvs.push_back(glm::vec2(float(i) / sliceCount, point.v));
+		}
+	}
+	unsigned int ring = sliceCount + 1;
+	for (unsigned int s = 0; s + 1 < profile.size(); ++s)
+	{
+		for (unsigned int i = 0; i < sliceCount; ++i)
+		{
+			unsigned int a = base + s * ring + i;
+			unsigned int b = a + 1;
+			unsigned int c = b + ring;
+			unsigned int d = a + ring;
+			if (profile[s].radius != 0.0f)
+				mesh.indices.insert(mesh.indices.end(), {a, b, c});
+			if (profile[s + 1].radius != 0.0f)
+				mesh.indices.insert(mesh.indices.end(), {a, c, d});
+		}
+	}
+}
+
+// Flat disk at z facing up or down, a center vertex and one ring
+static void cap(ShapeMesh & mesh, float z, bool up, const TrigTable & slices)
+{
+	unsigned int sliceCount = unsigned(slices.cos.size()) - 1;
+	unsigned int center = unsigned(mesh.positions.size());
+	glm::vec3 normal(0.0f, 0.0f, up ? 1.0f : -1.0f);
+	mesh.positions.push_back(glm::vec3(0.0f, 0.0f, z));
+	mesh.normals.push_back(normal);
+	mesh.uvs.push_back(glm::vec2(0.5f, 0.5f));
+	for (unsigned int i = 0; i < sliceCount; ++i)
+	{
+		mesh.positions.push_back(glm::vec3(slices.cos[i], slices.sin[i], z));
+		mesh.normals.push_back(normal);
+		mesh.uvs.push_back(glm::vec2(0.5f + 0.5f * slices.cos[i], 0.5f + 0.5f * slices.sin[i]));
+	}
+	for (unsigned int i = 0; i < sliceCount; ++i)
+	{
+		unsigned int current = center + 1 + i;
+		unsigned int next = center + 1 + (i + 1) % sliceCount;
+		if (up)
+			mesh.indices.insert(mesh.indices.end(), {center, current, next});
+		else
+			mesh.indices.insert(mesh.indices.end(), {center, next, current});
+	}
+}
+
+static void generateCube(ShapeMesh & mesh)
+{
+	for (int i = 0; i < 24; ++i)
+	{
+		mesh.positions.push_back(glm::vec3(Cube.positions[i][0], Cube.positions[i][1], Cube.positions[i][2]));
+		mesh.uvs.push_back(glm::vec2(Cube.uvs[i][0], Cube.uvs[i][1]));
+		mesh.normals.push_back(glm::vec3(Cube.normals[i][0], Cube.normals[i][1], Cube.normals[i][2]));
+	}
+	mesh.indices.assign(std::begin(Cube.indices), std::end(Cube.indices));
+}
+
+static void generateSphere(ShapeMesh & mesh, unsigned int slices, unsigned int stacks)
+{
+	TrigTable latitudes{trigTable(stacks, -M_PI / 2.0, M_PI / 2.0)};
+	std::vector<ProfilePoint> profile(stacks + 1);
+	for (unsigned int s = 0; s <= stacks; ++s)
+	{
+		// The poles exactly on the axis, cos(pi / 2) isn't 0 in floating point
+		float radius = s == 0 || s == stacks ? 0.0f : latitudes.cos[s];
+		profile[s] = ProfilePoint{radius, latitudes.sin[s], radius, latitudes.sin[s], float(s) / stacks};
+	}
+	lathe(mesh, profile, trigTable(slices, 0.0, 2.0 * M_PI));
+}
+
+static void generateIcosphere(ShapeMesh & mesh, unsigned int subdivisions)
+{
+	for (const float (&vertex)[3] : Icosahedron)
+		mesh.positions.push_back(glm::vec3(vertex[0], vertex[1], vertex[2]));
+	for (const unsigned int (&face)[3] : IcosahedronFaces)
+		mesh.indices.insert(mesh.indices.end(), {face[0], face[1], face[2]});
+
+	// Each triangle becomes four, the new vertices are the edge midpoints pushed onto the sphere.
+	// Neighbouring triangles share the midpoint of their edge.
+	for (unsigned int level = 0; level < subdivisions; ++level)
+	{
+		std::unordered_map<uint64_t, unsigned int> midpoints;
+		midpoints.reserve(mesh.indices.size());
+		auto midpoint = [&](unsigned int a, unsigned int b)
+		{
+			uint64_t key = uint64_t(std::min(a, b)) << 32 | std::max(a, b);
+			auto inserted = midpoints.emplace(key, unsigned(mesh.positions.size()));
+			if (inserted.second)
+				mesh.positions.push_back(glm::normalize(mesh.positions[a] + mesh.positions[b]));
+			return inserted.first->second;
+		};
+		std::vector<unsigned int> indices;
+		indices.reserve(mesh.indices.size() * 4);
+		for (size_t i = 0; i < mesh.indices.size(); i += 3)
+		{
+			unsigned int a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+			unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+			indices.insert(indices.end(), {a, ab, ca, ab, b, bc, ca, bc, c, ab, bc, ca});
+		}
+		mesh.indices.swap(indices);
+	}
+
+	// Spherical mapping. Vertices are shared across the u seam, so the triangles there wrap the texture once backwards.
+	mesh.normals = mesh.positions;
+	mesh.uvs.reserve(mesh.positions.size());
+	for (const glm::vec3 & position : mesh.positions)
+		mesh.uvs.push_back(glm::vec2(float(std::atan2(position.y, position.x) / (2.0 * M_PI) + 0.5),
+			float(std::asin(std::clamp(position.z, -1.0f, 1.0f)) / M_PI + 0.5)));
+}
+
+static void generateCylinder(ShapeMesh & mesh, unsigned int slices, unsigned int stacks)
+{
+	TrigTable circle{trigTable(slices, 0.0, 2.0 * M_PI)};
+	std::vector<ProfilePoint> profile(stacks + 1);
+	for (unsigned int s = 0; s <= stacks; ++s)
+	{
+		float v = float(s) / stacks;
+		profile[s] = ProfilePoint{1.0f, 2.0f * v - 1.0f, 1.0f, 0.0f, v};
+	}
+	lathe(mesh, profile, circle);
+	cap(mesh, -1.0f, false, circle);
+	cap(mesh, 1.0f, true, circle);
+}
+
+static void generateCone(ShapeMesh & mesh, unsigned int slices, unsigned int stacks)
+{
+	TrigTable circle{trigTable(slices, 0.0, 2.0 * M_PI)};
+	// Height 2, radius 1: the side normal leans up by atan(1 / 2)
+	const float normalRadius = 2.0f / std::sqrt(5.0f);
+	const float normalZ = 1.0f / std::sqrt(5.0f);
+	std::vector<ProfilePoint> profile(stacks + 1);
+	for (unsigned int s = 0; s <= stacks; ++s)
+	{
+		float v = float(s) / stacks;
+		profile[s] = ProfilePoint{1.0f - v, 2.0f * v - 1.0f, normalRadius, normalZ, v};
+	}
+	profile[stacks].radius = 0.0f;
+	lathe(mesh, profile, circle);
+	cap(mesh, -1.0f, false, circle);
+}
+
+static void generateTorus(ShapeMesh & mesh, unsigned int slices, unsigned int tubeSlices, float tubeRadius)
+{
+	// Scaled so the outer edge is at radius 1
+	float centerRadius = 1.0f / (1.0f + tubeRadius);
+	float radius = tubeRadius * centerRadius;
+	// Around the tube starting outside, going up first
+	TrigTable tube{trigTable(tubeSlices, 0.0, 2.0 * M_PI)};
+	std::vector<ProfilePoint> profile(tubeSlices + 1);
+	for (unsigned int s = 0; s <= tubeSlices; ++s)
+		profile[s] = ProfilePoint{centerRadius + radius * tube.cos[s], radius * tube.sin[s], tube.cos[s], tube.sin[s], float(s) / tubeSlices};
+	lathe(mesh, profile, trigTable(slices, 0.0, 2.0 * M_PI));
+}
+
+ShapeMesh generateShape(const ShapeParams & shape)
+{
+	ShapeMesh mesh;
+	switch (shape.type)
+	{
+	case ShapeType::Cube:
+		generateCube(mesh);
+		break;
+	case ShapeType::Sphere:
+		generateSphere(mesh, shape.slices, shape.stacks);
+		break;
+	case ShapeType::Icosphere:
+		generateIcosphere(mesh, shape.stacks);
+		break;
+	case ShapeType::Cylinder:
+		generateCylinder(mesh, shape.slices, shape.stacks);
+		break;
+	case ShapeType::Cone:
+		generateCone(mesh, shape.slices, shape.stacks);
+		break;
+	case ShapeType::Torus:
+		generateTorus(mesh, shape.slices, shape.stacks, shape.tubeRadius);
+		break;
+	}
+	return mesh;
+}
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "profiler.hpp"
+
+namespace {
+
+// Frames between two comparisons of the GPU clock with the CPU clock, they drift apart slowly
+const uint64_t CalibrationFrames = 256;
+
+// Nearest rank, sorts values
+double percentile(std::vector<double> & values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	size_t rank = size_t(std::ceil(p * values.size()));
+	return values[std::min(std::max(rank, size_t(1)), values.size()) - 1];
+}
+
+void writeName(FILE * file, const char * name)
+{
+	for (const char * c = name; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			fputc('\\', file);
+		fputc(*c, file);
+	}
+}
+
+} // namespace
+
+Profiler::Profiler()
+	: start_(std::chrono::steady_clock::now())
+{
+	gpu_ = GLEW_ARB_timer_query;
+	if (gpu_)
+		calibrate();
+}
+
+Profiler::~Profiler()
+{
+	release();
+}
+
+void Profiler::release()
+{
+	for (GpuFrame & gpuFrame : gpuFrames_)
+	{
+		if (!gpuFrame.queries.empty())
+			glDeleteQueries(GLsizei(gpuFrame.queries.size()), gpuFrame.queries.data());
+		gpuFrame = GpuFrame{};
+	}
+	gpu_ = false;
+	recording_ = false;
+}
+
+int64_t Profiler::now() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+}
+
+void Profiler::calibrate()
+{
+	// The time the GPU has reached, it doesn't wait for the commands before it
+	GLint64 gpuTime = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	gpuOffset_ = now() - int64_t(gpuTime);
+}
+
+void Profiler::beginFrame()
+{
+	if (gpu_)
+	{
+		// Whatever arrived, the frames complete in order
+		for (GpuFrame & gpuFrame : gpuFrames_)
+			if (gpuFrame.pending && readGpuFrame(gpuFrame))
+				gpuFrame.pending = false;
+	}
+	recording_ = enabled_;
+	if (!recording_)
+		return;
+
+	// frameIndex_ only counts recorded frames, disabled ones never wait for the GPU here
+	if (gpu_ && frameIndex_ % CalibrationFrames == 0)
+		calibrate();
+	current_ = Frame{frameIndex_, now(), 0, {}, {}};
+	cpuStack_.clear();
+	if (gpu_)
+	{
+		GpuFrame & gpuFrame = gpuFrames_[frameIndex_ % GpuLatency];
+		if (gpuFrame.pending)
+			++droppedGpuFrames_;
+		gpuFrame.index = frameIndex_;
+		gpuFrame.pending = true;
+		gpuFrame.events.clear();
+		gpuFrame.stack.clear();
+		gpuFrame.used = 0;
+	}
+	beginScope("Frame", false);
+	if (gpu_)
+		beginScope("Frame", true);
+}
+
+void Profiler::endFrame()
+{
+	if (!recording_)
+		return;
+	// Scopes left open end with the frame
+	if (gpu_)
+		while (!gpuFrames_[frameIndex_ % GpuLatency].stack.empty())
+			endScope(true);
+	while (!cpuStack_.empty())
+		endScope(false);
+	current_.end = now();
+	recording_ = false;
+
+	history_.push_back(std::move(current_));
+	if (history_.size() > HistoryFrames)
+		history_.pop_front();
+	++frameIndex_;
+}
+
+void Profiler::beginScope(const char * name, bool gpu)
+{
+	if (!gpu)
+	{
+		cpuStack_.push_back(uint32_t(current_.cpu.size()));
+		current_.cpu.push_back(Event{name, now(), 0, uint32_t(cpuStack_.size() - 1)});
+		return;
+	}
+	GpuFrame & gpuFrame = gpuFrames_[frameIndex_ % GpuLatency];
+	if (gpuFrame.used + 2 > gpuFrame.queries.size())
+	{
+		size_t count = std::max(gpuFrame.queries.size(), size_t(16));
+		gpuFrame.queries.resize(gpuFrame.queries.size() + count);
+		glGenQueries(GLsizei(count), gpuFrame.queries.data() + gpuFrame.queries.size() - count);
+	}
+	glQueryCounter(gpuFrame.queries[gpuFrame.used], GL_TIMESTAMP);
+	gpuFrame.stack.push_back(uint32_t(gpuFrame.events.size()));
+	gpuFrame.events.push_back(Event{name, int64_t(gpuFrame.used), int64_t(gpuFrame.used + 1), uint32_t(gpuFrame.stack.size() - 1)});
+	gpuFrame.used += 2;
+}
+
+void Profiler::endScope(bool gpu)
+{
+	if (!gpu)
+	{
+		if (cpuStack_.empty())
+			return;
+		current_.cpu[cpuStack_.back()].end = now();
+		cpuStack_.pop_back();
+		return;
+	}
+	GpuFrame & gpuFrame = gpuFrames_[frameIndex_ % GpuLatency];
+	if (gpuFrame.stack.empty())
+		return;
+	glQueryCounter(gpuFrame.queries[gpuFrame.events[gpuFrame.stack.back()].end], GL_TIMESTAMP);
+	gpuFrame.stack.pop_back();
+}
+
+bool Profiler::readGpuFrame(GpuFrame & gpuFrame)
+{
+	// The queries finish in the order they were issued, the last one tells for all of them
+	if (gpuFrame.used)
+	{
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(gpuFrame.queries[gpuFrame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+	}
+	Frame * frame = findFrame(gpuFrame.index);
+	if (!frame)
+		return true;
+	frame->gpu = gpuFrame.events;
+	for (Event & event : frame->gpu)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(gpuFrame.queries[event.begin], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(gpuFrame.queries[event.end], GL_QUERY_RESULT, &end);
+		event.begin = int64_t(begin) + gpuOffset_;
+		event.end = int64_t(end) + gpuOffset_;
+	}
+	frame->gpuDone = true;
+	return true;
+}
+
+Profiler::Frame * Profiler::findFrame(uint64_t index)
+{
+	if (history_.empty() || index < history_.front().index || index - history_.front().index >= history_.size())
+		return nullptr;
+	return &history_[index - history_.front().index];
+}
+
+FrameTimeSummary Profiler::summary() const
+{
+	FrameTimeSummary summary{};
+	std::vector<double> cpu, gpu;
+	for (const Frame & frame : history_)
+	{
+		cpu.push_back((frame.end - frame.begin) * 1e-6);
+		// The first GPU scope is the one around the whole frame
+		if (frame.gpuDone && !frame.gpu.empty())
+			gpu.push_back((frame.gpu[0].end - frame.gpu[0].begin) * 1e-6);
+	}
+	summary.frames = cpu.size();
+	summary.cpu50 = percentile(cpu, 0.50);
+	summary.cpu95 = percentile(cpu, 0.95);
+	summary.cpu99 = percentile(cpu, 0.99);
+	summary.gpuFrames = gpu.size();
+	summary.gpu50 = percentile(gpu, 0.50);
+	summary.gpu95 = percentile(gpu, 0.95);
+	summary.gpu99 = percentile(gpu, 0.99);
+	return summary;
+}
+
+void Profiler::printSummary() const
+{
+	FrameTimeSummary times = summary();
+	printf("Frame time over the last %zu frames: CPU p50 %.2f ms, p95 %.2f ms, p99 %.2f ms\n",
+		times.frames, times.cpu50, times.cpu95, times.cpu99);
+	if (times.gpuFrames)
+		printf("  GPU over %zu frames: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms (%zu frames dropped, the GPU was too late)\n",
+			times.gpuFrames, times.gpu50, times.gpu95, times.gpu99, droppedGpuFrames_);
+
+	// Scopes by name, in the order they first came up
+	struct Scope
+	{
+		const char * name;
+		uint32_t depth;
+		double cpu, gpu; // milliseconds
+	};
+	std::vector<Scope> scopes;
+	auto add = [&scopes](const Event & event, bool gpu)
+	{
+		auto found = std::find_if(scopes.begin(), scopes.end(),
+			[&event](const Scope & scope) { return scope.depth == event.depth && strcmp(scope.name, event.name) == 0; });
+		if (found == scopes.end())
+			found = scopes.insert(scopes.end(), Scope{event.name, event.depth, 0.0, 0.0});
+		(gpu ? found->gpu : found->cpu) += (event.end - event.begin) * 1e-6;
+	};
+	for (const Frame & frame : history_)
+	{
+		for (const Event & event : frame.cpu)
+			add(event, false);
+		for (const Event & event : frame.gpu)
+			add(event, true);
+	}
+	double perFrame = times.frames ? 1.0 / times.frames : 0.0;
+	double perGpuFrame = times.gpuFrames ? 1.0 / times.gpuFrames : 0.0;
+	printf("  Per frame                 CPU ms    GPU ms\n");
+	for (const Scope & scope : scopes)
+		printf("  %*s%-*s %8.3f  %8.3f\n", 2 * int(scope.depth), "", 24 - 2 * int(scope.depth), scope.name,
+			scope.cpu * perFrame, scope.gpu * perGpuFrame);
+}
+
+bool Profiler::writeChromeTrace(const char * path) const
+{
+	FILE * file = fopen(path, "w");
+	if (!file)
+	{
+		printf("Impossible to write %s\n", path);
+		return false;
+	}
+	// Complete events ("X") in microseconds. The GPU gets a track of its own next to the render thread.
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Render thread\"}},\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	for (const Frame & frame : history_)
+	{
+		const std::vector<Event> * tracks[2]{&frame.cpu, &frame.gpu};
+		for (int track = 0; track < 2; ++track)
+		{
+			for (const Event & event : *tracks[track])
+			{
+				fprintf(file, ",\n{\"name\":\"");
+				writeName(file, event.name);
+				fprintf(file, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"frame\":%llu}}",
+					track ? "gpu" : "cpu", event.begin * 1e-3, (event.end - event.begin) * 1e-3, track + 1,
+					static_cast<unsigned long long>(frame.index));
+			}
+		}
+	}
+	fprintf(file, "\n]}\n");
+	bool written = !ferror(file);
+	fclose(file);
+	if (written)
+		printf("Wrote the trace of %zu frames to %s\n", history_.size(), path);
+	return written;
+}
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+#include "frustum.hpp"
+#include "glstate.hpp"
+#include "jobsystem.hpp"
+#include "objects.hpp"
+#include "renderqueue.hpp"
+#include "shaderprogram.hpp"
+#include "texturearray.hpp"
+#include "vertexformat.hpp"
+
+namespace {
+
+const int DepthBits = 24;
+const int IdBits = 12;
+const uint64_t IdMask = (1u << IdBits) - 1;
+// Model matrices per job of the parallel culling
+const size_t CullGrain = 1024;
+
+static_assert(MaxShaderLights == size_t(ShaderProgram::UniformSlot::Light3) - size_t(ShaderProgram::UniformSlot::Light0) + 1,
+	"a uniform slot for each light");
+
+uint64_t quantizeDepth(float depth)
+{
+	depth = std::min(std::max(depth, 0.0f), 1.0f);
+	return uint64_t(depth * float((1u << DepthBits) - 1) + 0.5f);
+}
+
+} // namespace
+
+uint64_t makeSortKey(RenderPass pass, GLuint program, GLuint material, GLuint mesh, float depth)
+{
+	uint64_t state{((program & IdMask) << (2 * IdBits)) | ((material & IdMask) << IdBits) | (mesh & IdMask)};
+	uint64_t key{uint64_t(pass) << 60};
+	if (pass == RenderPass::Transparent)
+	{
+		// Blending needs the far surfaces first, state changes come second
+		uint64_t farFirst{((1u << DepthBits) - 1) - quantizeDepth(depth)};
+		return key | (farFirst << (3 * IdBits)) | state;
+	}
+	return key | (state << DepthBits) | quantizeDepth(depth);
+}
+
+void RenderQueue::submit(const DrawPacket & packet, const glm::mat4 * models, GLsizei count, const GLint * layers)
+{
+	packets_.push_back(Entry{packet, uint32_t(models_.size()), uint32_t(count), layers != nullptr});
+	models_.insert(models_.end(), models, models + count);
+	if (layers)
+		layers_.insert(layers_.end(), layers, layers + count);
+	else
+		layers_.insert(layers_.end(), size_t(count), packet.layer);
+	sorted_ = false;
+}
+
+CullStats RenderQueue::cull(const Frustum & frustum, JobSystem * jobs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	spheres_.resize(models_.size());
+	visible_.resize(models_.size());
+	CullStats stats{};
+	if (!jobs)
+	{
+		for (const Entry & entry : packets_)
+			for (uint32_t i = entry.firstModel; i < entry.firstModel + entry.modelCount; ++i)
+				spheres_[i] = transformSphere(entry.packet.geometry.bounds, models_[i]);
+		stats.visible = cullSpheres(frustum, spheres_.data(), spheres_.size(), visible_.data());
+	}
+	else
+	{
+		// Instanced packets hold most of the models, so the models of each packet are split up
+		std::atomic<size_t> visible{0};
+		for (const Entry & entry : packets_)
+		{
+			jobs->parallelFor(entry.modelCount, CullGrain, [&](size_t begin, size_t end)
+			{
+				size_t first{entry.firstModel + begin};
+				for (size_t i = first; i < entry.firstModel + end; ++i)
+					spheres_[i] = transformSphere(entry.packet.geometry.bounds, models_[i]);
+				visible += cullSpheres(frustum, spheres_.data() + first, end - begin, visible_.data() + first);
+			});
+		}
+		stats.visible = visible;
+	}
+	stats.culled = models_.size() - stats.visible;
+
+	// Compact in place, everything only ever moves towards the front
+	if (stats.culled)
+	{
+		size_t keptPackets{0};
+		uint32_t keptModels{0};
+		for (Entry & entry : packets_)
+		{
+			uint32_t first{keptModels};
+			for (uint32_t i = entry.firstModel; i < entry.firstModel + entry.modelCount; ++i)
+				if (visible_[i])
+				{
+					layers_[keptModels] = layers_[i];
+					models_[keptModels++] = models_[i];
+				}
+			if (keptModels == first)
+				continue;
+			entry.firstModel = first;
+			entry.modelCount = keptModels - first;
+			packets_[keptPackets++] = entry;
+		}
+		packets_.resize(keptPackets);
+		models_.resize(keptModels);
+		layers_.resize(keptModels);
+	}
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+// LSD radix sort, one byte per pass. Passes over bytes that are the same in every key
+// are skipped, which for a typical frame leaves only a few of the eight.
+void RenderQueue::sort()
+{
+	const size_t count{packets_.size()};
+	keys_.resize(count);
+	keysTemp_.resize(count);
+	order_.resize(count);
+	orderTemp_.resize(count);
+
+	size_t histograms[8][256]{};
+	uint64_t allOr{0}, allAnd{~uint64_t(0)};
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint64_t key{packets_[i].packet.key};
+		keys_[i] = key;
+		order_[i] = uint32_t(i);
+		allOr |= key;
+		allAnd &= key;
+		for (int digit = 0; digit < 8; ++digit)
+			++histograms[digit][(key >> (8 * digit)) & 0xff];
+	}
+
+	for (int digit = 0; digit < 8; ++digit)
+	{
+		int shift{8 * digit};
+		if ((((allOr ^ allAnd) >> shift) & 0xff) == 0)
+			continue;
+
+		size_t offsets[256];
+		size_t sum{0};
+		for (int bucket = 0; bucket < 256; ++bucket)
+		{
+			offsets[bucket] = sum;
+			sum += histograms[digit][bucket];
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t target{offsets[(keys_[i] >> shift) & 0xff]++};
+			keysTemp_[target] = keys_[i];
+			orderTemp_[target] = order_[i];
+		}
+		keys_.swap(keysTemp_);
+		order_.swap(orderTemp_);
+	}
+	sorted_ = true;
+}
+
+void RenderQueue::execute(const FrameUniforms & frame)
+{
+	if (!sorted_)
+	{
+		order_.resize(packets_.size());
+		for (size_t i = 0; i < order_.size(); ++i)
+			order_[i] = uint32_t(i);
+	}
+
+	const glm::mat4 viewProjection{frame.projection * frame.view};
+	ShaderProgram * current{nullptr};
+	// The layer for draws without a layer array is vertex array independent state, sent when it changes
+	GLint currentLayer{-2};
+	for (uint32_t index : order_)
+	{
+		const Entry & entry{packets_[index]};
+		const DrawPacket & packet{entry.packet};
+		ShaderProgram & program{*packet.program};
+		if (&program != current)
+		{
+			program.set(ShaderProgram::UniformSlot::V, frame.view);
+			program.set(ShaderProgram::UniformSlot::P, frame.projection);
+			program.set(ShaderProgram::UniformSlot::VP, viewProjection);
+			for (unsigned int i = 0; i < frame.lightCount && i < MaxShaderLights; ++i)
+				program.set(ShaderProgram::UniformSlot(size_t(ShaderProgram::UniformSlot::Light0) + i), frame.lightPositions[i]);
+			current = &program;
+		}
+		glState().useProgram(program.id());
+		if (packet.texture)
+		{
+			glState().activeTexture(GL_TEXTURE0);
+			glState().bindTexture(GL_TEXTURE_2D, packet.texture);
+		}
+		if (packet.textureArray)
+		{
+			glState().activeTexture(TextureArrayUnit);
+			glState().bindTexture(GL_TEXTURE_2D_ARRAY, packet.textureArray);
+		}
+		if (packet.mesh && packet.mesh->format == VertexFormat::Packed)
+			sendMeshUniforms(program, *packet.mesh);
+
+		const glm::mat4 * models{&models_[entry.firstModel]};
+		const GLint * layers{&layers_[entry.firstModel]};
+		if (packet.instanced)
+		{
+			if (!entry.layered && packet.layer != currentLayer)
+			{
+				glVertexAttribI1i(InstanceLayerAttribute, packet.layer);
+				currentLayer = packet.layer;
+			}
+			drawInstanced(packet.geometry, models, GLsizei(entry.modelCount), entry.layered ? layers : nullptr);
+			continue;
+		}
+		glState().bindVertexArray(packet.geometry.vertexArray);
+		for (uint32_t i = 0; i < entry.modelCount; ++i)
+		{
+			if (layers[i] != currentLayer)
+			{
+				glVertexAttribI1i(InstanceLayerAttribute, layers[i]);
+				currentLayer = layers[i];
+			}
+			program.set(ShaderProgram::UniformSlot::M, models[i]);
+			program.set(ShaderProgram::UniformSlot::MVP, viewProjection * models[i]);
+			if (packet.geometry.indexType)
+				glDrawElements(packet.geometry.mode, packet.geometry.count, packet.geometry.indexType, (void*)(packet.geometry.first * sizeof(GLuint)));
+			else
+				glDrawArrays(packet.geometry.mode, packet.geometry.first, packet.geometry.count);
+		}
+	}
+}
+
+void RenderQueue::append(const RenderQueue & other)
+{
+	uint32_t offset{uint32_t(models_.size())};
+	for (Entry entry : other.packets_)
+	{
+		entry.firstModel += offset;
+		packets_.push_back(entry);
+	}
+	models_.insert(models_.end(), other.models_.begin(), other.models_.end());
+	layers_.insert(layers_.end(), other.layers_.begin(), other.layers_.end());
+	sorted_ = false;
+}
+
+void RenderQueue::clear()
+{
+	packets_.clear();
+	models_.clear();
+	layers_.clear();
+	order_.clear();
+	sorted_ = false;
+}
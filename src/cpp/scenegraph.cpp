@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "jobsystem.hpp"
+#include "scenegraph.hpp"
+
+namespace {
+
+// Nodes per job of the parallel update, fewer are updated on the calling thread
+const size_t UpdateGrain = 1024;
+
+} // namespace
+
+SceneGraph::Node SceneGraph::add(Node parent, const glm::mat4 & local)
+{
+	Node node{Node(parents_.size())};
+	parents_.push_back(parent);
+	locals_.push_back(local);
+	worlds_.push_back(local);
+	dirty_.push_back(1);
+	uint32_t depth{parent == NoParent ? 0 : depths_[parent] + 1};
+	depths_.push_back(depth);
+	if (levels_.size() <= depth)
+		levels_.resize(depth + 1);
+	levels_[depth].push_back(node);
+	firstDirty_ = std::min(firstDirty_, size_t(node));
+	return node;
+}
+
+void SceneGraph::setLocal(Node node, const glm::mat4 & local)
+{
+	if (std::memcmp(&locals_[node], &local, sizeof(glm::mat4)) == 0)
+		return;
+	locals_[node] = local;
+	dirty_[node] = 1;
+	firstDirty_ = std::min(firstDirty_, size_t(node));
+}
+
+size_t SceneGraph::update()
+{
+	const size_t count{parents_.size()};
+	size_t updated{0};
+	// Parents come before their children, so a dirty parent has already passed its flag on
+	// and its world matrix is current when the children get to it
+	for (size_t node = firstDirty_; node < count; ++node)
+	{
+		Node parent{parents_[node]};
+		if (parent != NoParent)
+			dirty_[node] |= dirty_[parent];
+		if (!dirty_[node])
+			continue;
+		worlds_[node] = parent == NoParent ? locals_[node] : worlds_[parent] * locals_[node];
+		++updated;
+	}
+	if (firstDirty_ < count)
+		std::fill(dirty_.begin() + firstDirty_, dirty_.end(), 0);
+	firstDirty_ = count;
+	return updated;
+}
+
+size_t SceneGraph::update(JobSystem & jobs)
+{
+	const size_t count{parents_.size()};
+	if (firstDirty_ >= count)
+		return 0;
+	std::atomic<size_t> updated{0};
+	for (const std::vector<Node> & level : levels_)
+	{
+		// Nothing before firstDirty_ changes, the levels are sorted
+		size_t first{size_t(std::lower_bound(level.begin(), level.end(), Node(firstDirty_)) - level.begin())};
+		jobs.parallelFor(level.size() - first, UpdateGrain, [&](size_t begin, size_t end)
+		{
+			size_t chunkUpdated{0};
+			for (size_t i = first + begin; i < first + end; ++i)
+			{
+				Node node{level[i]};
+				Node parent{parents_[node]};
+				if (parent != NoParent)
+					dirty_[node] |= dirty_[parent];
+				if (!dirty_[node])
+					continue;
+				worlds_[node] = parent == NoParent ? locals_[node] : worlds_[parent] * locals_[node];
+				++chunkUpdated;
+			}
+			updated += chunkUpdated;
+		});
+	}
+	std::fill(dirty_.begin() + firstDirty_, dirty_.end(), 0);
+	firstDirty_ = count;
+	return updated;
+}
+
+void SceneGraph::clear()
+{
+	parents_.clear();
+	locals_.clear();
+	worlds_.clear();
+	dirty_.clear();
+	depths_.clear();
+	levels_.clear();
+	firstDirty_ = 0;
+}
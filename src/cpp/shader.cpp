@@ -3,7 +3,14 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+#include <thread>
 using namespace std;
 
 #include <stdlib.h>
@@ -11,39 +18,200 @@ using namespace std;
 
 #include <GL/glew.h>
 
+#include "asset.hpp"
+#include "hash.hpp"
+#include "mappedfile.hpp"
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+namespace {
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// Bump when the layout of the cache files changes
+const uint32_t ProgramCacheVersion = 1;
+const char ProgramCacheMagic[4] = {'C', 'G', 'P', 'B'};
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
+// Followed by length bytes of the driver's program binary
+struct ProgramCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t binaryFormat;
+	uint32_t length;
+};
+
+// LoadShaders also runs on the shader reloader's thread
+std::mutex StatsMutex;
+ShaderCacheStats Stats; // guarded by StatsMutex
+std::atomic<bool> CacheEnabled{true};
+
+bool readSource(const char * path, std::string & source){
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if (!stream.is_open())
+		return false;
+	std::ostringstream text;
+	text << stream.rdbuf();
+	source = text.str();
+	return true;
+}
+
+// Appends the file to source, with the files it includes in place of the #include lines.
+// defines is set to nullptr once it went in after the #version line.
+bool includeFile(const std::string & path, const char *& defines, std::string & source, std::vector<std::string> & files){
+	std::string text;
+	if (!readSource(path.c_str(), text))
+		return false;
+	std::string number = std::to_string(files.size());
+	files.push_back(path);
+
+	std::istringstream lines(text);
+	std::string line;
+	for (int lineNumber = 1; std::getline(lines, line); ++lineNumber){
+		size_t start = line.find_first_not_of(" \t");
+		bool directive = start != std::string::npos && line[start] == '#';
+		if (directive && line.compare(start, 8, "#include") == 0){
+			size_t open = line.find('"', start + 8);
+			size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+			if (close == std::string::npos){
+				printf("%s(%d): #include needs a \"file name\"\n", path.c_str(), lineNumber);
+				return false;
+			}
+			std::filesystem::path included = std::filesystem::path(path).parent_path() / line.substr(open + 1, close - open - 1);
+			std::string includedPath = included.lexically_normal().string();
+			if (std::find(files.begin(), files.end(), includedPath) == files.end()){
+				size_t count = files.size();
+				source += "#line 1 " + std::to_string(count) + "\n";
+				if (!includeFile(includedPath, defines, source, files)){
+					// Deeper down the file that is missing was reported already
+					if (files.size() == count)
+						printf("%s(%d): Impossible to open %s\n", path.c_str(), lineNumber, includedPath.c_str());
+					return false;
+				}
+			}
+			source += "#line " + std::to_string(lineNumber + 1) + " " + number + "\n";
+			continue;
+		}
+		source += line;
+		source += '\n';
+		// Nothing but comments may come before #version
+		if (defines && directive && line.compare(start, 8, "#version") == 0){
+			source += defines;
+			source += "#line " + std::to_string(lineNumber + 1) + " " + number + "\n";
+			defines = nullptr;
+		}
+	}
+	return true;
+}
+
+void printSourceNames(const std::vector<std::string> & files){
+	if (files.size() < 2)
+		return;
+	printf("Source strings:");
+	for (size_t i = 0; i < files.size(); ++i)
+		printf(" %zu %s", i, files[i].c_str());
+	printf("\n");
+}
+
+// A binary only fits the driver that wrote it, so the driver is part of the key
+uint64_t programKey(const std::string & vertexSource, const std::string & fragmentSource){
+	uint64_t key = hashBytes(vertexSource.data(), vertexSource.size());
+	key = hashBytes(fragmentSource.data(), fragmentSource.size(), key);
+	for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}){
+		const GLubyte * text = glGetString(name);
+		key = hashString(text ? reinterpret_cast<const char *>(text) : "", key);
+	}
+	return key;
+}
+
+// Empty if there is no cache directory
+std::string programCachePath(uint64_t key){
+	std::error_code error;
+	std::filesystem::path directory(CACHE_DIR);
+	std::filesystem::create_directories(directory, error);
+	if (error || !std::filesystem::is_directory(directory, error))
+		return std::string();
+	char name[40];
+	snprintf(name, sizeof(name), "program-%016llx.bin", static_cast<unsigned long long>(key));
+	return (directory / name).string();
+}
+
+bool binariesSupported(){
+	if (!GLEW_ARB_get_program_binary)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+// 0 if there is no usable binary. The driver may refuse one it wrote itself, e.g. after an update.
+GLuint loadProgramBinary(const std::string & cachePath, uint64_t key){
+	MappedFile file;
+	if (!file.open(cachePath.c_str()))
+		return 0;
+	ProgramCacheHeader header;
+	if (file.size() < sizeof(header))
+		return 0;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, ProgramCacheMagic, 4) != 0 || header.version != ProgramCacheVersion
+		|| header.key != key || sizeof(header) + header.length > file.size())
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.binaryFormat, file.data() + sizeof(header), header.length);
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE){
+		{
+			std::lock_guard<std::mutex> lock(StatsMutex);
+			++Stats.rejected;
+		}
+		glDeleteProgram(ProgramID);
 		return 0;
 	}
+	return ProgramID;
+}
+
+void saveProgramBinary(GLuint ProgramID, const std::string & cachePath, uint64_t key){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum binaryFormat = 0;
+	glGetProgramBinary(ProgramID, length, &length, &binaryFormat, binary.data());
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	ProgramCacheHeader header{};
+	memcpy(header.magic, ProgramCacheMagic, 4);
+	header.version = ProgramCacheVersion;
+	header.key = key;
+	header.binaryFormat = binaryFormat;
+	header.length = uint32_t(length);
+
+	// Write next to the final file and rename, so a crash never leaves a half written cache behind.
+	// The name is the writer's own, two threads or processes may save the same program at once.
+	std::ostringstream tempName;
+	tempName << cachePath << '.' << std::this_thread::get_id() << '-' << std::chrono::steady_clock::now().time_since_epoch().count() << ".tmp";
+	std::string tempPath = tempName.str();
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		out.write(binary.data(), length);
+		if (!out){
+			out.close();
+			std::error_code error;
+			std::filesystem::remove(tempPath, error);
+			return;
+		}
 	}
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+}
 
+GLuint compileProgram(const char * vertex_file_path, const std::string & VertexShaderCode,
+	const char * fragment_file_path, const std::string & FragmentShaderCode, bool retrievable){
 
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
@@ -87,6 +255,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	// Link the program
 	printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
+	// Asks the driver to keep the binary around for glGetProgramBinary
+	if (retrievable)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
 	glLinkProgram(ProgramID);
@@ -100,10 +271,83 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
+	glDetachShader(ProgramID, VertexShaderID);
+	glDetachShader(ProgramID, FragmentShaderID);
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
 	return ProgramID;
 }
 
+} // namespace
+
+bool preprocessShader(const char * path, const char * defines, std::string & source, std::vector<std::string> * files){
+	std::string definitions = defines ? defines : "";
+	if (!definitions.empty() && definitions.back() != '\n')
+		definitions += '\n';
+	const char * pending = definitions.empty() ? nullptr : definitions.c_str();
+	std::vector<std::string> read;
+	source.clear();
+	bool result = includeFile(std::filesystem::path(path).lexically_normal().string(), pending, source, read);
+	// Without a #version line they go first
+	if (result && pending)
+		source = definitions + "#line 1 0\n" + source;
+	if (files)
+		*files = std::move(read);
+	return result;
+}
 
+ShaderCacheStats shaderCacheStats(){
+	std::lock_guard<std::mutex> lock(StatsMutex);
+	return Stats;
+}
+
+void setShaderCacheEnabled(bool enabled){
+	CacheEnabled = enabled;
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines){
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Read the shader code from the files and preprocess it, so the hash sees exactly what gets compiled,
+	// includes and defines too. A file that couldn't be included was reported already.
+	std::string VertexShaderCode, FragmentShaderCode;
+	std::vector<std::string> VertexFiles, FragmentFiles;
+	if (!preprocessShader(vertex_file_path, defines, VertexShaderCode, &VertexFiles)){
+		if (VertexFiles.empty())
+			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
+		return 0;
+	}
+	if (!preprocessShader(fragment_file_path, defines, FragmentShaderCode, &FragmentFiles)){
+		if (FragmentFiles.empty())
+			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", fragment_file_path);
+		return 0;
+	}
+
+	// A program linked before by the same driver from the same sources is taken from the cache
+	bool cached = CacheEnabled && binariesSupported();
+	uint64_t key = cached ? programKey(VertexShaderCode, FragmentShaderCode) : 0;
+	std::string cachePath = cached ? programCachePath(key) : std::string();
+	GLuint ProgramID = cachePath.empty() ? 0 : loadProgramBinary(cachePath, key);
+	bool loaded = ProgramID != 0;
+	if (loaded){
+		printf("Loaded program binary of %s and %s\n", vertex_file_path, fragment_file_path);
+	}else{
+		ProgramID = compileProgram(vertex_file_path, VertexShaderCode, fragment_file_path, FragmentShaderCode, !cachePath.empty());
+		GLint Result = GL_FALSE;
+		glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+		if (Result == GL_TRUE && !cachePath.empty())
+			saveProgramBinary(ProgramID, cachePath, key);
+		// For the source string numbers in the messages
+		if (Result != GL_TRUE){
+			printSourceNames(VertexFiles);
+			printSourceNames(FragmentFiles);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(StatsMutex);
+	++(loaded ? Stats.loaded : Stats.compiled);
+	Stats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return ProgramID;
+}
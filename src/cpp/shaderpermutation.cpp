@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+#include "shaderpermutation.hpp"
+#include "shaderreload.hpp"
+
+std::string shaderDefines(uint32_t features)
+{
+	std::string defines;
+	defines += "#define TEXTURE " + std::to_string((features & ShaderTexture) ? 1 : 0) + "\n";
+	defines += "#define SPECULAR " + std::to_string((features & ShaderSpecular) ? 1 : 0) + "\n";
+	defines += "#define LIGHT_COUNT " + std::to_string(features >> ShaderLightShift) + "\n";
+	return defines;
+}
+
+ShaderPermutations::ShaderPermutations(const char * vertexPath, const char * fragmentPath, const char * defines,
+	std::function<void(ShaderProgram &)> setup)
+	: vertexPath_(vertexPath), fragmentPath_(fragmentPath), defines_(defines ? defines : ""), setup_(std::move(setup))
+{
+	if (!defines_.empty() && defines_.back() != '\n')
+		defines_ += '\n';
+}
+
+ShaderProgram & ShaderPermutations::get(uint32_t features)
+{
+	auto found = variants_.find(features);
+	if (found != variants_.end())
+		return found->second;
+
+	unsigned int lights = features >> ShaderLightShift;
+	if (lights < 1 || lights > MaxShaderLights)
+		printf("Shader permutation with %u lights, only 1 to %u work\n", lights, MaxShaderLights);
+	std::string defines = defines_ + shaderDefines(features);
+	ShaderProgram & program = variants_.emplace(features, ShaderProgram(LoadShaders(vertexPath_.c_str(), fragmentPath_.c_str(), defines.c_str()))).first->second;
+	if (setup_)
+		setup_(program);
+	if (reloader_)
+		reloader_->watch(program, vertexPath_.c_str(), fragmentPath_.c_str(), defines.c_str());
+	return program;
+}
+
+void ShaderPermutations::watch(ShaderReloader & reloader)
+{
+	reloader_ = &reloader;
+	for (auto & variant : variants_)
+		reloader.watch(variant.second, vertexPath_.c_str(), fragmentPath_.c_str(), (defines_ + shaderDefines(variant.first)).c_str());
+}
+
+void ShaderPermutations::release()
+{
+	for (auto & variant : variants_)
+		glDeleteProgram(variant.second.id());
+	variants_.clear();
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "shaderprogram.hpp"
+
+namespace {
+
+// Names of ShaderProgram::UniformSlot, in its order
+const char * const SlotNames[] = {"M", "V", "P", "VP", "MVP", "PositionScale", "PositionBias", "UVScale", "UVBias",
+	"LightPosition_worldspace", "LightPosition_worldspace[1]", "LightPosition_worldspace[2]", "LightPosition_worldspace[3]"};
+static_assert(sizeof(SlotNames) / sizeof(SlotNames[0]) == size_t(ShaderProgram::UniformSlot::Count), "a name for each slot");
+
+} // namespace
+
+ShaderProgram::ShaderProgram(GLuint programID) : id_(programID)
+{
+	slots_.fill(-1);
+	if (!id_)
+		return;
+
+	GLint count = 0;
+	GLint maxLength = 0;
+	GLint location = -1;
+	GLint size = 0;
+	GLenum type = 0;
+
+	glGetProgramiv(id_, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(id_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> name(maxLength + 1);
+	GLint maxLocation = -1;
+	for (GLint i = 0; i < count; ++i)
+	{
+		glGetActiveUniform(id_, i, name.size(), nullptr, &size, &type, name.data());
+		location = glGetUniformLocation(id_, name.data());
+		std::string uniformName(name.data());
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			uniformName.resize(uniformName.size() - 3);
+		uniforms_.push_back(Uniform{uniformName, location, type, size});
+		maxLocation = std::max(maxLocation, location);
+		// The elements don't have to be at consecutive locations, each gets its own entry
+		for (GLint element = 1; location >= 0 && element < size; ++element)
+		{
+			std::string elementName = uniformName + "[" + std::to_string(element) + "]";
+			GLint elementLocation = glGetUniformLocation(id_, elementName.c_str());
+			uniforms_.push_back(Uniform{elementName, elementLocation, type, 1});
+			maxLocation = std::max(maxLocation, elementLocation);
+		}
+	}
+	values_.resize(maxLocation + 1);
+	for (size_t slot = 0; slot < slots_.size(); ++slot)
+		slots_[slot] = uniform(SlotNames[slot]);
+
+	glGetProgramiv(id_, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(id_, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	name.assign(maxLength + 1, '\0');
+	for (GLint i = 0; i < count; ++i)
+	{
+		glGetActiveAttrib(id_, i, name.size(), nullptr, &size, &type, name.data());
+		attributes_.push_back(Attribute{name.data(), glGetAttribLocation(id_, name.data()), type, size});
+	}
+
+	glGetProgramiv(id_, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	glGetProgramiv(id_, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+	name.assign(maxLength + 1, '\0');
+	for (GLint i = 0; i < count; ++i)
+	{
+		GLint dataSize = 0;
+		GLint binding = 0;
+		glGetActiveUniformBlockName(id_, i, name.size(), nullptr, name.data());
+		glGetActiveUniformBlockiv(id_, i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+		glGetActiveUniformBlockiv(id_, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+		blocks_.push_back(UniformBlock{name.data(), static_cast<GLuint>(i), dataSize, binding});
+	}
+}
+
+GLint ShaderProgram::uniform(const char * name) const
+{
+	for (const Uniform & uniform : uniforms_)
+		if (uniform.name == name)
+			return uniform.location;
+	return -1;
+}
+
+GLint ShaderProgram::attribute(const char * name) const
+{
+	for (const Attribute & attribute : attributes_)
+		if (attribute.name == name)
+			return attribute.location;
+	return -1;
+}
+
+GLuint ShaderProgram::uniformBlock(const char * name) const
+{
+	for (const UniformBlock & block : blocks_)
+		if (block.name == name)
+			return block.index;
+	return GL_INVALID_INDEX;
+}
+
+bool ShaderProgram::changed(GLint location, const void * value, size_t size)
+{
+	if (location < 0 || static_cast<size_t>(location) >= values_.size())
+		return false;
+	glState().useProgram(id_);
+	CachedValue & cached = values_[location];
+	if (cached.valid && memcmp(cached.data, value, size) == 0)
+	{
+		++glState().counters().uniformSkips;
+		return false;
+	}
+	memcpy(cached.data, value, size);
+	cached.valid = true;
+	++glState().counters().uniformUploads;
+	return true;
+}
+
+void ShaderProgram::set(GLint location, GLint value)
+{
+	if (changed(location, &value, sizeof(value)))
+		glUniform1i(location, value);
+}
+
+void ShaderProgram::set(GLint location, float value)
+{
+	if (changed(location, &value, sizeof(value)))
+		glUniform1f(location, value);
+}
+
+void ShaderProgram::set(GLint location, const glm::vec2 & value)
+{
+	if (changed(location, &value, sizeof(value)))
+		glUniform2f(location, value.x, value.y);
+}
+
+void ShaderProgram::set(GLint location, const glm::vec3 & value)
+{
+	if (changed(location, &value, sizeof(value)))
+		glUniform3f(location, value.x, value.y, value.z);
+}
+
+void ShaderProgram::set(GLint location, const glm::vec4 & value)
+{
+	if (changed(location, &value, sizeof(value)))
+		glUniform4f(location, value.x, value.y, value.z, value.w);
+}
+
+void ShaderProgram::set(GLint location, const glm::mat4 & value)
+{
+	if (changed(location, &value, sizeof(value)))
+		glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+}
+
+void ShaderProgram::invalidateValues()
+{
+	for (CachedValue & value : values_)
+		value.valid = false;
+}
+
+GLuint ShaderProgram::replace(GLuint programID)
+{
+	ShaderProgram next(programID);
+	for (const Uniform & uniform : uniforms_)
+	{
+		if (uniform.location < 0 || !values_[uniform.location].valid)
+			continue;
+		auto match = std::find_if(next.uniforms_.begin(), next.uniforms_.end(),
+			[&uniform](const Uniform & other) { return other.name == uniform.name && other.type == uniform.type; });
+		if (match == next.uniforms_.end() || match->location < 0)
+			continue;
+		const float * data = values_[uniform.location].data;
+		switch (uniform.type)
+		{
+		case GL_FLOAT:      next.set(match->location, data[0]); break;
+		case GL_FLOAT_VEC2: next.set(match->location, glm::vec2(data[0], data[1])); break;
+		case GL_FLOAT_VEC3: next.set(match->location, glm::vec3(data[0], data[1], data[2])); break;
+		case GL_FLOAT_VEC4: next.set(match->location, glm::vec4(data[0], data[1], data[2], data[3])); break;
+		case GL_FLOAT_MAT4:
+		{
+			glm::mat4 matrix;
+			memcpy(&matrix[0][0], data, sizeof(matrix));
+			next.set(match->location, matrix);
+			break;
+		}
+		default:
+		{
+			// int, bool and the samplers, which set() stores as GLint
+			GLint value;
+			memcpy(&value, data, sizeof(value));
+			next.set(match->location, value);
+			break;
+		}
+		}
+	}
+	std::swap(*this, next);
+	return next.id_;
+}
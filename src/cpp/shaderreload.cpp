@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "glstate.hpp"
+#include "shader.hpp"
+#include "shaderprogram.hpp"
+#include "shaderreload.hpp"
+
+namespace {
+
+// Without inotify the files are checked this often
+const double PollSeconds = 0.5;
+
+std::string fileName(const std::string & path)
+{
+	return std::filesystem::path(path).filename().string();
+}
+
+long long modificationTime(const std::string & path)
+{
+	std::error_code error;
+	return static_cast<long long>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+}
+
+void printLog(GLuint object, bool program)
+{
+	GLint length = 0;
+	program ? glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length) : glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+	if (length <= 1)
+		return;
+	std::vector<char> log(length + 1);
+	program ? glGetProgramInfoLog(object, length, nullptr, log.data()) : glGetShaderInfoLog(object, length, nullptr, log.data());
+	printf("%s\n", log.data());
+}
+
+} // namespace
+
+ShaderReloader::ShaderReloader(GLFWwindow * window, const char * directory)
+	: directory_(directory)
+{
+	if (GLEW_KHR_parallel_shader_compile)
+	{
+		// As many threads as the driver likes
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		parallel_ = true;
+	}
+	else
+	{
+		// GLFW creates windows on the main thread only, the worker just makes the context current
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		context_ = glfwCreateWindow(1, 1, "Shader compiler", nullptr, window);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (context_)
+			worker_ = std::thread(&ShaderReloader::work, this);
+		else
+			printf("No shared context for compiling shaders, edited shaders compile on the render thread\n");
+	}
+
+#ifdef __linux__
+	// Editors either rewrite the file or write another one and rename it over the old
+	inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_ >= 0 && inotify_add_watch(inotify_, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		close(inotify_);
+		inotify_ = -1;
+	}
+#endif
+	printf("Watching %s for shader changes (%s)\n", directory,
+		parallel_ ? "parallel compile" : context_ ? "compiler thread" : "render thread");
+}
+
+ShaderReloader::~ShaderReloader()
+{
+	release();
+}
+
+void ShaderReloader::release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_all();
+	if (worker_.joinable())
+		worker_.join();
+	if (context_)
+		glfwDestroyWindow(context_);
+	context_ = nullptr;
+	// Builds nobody will swap in any more
+	for (Program & program : programs_)
+	{
+		if (program.build)
+			glDeleteProgram(program.build);
+		if (program.vertexShader)
+			glDeleteShader(program.vertexShader);
+		if (program.fragmentShader)
+			glDeleteShader(program.fragmentShader);
+	}
+	programs_.clear();
+	for (const std::pair<size_t, GLuint> & result : results_)
+		glDeleteProgram(result.second);
+	results_.clear();
+#ifdef __linux__
+	if (inotify_ >= 0)
+		close(inotify_);
+#endif
+	inotify_ = -1;
+}
+
+void ShaderReloader::watch(ShaderProgram & program, const char * vertexPath, const char * fragmentPath, const char * defines)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	programs_.push_back(Program{&program, vertexPath, fragmentPath, defines ? defines : "", {}, {}, false, false, 0, 0, 0});
+	track(programs_.back());
+}
+
+void ShaderReloader::track(Program & program)
+{
+	// Only the file names are needed, the defines don't change which files are included
+	std::string source;
+	std::vector<std::string> vertexFiles, fragmentFiles;
+	preprocessShader(program.vertexPath.c_str(), nullptr, source, &vertexFiles);
+	preprocessShader(program.fragmentPath.c_str(), nullptr, source, &fragmentFiles);
+	if (vertexFiles.empty())
+		vertexFiles.push_back(program.vertexPath);
+	if (fragmentFiles.empty())
+		fragmentFiles.push_back(program.fragmentPath);
+	program.files = vertexFiles;
+	program.files.insert(program.files.end(), fragmentFiles.begin(), fragmentFiles.end());
+	program.times.clear();
+	for (const std::string & file : program.files)
+		program.times.push_back(modificationTime(file));
+}
+
+void ShaderReloader::changed(const std::string & name)
+{
+	for (Program & program : programs_)
+	{
+		bool uses = false;
+		for (const std::string & file : program.files)
+			uses = uses || fileName(file) == name;
+		if (!uses)
+			continue;
+		if (program.building)
+			program.changedAgain = true;
+		else
+			start(program);
+	}
+}
+
+void ShaderReloader::start(Program & program)
+{
+	program.building = true;
+	program.changedAgain = false;
+	if (!parallel_)
+	{
+		size_t index = &program - programs_.data();
+		if (!context_)
+		{
+			// No other context: it stalls, but reloading still works
+			std::lock_guard<std::mutex> lock(mutex_);
+			results_.emplace_back(index, LoadShaders(program.vertexPath.c_str(), program.fragmentPath.c_str(), program.defines.c_str()));
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			requests_.push_back(index);
+		}
+		wake_.notify_one();
+		return;
+	}
+
+	// The calls return at once, the driver compiles and links on its threads. Asking for
+	// anything but GL_COMPLETION_STATUS_KHR before it is done would wait for it.
+	std::string vertexSource, fragmentSource;
+	const char * defines = program.defines.c_str();
+	if (!preprocessShader(program.vertexPath.c_str(), defines, vertexSource) || !preprocessShader(program.fragmentPath.c_str(), defines, fragmentSource))
+	{
+		printf("Impossible to read %s or %s with their includes, keeping the old program\n", program.vertexPath.c_str(), program.fragmentPath.c_str());
+		program.building = false;
+		return;
+	}
+	printf("Compiling %s and %s in the background\n", program.vertexPath.c_str(), program.fragmentPath.c_str());
+	const char * sources[2]{vertexSource.c_str(), fragmentSource.c_str()};
+	program.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	program.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(program.vertexShader, 1, &sources[0], nullptr);
+	glShaderSource(program.fragmentShader, 1, &sources[1], nullptr);
+	glCompileShader(program.vertexShader);
+	glCompileShader(program.fragmentShader);
+	program.build = glCreateProgram();
+	glAttachShader(program.build, program.vertexShader);
+	glAttachShader(program.build, program.fragmentShader);
+	glLinkProgram(program.build);
+}
+
+bool ShaderReloader::finished(Program & program, GLuint & build)
+{
+	GLint complete = GL_FALSE;
+	glGetProgramiv(program.build, GL_COMPLETION_STATUS_KHR, &complete);
+	if (!complete)
+		return false;
+	// LoadShaders prints the logs itself, here they are still in the objects
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program.build, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		printLog(program.vertexShader, false);
+		printLog(program.fragmentShader, false);
+		printLog(program.build, true);
+	}
+	glDetachShader(program.build, program.vertexShader);
+	glDetachShader(program.build, program.fragmentShader);
+	glDeleteShader(program.vertexShader);
+	glDeleteShader(program.fragmentShader);
+	program.vertexShader = program.fragmentShader = 0;
+	build = program.build;
+	program.build = 0;
+	return true;
+}
+
+bool ShaderReloader::swap(Program & program, GLuint build)
+{
+	program.building = false;
+	// The edit may have added or removed an #include. Without a build the files couldn't
+	// be read, then they stay as they were, the one with the broken #include is among them.
+	if (build)
+		track(program);
+	GLint linked = GL_FALSE;
+	if (build)
+		glGetProgramiv(build, GL_LINK_STATUS, &linked);
+	bool swapped = linked == GL_TRUE;
+	if (swapped)
+	{
+		glDeleteProgram(program.program->replace(build));
+		// The deleted name can come back from glCreateProgram, the shadow copy must not think it is bound
+		glState().invalidate();
+		printf("Reloaded %s and %s\n", program.vertexPath.c_str(), program.fragmentPath.c_str());
+	}
+	else
+	{
+		if (build)
+			glDeleteProgram(build);
+		printf("%s and %s don't link, keeping the old program\n", program.vertexPath.c_str(), program.fragmentPath.c_str());
+	}
+	if (program.changedAgain)
+		start(program);
+	return swapped;
+}
+
+void ShaderReloader::work()
+{
+	glfwMakeContextCurrent(context_);
+	for (;;)
+	{
+		size_t index;
+		std::string vertexPath, fragmentPath, defines;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+			if (stopping_)
+				break;
+			index = requests_.front();
+			requests_.pop_front();
+			vertexPath = programs_[index].vertexPath;
+			fragmentPath = programs_[index].fragmentPath;
+			defines = programs_[index].defines;
+		}
+		GLuint build = LoadShaders(vertexPath.c_str(), fragmentPath.c_str(), defines.c_str());
+		// The render thread may only use the program once this context is done with it
+		glFinish();
+		std::lock_guard<std::mutex> lock(mutex_);
+		results_.emplace_back(index, build);
+	}
+	glfwMakeContextCurrent(nullptr);
+}
+
+unsigned int ShaderReloader::update()
+{
+#ifdef __linux__
+	if (inotify_ >= 0)
+	{
+		alignas(inotify_event) char buffer[4096];
+		ssize_t size;
+		while ((size = read(inotify_, buffer, sizeof(buffer))) > 0)
+		{
+			for (char * next = buffer; next < buffer + size;)
+			{
+				const inotify_event * event = reinterpret_cast<const inotify_event *>(next);
+				if (event->len)
+					changed(event->name);
+				next += sizeof(inotify_event) + event->len;
+			}
+		}
+	}
+	else
+#endif
+	if (glfwGetTime() - lastPoll_ > PollSeconds)
+	{
+		lastPoll_ = glfwGetTime();
+		std::vector<std::string> names;
+		for (Program & program : programs_)
+		{
+			for (size_t i = 0; i < program.files.size(); ++i)
+			{
+				long long time = modificationTime(program.files[i]);
+				if (time != program.times[i])
+				{
+					program.times[i] = time;
+					std::string name = fileName(program.files[i]);
+					// Files several programs use only once, or the second would build them again
+					if (std::find(names.begin(), names.end(), name) == names.end())
+						names.push_back(name);
+				}
+			}
+		}
+		// After the loop, starting a build can change the files
+		for (const std::string & name : names)
+			changed(name);
+	}
+
+	unsigned int swapped = 0;
+	if (parallel_)
+	{
+		for (Program & program : programs_)
+		{
+			GLuint build;
+			if (program.build && finished(program, build))
+				swapped += swap(program, build);
+		}
+		return swapped;
+	}
+	std::deque<std::pair<size_t, GLuint>> results;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		results.swap(results_);
+	}
+	for (const std::pair<size_t, GLuint> & result : results)
+		swapped += swap(programs_[result.first], result.second);
+	return swapped;
+}
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "meshoptimizer.hpp"
+#include "simplify.hpp"
+
+namespace {
+
+// Borders get a plane perpendicular to the border triangle, so they only shrink along themselves
+const double BorderWeight = 10.0;
+// Attribute distance (uv and normal, squared) relative to squared geometric error, which is relative to the mesh size
+const float AttributeWeight = 0.01f;
+// Collapses that turn a triangle further than this (cosine between old and new normal) are rejected
+const float MinNormalCos = 0.2f;
+// Levels with fewer triangles than this are not worth it
+const size_t MinLODTriangles = 64;
+
+// Sum of squared distances to a set of planes, weighted
+struct Quadric
+{
+	double a2{0}, ab{0}, ac{0}, ad{0}, b2{0}, bc{0}, bd{0}, c2{0}, cd{0}, d2{0};
+	double weight{0};
+
+	void addPlane(const glm::vec3 & normal, float distance, double planeWeight)
+	{
+		double a{normal.x}, b{normal.y}, c{normal.z}, d{distance};
+		a2 += planeWeight * a * a; ab += planeWeight * a * b; ac += planeWeight * a * c; ad += planeWeight * a * d;
+		b2 += planeWeight * b * b; bc += planeWeight * b * c; bd += planeWeight * b * d;
+		c2 += planeWeight * c * c; cd += planeWeight * c * d;
+		d2 += planeWeight * d * d;
+		weight += planeWeight;
+	}
+	void add(const Quadric & q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd; d2 += q.d2; weight += q.weight;
+	}
+	// Weighted mean of the squared distances
+	double error(const glm::vec3 & p) const
+	{
+		double x{p.x}, y{p.y}, z{p.z};
+		double sum{a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2};
+		return weight > 0 ? std::max(sum, 0.0) / weight : 0.0;
+	}
+};
+
+struct Collapse
+{
+	float cost;
+	float error; // geometric part of the cost
+	uint32_t from, to;
+	uint32_t fromVersion, toVersion;
+
+	bool operator>(const Collapse & other) const { return cost > other.cost; }
+};
+
+// The simplifier works on positions: all vertices (wedges) with the same position form one group
+class Simplifier
+{
+public:
+	Simplifier(const std::vector<unsigned int> & indices,
+		const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount)
+		: vertices_(vertices), uvs_(uvs), normals_(normals), corners_(indices)
+	{
+		groupPositions(vertexCount);
+		// Positions relative to the mesh size, so the weights don't depend on its units
+		glm::vec3 low{vertices[0]}, high{low};
+		for (size_t v = 1; v < vertexCount; ++v)
+		{
+			low = glm::min(low, vertices[v]);
+			high = glm::max(high, vertices[v]);
+		}
+		scale_ = glm::length(high - low);
+		if (scale_ <= 0.0f)
+			scale_ = 1.0f;
+		origin_ = low;
+
+		size_t triangleCount{corners_.size() / 3};
+		alive_.assign(triangleCount, 1);
+		aliveCount_ = triangleCount;
+		adjacency_.resize(groupCount_);
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			uint32_t g0{groupOf(corners_[3 * t])}, g1{groupOf(corners_[3 * t + 1])}, g2{groupOf(corners_[3 * t + 2])};
+			if (g0 == g1 || g1 == g2 || g0 == g2)
+			{
+				alive_[t] = 0;
+				--aliveCount_;
+				continue;
+			}
+			for (int k = 0; k < 3; ++k)
+				adjacency_[groupOf(corners_[3 * t + k])].push_back(uint32_t(t));
+		}
+		computeQuadrics();
+	}
+
+	std::vector<unsigned int> run(size_t targetIndexCount, float & error)
+	{
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+		version_.assign(groupCount_, 0);
+		removed_.assign(groupCount_, 0);
+		for (uint32_t g = 0; g < groupCount_; ++g)
+			pushCollapses(queue, g);
+
+		double maxError{0.0};
+		while (aliveCount_ * 3 > targetIndexCount && !queue.empty())
+		{
+			Collapse collapse{queue.top()};
+			queue.pop();
+			if (removed_[collapse.from] || removed_[collapse.to]
+				|| version_[collapse.from] != collapse.fromVersion || version_[collapse.to] != collapse.toVersion)
+				continue;
+			if (!canCollapse(collapse.from, collapse.to))
+				continue;
+			apply(collapse.from, collapse.to);
+			maxError = std::max(maxError, double(collapse.error));
+			pushCollapses(queue, collapse.to);
+		}
+		error = float(std::sqrt(maxError)) * scale_;
+
+		std::vector<unsigned int> result;
+		result.reserve(aliveCount_ * 3);
+		for (size_t t = 0; t < alive_.size(); ++t)
+			if (alive_[t])
+				result.insert(result.end(), &corners_[3 * t], &corners_[3 * t] + 3);
+		return result;
+	}
+
+private:
+	glm::vec3 position(uint32_t group) const { return (vertices_[wedges_[wedgeStart_[group]]] - origin_) / scale_; }
+	uint32_t groupOf(unsigned int vertex) const { return group_[vertex]; }
+
+	void groupPositions(size_t vertexCount)
+	{
+		std::vector<unsigned int> sorted(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+			sorted[v] = unsigned(v);
+		auto less{[this](unsigned int a, unsigned int b) {
+			const glm::vec3 & p{vertices_[a]}, & q{vertices_[b]};
+			if (p.x != q.x) return p.x < q.x;
+			if (p.y != q.y) return p.y < q.y;
+			return p.z < q.z;
+		}};
+		std::sort(sorted.begin(), sorted.end(), less);
+		group_.resize(vertexCount);
+		groupCount_ = 0;
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			if (i == 0 || vertices_[sorted[i]] != vertices_[sorted[i - 1]])
+			{
+				wedgeStart_.push_back(uint32_t(i));
+				++groupCount_;
+			}
+			group_[sorted[i]] = groupCount_ - 1;
+		}
+		wedgeStart_.push_back(uint32_t(vertexCount));
+		wedges_.assign(sorted.begin(), sorted.end());
+	}
+
+	void computeQuadrics()
+	{
+		quadrics_.assign(groupCount_, Quadric{});
+		// Edges used by one triangle only are borders, found by sorting the directed edges
+		std::vector<std::pair<uint64_t, uint32_t>> edges; // (lower group << 32 | higher group, triangle)
+		for (size_t t = 0; t < alive_.size(); ++t)
+		{
+			if (!alive_[t])
+				continue;
+			uint32_t g[3]{groupOf(corners_[3 * t]), groupOf(corners_[3 * t + 1]), groupOf(corners_[3 * t + 2])};
+			glm::vec3 p0{position(g[0])}, p1{position(g[1])}, p2{position(g[2])};
+			glm::vec3 normal{glm::cross(p1 - p0, p2 - p0)};
+			float length{glm::length(normal)};
+			if (length <= 0.0f)
+				continue;
+			normal /= length;
+			double area{0.5 * length};
+			for (int k = 0; k < 3; ++k)
+				quadrics_[g[k]].addPlane(normal, -glm::dot(normal, p0), area);
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t a{g[k]}, b{g[(k + 1) % 3]};
+				edges.push_back({(uint64_t(std::min(a, b)) << 32) | std::max(a, b), uint32_t(t)});
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size(); ++i)
+		{
+			bool shared{(i > 0 && edges[i - 1].first == edges[i].first) || (i + 1 < edges.size() && edges[i + 1].first == edges[i].first)};
+			if (shared)
+				continue;
+			uint32_t a{uint32_t(edges[i].first >> 32)}, b{uint32_t(edges[i].first & 0xffffffffu)};
+			size_t t{edges[i].second};
+			glm::vec3 p0{position(groupOf(corners_[3 * t]))}, p1{position(groupOf(corners_[3 * t + 1]))}, p2{position(groupOf(corners_[3 * t + 2]))};
+			glm::vec3 faceNormal{glm::normalize(glm::cross(p1 - p0, p2 - p0))};
+			glm::vec3 edge{position(b) - position(a)};
+			glm::vec3 normal{glm::cross(edge, faceNormal)};
+			float length{glm::length(normal)};
+			if (length <= 0.0f)
+				continue;
+			normal /= length;
+			double weight{BorderWeight * glm::dot(edge, edge)};
+			quadrics_[a].addPlane(normal, -glm::dot(normal, position(a)), weight);
+			quadrics_[b].addPlane(normal, -glm::dot(normal, position(a)), weight);
+		}
+	}
+
+	float attributeDistance(unsigned int a, unsigned int b) const
+	{
+		glm::vec2 uv{uvs_[a] - uvs_[b]};
+		glm::vec3 normal{normals_[a] - normals_[b]};
+		return glm::dot(uv, uv) + glm::dot(normal, normal);
+	}
+
+	// Vertex of group to that each vertex of group from becomes, and the worst attribute distance
+	float mapWedges(uint32_t from, uint32_t to, std::vector<std::pair<unsigned int, unsigned int>> * mapping) const
+	{
+		float worst{0.0f};
+		for (uint32_t i = wedgeStart_[from]; i < wedgeStart_[from + 1]; ++i)
+		{
+			unsigned int wedge{wedges_[i]};
+			unsigned int best{wedges_[wedgeStart_[to]]};
+			float bestDistance{attributeDistance(wedge, best)};
+			for (uint32_t j = wedgeStart_[to] + 1; j < wedgeStart_[to + 1]; ++j)
+			{
+				float distance{attributeDistance(wedge, wedges_[j])};
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = wedges_[j];
+				}
+			}
+			worst = std::max(worst, bestDistance);
+			if (mapping)
+				mapping->push_back({wedge, best});
+		}
+		return worst;
+	}
+
+	template <typename Queue>
+	void pushCollapses(Queue & queue, uint32_t group)
+	{
+		for (uint32_t t : adjacency_[group])
+		{
+			if (!alive_[t])
+				continue;
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t other{groupOf(corners_[3 * t + k])};
+				if (other == group)
+					continue;
+				// Both directions, the cheaper one goes into the queue
+				Quadric sum{quadrics_[group]};
+				sum.add(quadrics_[other]);
+				float toOther{float(sum.error(position(other)))};
+				float toGroup{float(sum.error(position(group)))};
+				float costToOther{toOther + AttributeWeight * mapWedges(group, other, nullptr)};
+				float costToGroup{toGroup + AttributeWeight * mapWedges(other, group, nullptr)};
+				if (costToOther <= costToGroup)
+					queue.push(Collapse{costToOther, toOther, group, other, version_[group], version_[other]});
+				else
+					queue.push(Collapse{costToGroup, toGroup, other, group, version_[other], version_[group]});
+			}
+		}
+	}
+
+	// Rejects collapses that fold triangles over or that would glue two surfaces together
+	bool canCollapse(uint32_t from, uint32_t to)
+	{
+		glm::vec3 target{position(to)};
+		std::vector<uint32_t> & fromNeighbours{neighbours_[0]};
+		std::vector<uint32_t> & toNeighbours{neighbours_[1]};
+		fromNeighbours.clear();
+		toNeighbours.clear();
+		size_t shared{0};
+		for (uint32_t t : adjacency_[from])
+		{
+			if (!alive_[t])
+				continue;
+			uint32_t g[3]{groupOf(corners_[3 * t]), groupOf(corners_[3 * t + 1]), groupOf(corners_[3 * t + 2])};
+			if (g[0] == to || g[1] == to || g[2] == to)
+			{
+				++shared;
+				continue;
+			}
+			glm::vec3 p[3]{position(g[0]), position(g[1]), position(g[2])};
+			glm::vec3 before{glm::cross(p[1] - p[0], p[2] - p[0])};
+			for (int k = 0; k < 3; ++k)
+			{
+				if (g[k] == from)
+					p[k] = target;
+				else
+					fromNeighbours.push_back(g[k]);
+			}
+			glm::vec3 after{glm::cross(p[1] - p[0], p[2] - p[0])};
+			float lengths{glm::length(before) * glm::length(after)};
+			if (lengths <= 0.0f || glm::dot(before, after) < MinNormalCos * lengths)
+				return false;
+		}
+		for (uint32_t t : adjacency_[to])
+			if (alive_[t])
+				for (int k = 0; k < 3; ++k)
+					toNeighbours.push_back(groupOf(corners_[3 * t + k]));
+
+		// Link condition: the two may only have the neighbours in common that share a triangle with both
+		std::sort(fromNeighbours.begin(), fromNeighbours.end());
+		fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+		std::sort(toNeighbours.begin(), toNeighbours.end());
+		toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+		size_t common{0};
+		for (uint32_t g : fromNeighbours)
+			if (g != to && std::binary_search(toNeighbours.begin(), toNeighbours.end(), g))
+				++common;
+		// Around a manifold edge these are the far corners of the triangles on the edge, one each
+		return common <= shared;
+	}
+
+	void apply(uint32_t from, uint32_t to)
+	{
+		std::vector<std::pair<unsigned int, unsigned int>> mapping;
+		mapWedges(from, to, &mapping);
+		for (uint32_t t : adjacency_[from])
+		{
+			if (!alive_[t])
+				continue;
+			bool degenerate{false};
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int & corner{corners_[3 * t + k]};
+				uint32_t group{groupOf(corner)};
+				if (group == to)
+					degenerate = true;
+				else if (group == from)
+					for (const std::pair<unsigned int, unsigned int> & map : mapping)
+						if (map.first == corner)
+						{
+							corner = map.second;
+							break;
+						}
+			}
+			if (degenerate)
+			{
+				alive_[t] = 0;
+				--aliveCount_;
+			}
+			else
+				adjacency_[to].push_back(t);
+		}
+		adjacency_[from].clear();
+		quadrics_[to].add(quadrics_[from]);
+		removed_[from] = 1;
+		++version_[to];
+
+		// Drop dead triangles now and then, so the lists don't keep growing
+		std::vector<uint32_t> & list{adjacency_[to]};
+		list.erase(std::remove_if(list.begin(), list.end(), [this](uint32_t t) { return !alive_[t]; }), list.end());
+	}
+
+	const glm::vec3 * vertices_;
+	const glm::vec2 * uvs_;
+	const glm::vec3 * normals_;
+	std::vector<unsigned int> corners_;
+	glm::vec3 origin_{0.0f};
+	float scale_{1.0f};
+
+	uint32_t groupCount_{0};
+	std::vector<uint32_t> group_;      // per vertex
+	std::vector<uint32_t> wedgeStart_; // per group, into wedges_
+	std::vector<unsigned int> wedges_; // vertices sorted by group
+	std::vector<Quadric> quadrics_;
+	std::vector<std::vector<uint32_t>> adjacency_; // triangles per group
+	std::vector<uint32_t> version_;
+	std::vector<uint8_t> removed_;
+	std::vector<uint8_t> alive_;
+	size_t aliveCount_{0};
+	std::vector<uint32_t> neighbours_[2];
+};
+
+} // namespace
+
+std::vector<unsigned int> simplifyMesh(const std::vector<unsigned int> & indices,
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	size_t targetIndexCount, float & error)
+{
+	error = 0.0f;
+	if (indices.empty() || !vertexCount)
+		return indices;
+	Simplifier simplifier(indices, vertices, uvs, normals, vertexCount);
+	return simplifier.run(targetIndexCount, error);
+}
+
+void buildLODChain(std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices, const std::vector<glm::vec2> & uvs, const std::vector<glm::vec3> & normals,
+	std::vector<MeshLOD> & lods)
+{
+	lods.clear();
+	lods.push_back(MeshLOD{0, unsigned(indices.size()), 0.0f});
+	std::vector<unsigned int> level(indices);
+	float error{0.0f};
+	while (lods.size() < MaxLODLevels && level.size() / 3 >= 2 * MinLODTriangles)
+	{
+		float levelError;
+		std::vector<unsigned int> coarser{simplifyMesh(level, vertices.data(), uvs.data(), normals.data(), vertices.size(),
+			level.size() / 2, levelError)};
+		// Stuck on borders or flips, another level would look the same
+		if (coarser.size() > level.size() * 9 / 10)
+			break;
+		optimizeVertexCache(coarser, vertices.size());
+		// Each level is simplified from the one before, so the errors add up
+		error += levelError;
+		lods.push_back(MeshLOD{unsigned(indices.size()), unsigned(coarser.size()), error});
+		indices.insert(indices.end(), coarser.begin(), coarser.end());
+		level.swap(coarser);
+	}
+
+	printf("LOD chain:");
+	for (const MeshLOD & lod : lods)
+		printf(" %u", lod.indexCount / 3);
+	printf(" triangles, error %.4g\n", lods.back().error);
+}
+
+size_t selectLOD(const std::vector<MeshLOD> & lods, float distance, float scale, float pixelsPerUnit, float maxPixelError)
+{
+	size_t level{0};
+	if (distance <= 0.0f)
+		return level;
+	for (size_t i = 1; i < lods.size(); ++i)
+		if (lods[i].error * scale * pixelsPerUnit / distance <= maxPixelError)
+			level = i;
+	return level;
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include "simulation.hpp"
+
+namespace {
+
+// Per second while a key is held, about what the key repeat used to give with its fixed steps per event
+const float MoveSpeed = 2.5f;
+const float RotateSpeed = 2.5f;
+const float RobotSpeed = 1.25f;
+
+} // namespace
+
+Simulation::Simulation(const SimulationState & initial)
+	: start_(Clock::now()), initial_(initial)
+{
+	// Something to sample before the first tick. The thread doesn't run yet, this is the writer until it does.
+	frames_.back() = Frame{initial, initial, 0};
+	frames_.publish();
+	thread_ = std::thread(&Simulation::run, this);
+}
+
+Simulation::~Simulation()
+{
+	stop();
+}
+
+void Simulation::stop()
+{
+	stopping_ = true;
+	if (thread_.joinable())
+		thread_.join();
+	stats_.droppedEvents = droppedEvents_;
+}
+
+bool Simulation::post(const InputEvent & event)
+{
+	if (input_.push(event))
+		return true;
+	++droppedEvents_;
+	return false;
+}
+
+SimulationState Simulation::sample()
+{
+	frames_.update();
+	const Frame & frame = frames_.front();
+	// One tick behind now lies between the two states, unless the simulation is late
+	double ticks = std::chrono::duration<double>(Clock::now() - start_).count() / TickSeconds;
+	float t = float(std::clamp(ticks - double(frame.tick), 0.0, 1.0));
+	SimulationState state;
+	state.position = glm::mix(frame.previous.position, frame.current.position, t);
+	state.angle = glm::mix(frame.previous.angle, frame.current.angle, t);
+	state.robotModules = glm::mix(frame.previous.robotModules, frame.current.robotModules, t);
+	return state;
+}
+
+void Simulation::run()
+{
+	Frame frame{initial_, initial_, 0};
+	while (!stopping_.load(std::memory_order_relaxed))
+	{
+		// Tick n is the state at n * TickSeconds after the start
+		uint64_t due = uint64_t(std::chrono::duration<double>(Clock::now() - start_).count() / TickSeconds);
+		if (due > frame.tick + MaxCatchUpTicks)
+		{
+			stats_.skippedTicks += due - 1 - frame.tick;
+			frame.tick = due - 1;
+		}
+		if (due > frame.tick)
+		{
+			while (frame.tick < due)
+			{
+				InputEvent event;
+				while (input_.pop(event))
+				{
+					apply(event);
+					++stats_.events;
+				}
+				frame.previous = frame.current;
+				step(frame.current);
+				++frame.tick;
+				++stats_.ticks;
+			}
+			frames_.back() = frame;
+			frames_.publish();
+		}
+		std::this_thread::sleep_until(start_ + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((frame.tick + 1) * TickSeconds)));
+	}
+}
+
+void Simulation::apply(const InputEvent & event)
+{
+	uint32_t bit = 1u << unsigned(event.control);
+	held_ = event.pressed ? held_ | bit : held_ & ~bit;
+	if (event.control == Control::BendJoint && event.pressed)
+		bending_ = event.module;
+}
+
+void Simulation::step(SimulationState & state) const
+{
+	const float seconds = float(TickSeconds);
+	auto held = [this](Control control) { return float((held_ >> unsigned(control)) & 1u); };
+	state.position.x += MoveSpeed * seconds * (held(Control::MoveLeft) - held(Control::MoveRight));
+	state.position.y += MoveSpeed * seconds * (held(Control::MoveUp) - held(Control::MoveDown));
+	state.position.z += MoveSpeed * seconds * (held(Control::MoveAway) - held(Control::MoveCloser));
+	state.angle.x += RotateSpeed * seconds * held(Control::RotateX);
+	state.angle.y += RotateSpeed * seconds * held(Control::RotateY);
+	state.angle.z += RotateSpeed * seconds * held(Control::RotateZ);
+	state.robotModules.w += RobotSpeed * seconds * held(Control::TurnRobot);
+	if (bending_ >= 1 && bending_ <= 3)
+		state.robotModules[bending_ - 1] += RobotSpeed * seconds * held(Control::BendJoint);
+}
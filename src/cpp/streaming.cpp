@@ -0,0 +1,543 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+#include "mappedfile.hpp"
+#include "meshcache.hpp"
+#include "objloader.hpp"
+#include "procedural.hpp"
+#include "streaming.hpp"
+#include "texture.hpp"
+
+// Staged copies start at multiples of this, whatever the chunk before them ended on
+static const size_t StagingAlignment = 16;
+
+// One mipmap level of a streamed texture, all levels follow each other in its pixels.
+// A row is a row of pixels, or a row of 4 x 4 blocks for block compressed levels.
+struct MipLevel
+{
+	unsigned int width, height;
+	size_t offset;
+	size_t rowSize;
+	unsigned int rows;
+};
+
+// BGR rows padded to 4 bytes, like the BMP file and GL_UNPACK_ALIGNMENT
+static size_t rowSizeOf(unsigned int width)
+{
+	return (size_t(width) * 3 + 3) & ~size_t(3);
+}
+
+// Box filtered levels down to 1 x 1, appended to the pixels of level 0. They are made on the
+// worker thread, glGenerateMipmap on the render thread can take long enough to drop frames.
+static void buildMipmaps(std::vector<unsigned char> & pixels, unsigned int width, unsigned int height, std::vector<MipLevel> & levels)
+{
+	levels.push_back(MipLevel{width, height, 0, rowSizeOf(width), height});
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		MipLevel source = levels.back();
+		MipLevel level{std::max(source.width / 2, 1u), std::max(source.height / 2, 1u), pixels.size(), 0, 0};
+		level.rowSize = rowSizeOf(level.width);
+		level.rows = level.height;
+		pixels.resize(level.offset + level.rowSize * level.height);
+		for (unsigned int y = 0; y < level.height; ++y)
+		{
+			const unsigned char * row0 = pixels.data() + source.offset + std::min(2 * y, source.height - 1) * source.rowSize;
+			const unsigned char * row1 = pixels.data() + source.offset + std::min(2 * y + 1, source.height - 1) * source.rowSize;
+			unsigned char * target = pixels.data() + level.offset + y * level.rowSize;
+			for (unsigned int x = 0; x < level.width; ++x)
+			{
+				size_t x0 = std::min(2 * x, source.width - 1) * 3;
+				size_t x1 = std::min(2 * x + 1, source.width - 1) * 3;
+				for (int c = 0; c < 3; ++c)
+					target[x * 3 + c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+			}
+		}
+		levels.push_back(level);
+	}
+}
+
+static bool isDDS(const std::string & path)
+{
+	const char extension[] = ".dds";
+	if (path.size() < 4)
+		return false;
+	for (size_t i = 0; i < 4; ++i)
+		if (std::tolower(static_cast<unsigned char>(path[path.size() - 4 + i])) != extension[i])
+			return false;
+	return true;
+}
+
+// Copies the levels of a 2D DDS file out of the mapping, they are uploaded as they are. Cube maps
+// and arrays have their layers apart in the file and aren't streamed, loadDDSTexture takes them.
+static bool readDDSLevels(const char * path, std::vector<unsigned char> & data, GLenum & format, std::vector<MipLevel> & levels)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		printf("%s could not be opened\n", path);
+		return false;
+	}
+	DDSLayout layout;
+	if (!parseDDS(file.data(), file.size(), layout) || layout.layers > 1 || !ddsFormatSupported(layout.format))
+	{
+		printf("%s is not a 2D DDS file with a format this GL has\n", path);
+		return false;
+	}
+	format = layout.format;
+	for (unsigned int i = 0; i < layout.levels; ++i)
+	{
+		MipLevel level{std::max(layout.width >> i, 1u), std::max(layout.height >> i, 1u), data.size(), 0, 0};
+		level.rowSize = (level.width + 3) / 4 * layout.blockBytes;
+		level.rows = (level.height + 3) / 4;
+		const char * source = file.data() + layout.levelOffset(0, i);
+		data.insert(data.end(), source, source + layout.levelSize(i));
+		levels.push_back(level);
+	}
+	return true;
+}
+
+struct StreamingLoader::Resource
+{
+	enum class Kind
+	{
+		Texture,
+		Mesh
+	};
+
+	Kind kind;
+	std::string path;
+	std::function<void(const MeshCache &)> onLoaded;
+	std::chrono::steady_clock::time_point requested;
+
+	// Written by the worker, read by the render thread once the resource is in loaded_
+	bool failed{false};
+	BitmapImage image; // all mipmap levels
+	GLenum format{0};  // compressed format of a DDS file, 0 for the BGR pixels of a BMP file
+	std::vector<MipLevel> levels;
+	PreparedMesh prepared;
+	std::vector<unsigned int> indices;
+
+	// Render thread
+	size_t size{0};     // bytes to stream: rows of pixels, or the vertices followed by the indices
+	size_t uploaded{0};
+	bool ready{false};
+	GLuint texture{0};
+	MeshBuffers mesh;
+};
+
+StreamingLoader::StreamingLoader(unsigned int threads, size_t stagingBytes)
+	: stagingBytes_(stagingBytes)
+{
+	glGenBuffers(1, &staging_);
+	glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+	size_t total = FramesInFlight * stagingBytes_;
+	if (GLEW_ARB_buffer_storage)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_READ_BUFFER, total, nullptr, flags);
+		persistent_ = static_cast<unsigned char *>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, total, flags));
+	}
+	else
+	{
+		glBufferData(GL_COPY_READ_BUFFER, total, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	// Grey checker, noticeable without being loud
+	const unsigned char checker[2 * 2 * 4]{96, 96, 96, 255, 160, 160, 160, 255, 160, 160, 160, 255, 96, 96, 96, 255};
+	glGenTextures(1, &placeholderTexture_);
+	glState().bindTexture(GL_TEXTURE_2D, placeholderTexture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	ShapeMesh sphere{generateShape(icosphereShape(1))};
+	VertexQuantization quantization{};
+	quantization.allowPacked = false;
+	placeholderMesh_ = uploadMesh(sphere.indices.data(), sphere.indices.size(),
+		sphere.positions.data(), sphere.uvs.data(), sphere.normals.data(), sphere.positions.size(), quantization);
+
+	for (unsigned int i = 0; i < std::max(threads, 1u); ++i)
+		workers_.emplace_back(&StreamingLoader::work, this);
+}
+
+StreamingLoader::~StreamingLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_all();
+	for (std::thread & worker : workers_)
+		worker.join();
+}
+
+StreamingLoader::Handle StreamingLoader::requestTexture(const char * path)
+{
+	std::unique_ptr<Resource> resource{new Resource{}};
+	resource->kind = Resource::Kind::Texture;
+	resource->path = path;
+	resource->requested = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_.push_back(resource.get());
+	}
+	wake_.notify_one();
+	resources_.push_back(std::move(resource));
+	return resources_.size() - 1;
+}
+
+StreamingLoader::Handle StreamingLoader::requestMesh(const char * path, std::function<void(const MeshCache &)> onLoaded)
+{
+	std::unique_ptr<Resource> resource{new Resource{}};
+	resource->kind = Resource::Kind::Mesh;
+	resource->path = path;
+	resource->onLoaded = std::move(onLoaded);
+	resource->requested = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_.push_back(resource.get());
+	}
+	wake_.notify_one();
+	resources_.push_back(std::move(resource));
+	return resources_.size() - 1;
+}
+
+void StreamingLoader::work()
+{
+	for (;;)
+	{
+		Resource * resource;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+			if (stopping_)
+				return;
+			resource = pending_.front();
+			pending_.pop_front();
+		}
+		load(*resource);
+		std::lock_guard<std::mutex> lock(mutex_);
+		loaded_.push_back(resource);
+	}
+}
+
+void StreamingLoader::load(Resource & resource)
+{
+	if (resource.kind == Resource::Kind::Texture)
+	{
+		if (isDDS(resource.path))
+			resource.failed = !readDDSLevels(resource.path.c_str(), resource.image.data, resource.format, resource.levels);
+		else
+		{
+			resource.failed = !decodeBMP(resource.path.c_str(), resource.image);
+			if (!resource.failed)
+				buildMipmaps(resource.image.data, resource.image.width, resource.image.height, resource.levels);
+		}
+		// Rows are staged whole, one has to fit the staging buffer. A smaller budget lets it through alone.
+		if (!resource.failed && resource.levels[0].rowSize > stagingBytes_)
+		{
+			printf("%s has rows larger than the staging buffer\n", resource.path.c_str());
+			resource.failed = true;
+		}
+		return;
+	}
+
+	MeshCache cache;
+	if (!loadOBJCached(resource.path.c_str(), cache))
+	{
+		resource.failed = true;
+		return;
+	}
+	resource.prepared = prepareMesh(cache.indexCount(),
+		cache.vertices(), cache.uvs(), cache.normals(), cache.vertexCount(), VertexQuantization{}, cache.lods());
+	resource.indices.assign(cache.indices(), cache.indices() + resource.prepared.indexBufferCount);
+	if (resource.onLoaded)
+		resource.onLoaded(cache);
+	cache.close();
+}
+
+void StreamingLoader::update(size_t budgetBytes)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (Resource * resource : loaded_)
+		{
+			if (resource->kind == Resource::Kind::Texture)
+				resource->size = resource->image.data.size();
+			else
+				resource->size = resource->prepared.vertexData.size() + resource->indices.size() * sizeof(unsigned int);
+			uploading_.push_back(resource);
+		}
+		loaded_.clear();
+	}
+	if (uploading_.empty())
+		return;
+
+	// The GPU may still read what was staged in this part FramesInFlight uploads ago, then this frame uploads nothing
+	size_t part = frame_ % FramesInFlight;
+	if (fences_[part])
+	{
+		if (glClientWaitSync(fences_[part], 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			++stats_.waitFrames;
+			return;
+		}
+		glDeleteSync(fences_[part]);
+		fences_[part] = 0;
+	}
+
+	size_t base = part * stagingBytes_;
+	glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+	unsigned char * staging = persistent_ ? persistent_ + base : static_cast<unsigned char *>(glMapBufferRange(
+		GL_COPY_READ_BUFFER, base, stagingBytes_, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if (!staging)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		return;
+	}
+
+	size_t budget = std::min(budgetBytes, stagingBytes_);
+	size_t used = 0;
+	std::vector<Copy> copies;
+	for (Resource * resource : uploading_)
+		if (!stage(*resource, staging, used, budget, copies))
+			break;
+	if (!persistent_)
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+
+	for (Copy & copy : copies)
+	{
+		copy.stagingOffset += base;
+		issue(copy);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	if (!copies.empty())
+	{
+		fences_[part] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		++frame_;
+		++stats_.uploadFrames;
+		stats_.bytes += used;
+		stats_.maxFrameBytes = std::max(stats_.maxFrameBytes, used);
+	}
+
+	// Resources are staged in order, so the complete ones are at the front
+	while (!uploading_.empty() && (uploading_.front()->failed || uploading_.front()->uploaded == uploading_.front()->size))
+	{
+		finish(*uploading_.front());
+		uploading_.pop_front();
+	}
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	stats_.maxUpdateMilliseconds = std::max(stats_.maxUpdateMilliseconds, milliseconds);
+}
+
+// Copies the next chunk of the resource into the staging memory, returns false once the budget is used up
+bool StreamingLoader::stage(Resource & resource, unsigned char * staging, size_t & used, size_t budget, std::vector<Copy> & copies)
+{
+	if (resource.failed || resource.uploaded == resource.size)
+		return true;
+	used = std::min((used + StagingAlignment - 1) / StagingAlignment * StagingAlignment, budget);
+	size_t size = std::min(budget - used, resource.size - resource.uploaded);
+
+	if (resource.kind == Resource::Kind::Texture)
+	{
+		if (!resource.texture)
+		{
+			glGenTextures(1, &resource.texture);
+			glState().bindTexture(GL_TEXTURE_2D, resource.texture);
+			for (size_t i = 0; i < resource.levels.size(); ++i)
+			{
+				const MipLevel & level = resource.levels[i];
+				if (resource.format)
+					glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), resource.format, level.width, level.height, 0, GLsizei(level.rowSize * level.rows), nullptr);
+				else
+					glTexImage2D(GL_TEXTURE_2D, GLint(i), GL_RGB, level.width, level.height, 0, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(resource.levels.size() - 1));
+		}
+		// Whole rows of one level per copy, glTexSubImage2D takes rectangles
+		size = 0;
+		for (const MipLevel & level : resource.levels)
+		{
+			size_t offset = resource.uploaded + size;
+			size_t levelEnd = level.offset + level.rowSize * level.rows;
+			if (offset >= levelEnd)
+				continue;
+			// The level before ran out of budget
+			if (offset < level.offset)
+				break;
+			size_t rows = std::min((budget - used - size) / level.rowSize, (levelEnd - offset) / level.rowSize);
+			if (rows == 0)
+			{
+				// A row larger than the budget goes alone in a frame, it still fits the staging buffer (see load).
+				// Waiting for more budget would hold it and everything queued after it back for good.
+				if (used + size > 0 || !copies.empty())
+					break;
+				rows = 1;
+			}
+			memcpy(staging + used + size, resource.image.data.data() + offset, rows * level.rowSize);
+			copies.push_back(Copy{&resource, used + size, rows * level.rowSize, offset});
+			size += rows * level.rowSize;
+			if (used + size >= budget)
+				break;
+		}
+		if (size == 0)
+			return false;
+	}
+	else
+	{
+		if (size == 0)
+			return false;
+		if (!resource.mesh.vertexArray)
+		{
+			resource.mesh = resource.prepared.mesh;
+			createMeshBuffers(resource.mesh, resource.prepared.indexBufferCount, nullptr, nullptr);
+		}
+		// A chunk may end in the vertices and go on in the indices, those are two copies
+		size_t vertexBytes = resource.prepared.vertexData.size();
+		const unsigned char * indexData = reinterpret_cast<const unsigned char *>(resource.indices.data());
+		size_t stagingOffset = used;
+		size_t offset = resource.uploaded;
+		size_t end = resource.uploaded + size;
+		while (offset < end)
+		{
+			size_t chunk = offset < vertexBytes ? std::min(end, vertexBytes) - offset : end - offset;
+			const unsigned char * source = offset < vertexBytes ? resource.prepared.vertexData.data() + offset : indexData + offset - vertexBytes;
+			memcpy(staging + stagingOffset, source, chunk);
+			copies.push_back(Copy{&resource, stagingOffset, chunk, offset});
+			stagingOffset += chunk;
+			offset += chunk;
+		}
+	}
+	used += size;
+	resource.uploaded += size;
+	return used < budget;
+}
+
+void StreamingLoader::issue(const Copy & copy)
+{
+	Resource & resource = *copy.resource;
+	if (resource.kind == Resource::Kind::Texture)
+	{
+		size_t i = 0;
+		while (copy.offset >= resource.levels[i].offset + resource.levels[i].rowSize * resource.levels[i].rows)
+			++i;
+		const MipLevel & level = resource.levels[i];
+		GLint row = GLint((copy.offset - level.offset) / level.rowSize);
+		GLsizei rows = GLsizei(copy.size / level.rowSize);
+		// The staging buffer is the source of the pixels while it is bound as GL_PIXEL_UNPACK_BUFFER
+		glState().bindTexture(GL_TEXTURE_2D, resource.texture);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging_);
+		if (resource.format)
+		{
+			// Rows of blocks are 4 pixels high, the last one may reach past the edge of the level
+			GLint y = row * 4;
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(i), 0, y, level.width, std::min(rows * 4, GLsizei(level.height) - y),
+				resource.format, GLsizei(copy.size), (void*)copy.stagingOffset);
+		}
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, GLint(i), 0, row, level.width, rows, GL_BGR, GL_UNSIGNED_BYTE, (void*)copy.stagingOffset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	size_t vertexBytes = resource.prepared.vertexData.size();
+	bool vertices = copy.offset < vertexBytes;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertices ? resource.mesh.vertexBuffer : resource.mesh.indexBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+		copy.stagingOffset, vertices ? copy.offset : copy.offset - vertexBytes, copy.size);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamingLoader::finish(Resource & resource)
+{
+	++stats_.resources;
+	if (resource.failed)
+	{
+		printf("Could not stream %s, keeping the placeholder\n", resource.path.c_str());
+		return;
+	}
+	if (resource.kind == Resource::Kind::Texture)
+	{
+		glState().bindTexture(GL_TEXTURE_2D, resource.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, resource.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		resource.image = BitmapImage{};
+	}
+	else
+	{
+		// Here and not on the loader thread, where it would mix with the render thread's output
+		printVertexFormat(resource.mesh);
+		resource.prepared = PreparedMesh{};
+		resource.indices = std::vector<unsigned int>{};
+	}
+	resource.ready = true;
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - resource.requested).count();
+	printf("Streamed %s: %.1f KB, ready %.1f ms after the request\n", resource.path.c_str(), resource.size / 1024.0, milliseconds);
+}
+
+bool StreamingLoader::ready(Handle handle) const
+{
+	return resources_[handle]->ready;
+}
+
+bool StreamingLoader::idle() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_.empty() && loaded_.empty() && uploading_.empty() && stats_.resources == resources_.size();
+}
+
+GLuint StreamingLoader::texture(Handle handle) const
+{
+	const Resource & resource = *resources_[handle];
+	return resource.ready ? resource.texture : placeholderTexture_;
+}
+
+const MeshBuffers & StreamingLoader::mesh(Handle handle) const
+{
+	const Resource & resource = *resources_[handle];
+	return resource.ready ? resource.mesh : placeholderMesh_;
+}
+
+void StreamingLoader::release()
+{
+	for (std::unique_ptr<Resource> & resource : resources_)
+	{
+		if (resource->texture)
+			glDeleteTextures(1, &resource->texture);
+		if (resource->mesh.vertexArray)
+			deleteMesh(resource->mesh);
+		resource->texture = 0;
+		resource->ready = false;
+	}
+	for (GLsync & fence : fences_)
+	{
+		if (fence)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+	if (persistent_)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		persistent_ = nullptr;
+	}
+	glDeleteBuffers(1, &staging_);
+	staging_ = 0;
+	glDeleteTextures(1, &placeholderTexture_);
+	placeholderTexture_ = 0;
+	deleteMesh(placeholderMesh_);
+}
@@ -1,13 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <algorithm>
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
+#include "glstate.hpp"
+#include "mappedfile.hpp"
+#include "texture.hpp"
 
-GLuint loadBMP_custom(const char * imagepath){
+
+bool decodeBMP(const char * imagepath, BitmapImage & image){
 
 	printf("Reading image %s\n", imagepath);
 
@@ -16,28 +22,28 @@ GLuint loadBMP_custom(const char * imagepath){
 	unsigned int dataPos;
 	unsigned int imageSize;
 	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
 
 	// Open the file
 	FILE * file = fopen(imagepath,"rb");
-	if (!file)							    {printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); return 0;}
+	if (!file)							    {printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); return false;}
 
 	// Read the header, i.e. the 54 first bytes
 
 	// If less than 54 bytes are read, problem
 	if ( fread(header, 1, 54, file)!=54 ){ 
 		printf("Not a correct BMP file\n");
-		return 0;
+		fclose(file);
+		return false;
 	}
 	// A BMP files always begins with "BM"
 	if ( header[0]!='B' || header[1]!='M' ){
 		printf("Not a correct BMP file\n");
-		return 0;
+		fclose(file);
+		return false;
 	}
 	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    return 0;}
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
 
 	// Read the information about the image
 	dataPos    = *(int*)&(header[0x0A]);
@@ -46,30 +52,46 @@ GLuint loadBMP_custom(const char * imagepath){
 	height     = *(int*)&(header[0x16]);
 
 	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
 	if (dataPos==0)      dataPos=54; // The BMP header is done that way
-
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	// Rows are padded to 4 bytes, the same as GL_UNPACK_ALIGNMENT expects by default
+	unsigned int rowSize = (width * 3 + 3) & ~3u; // 3 : one byte for each Red, Green and Blue component
+	if (imageSize==0)    imageSize=rowSize*height;
+	if (width == 0 || height == 0 || imageSize < rowSize * height){
+		printf("Not a correct BMP file\n");
+		fclose(file);
+		return false;
+	}
 
 	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+	image.width = width;
+	image.height = height;
+	image.data.resize(rowSize * height);
+	if (fseek(file, dataPos, SEEK_SET) != 0 || fread(image.data.data(), 1, image.data.size(), file) != image.data.size()){
+		printf("%s is too short\n", imagepath);
+		fclose(file);
+		return false;
+	}
 
 	// Everything is in memory now, the file wan be closed
 	fclose (file);
+	return true;
+}
+
+GLuint loadBMP_custom(const char * imagepath){
+
+	BitmapImage image;
+	if (!decodeBMP(imagepath, image))
+		return 0;
 
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 	
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
+	glState().bindTexture(GL_TEXTURE_2D, textureID);
 
 	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, image.width, image.height, 0, GL_BGR, GL_UNSIGNED_BYTE, image.data.data());
 
 	// Poor filtering, or ...
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -115,94 +137,254 @@ GLuint loadTGA_glfw(const char * imagepath){
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_ATI1 0x31495441 // BC4, older tools
+#define FOURCC_BC4U 0x55344342
+#define FOURCC_BC4S 0x53344342
+#define FOURCC_ATI2 0x32495441 // BC5, older tools
+#define FOURCC_BC5U 0x55354342
+#define FOURCC_BC5S 0x53354342
+#define FOURCC_DX10 0x30315844 // DDS_HEADER_DXT10 follows the header
+
+namespace {
+
+// Offsets into the 124 byte DDS_HEADER, in 32 bit words
+enum DDSHeaderWord
+{
+	DDS_SIZE = 0,
+	DDS_HEIGHT = 2,
+	DDS_WIDTH = 3,
+	DDS_DEPTH = 5,
+	DDS_MIPMAPCOUNT = 6,
+	DDS_PF_FLAGS = 19,
+	DDS_PF_FOURCC = 20,
+	DDS_CAPS2 = 27
+};
+
+const uint32_t DDPF_FOURCC = 0x4;
+const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+const uint32_t DDSCAPS2_VOLUME = 0x200000;
+const uint32_t DDS_RESOURCE_DIMENSION_TEXTURE2D = 3;
+const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+uint32_t readWord(const char * data, size_t word)
+{
+	uint32_t value;
+	memcpy(&value, data + 4 * word, 4);
+	return value;
+}
 
-GLuint loadDDS(const char * imagepath){
+// The compressed GL format and its bytes per 4 x 4 block for a legacy four character code
+bool legacyFormat(uint32_t fourCC, GLenum & format, size_t & blockBytes)
+{
+	switch (fourCC)
+	{
+	case FOURCC_DXT1: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; return true;
+	case FOURCC_DXT3: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; blockBytes = 16; return true;
+	case FOURCC_DXT5: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockBytes = 16; return true;
+	case FOURCC_ATI1:
+	case FOURCC_BC4U: format = GL_COMPRESSED_RED_RGTC1; blockBytes = 8; return true;
+	case FOURCC_BC4S: format = GL_COMPRESSED_SIGNED_RED_RGTC1; blockBytes = 8; return true;
+	case FOURCC_ATI2:
+	case FOURCC_BC5U: format = GL_COMPRESSED_RG_RGTC2; blockBytes = 16; return true;
+	case FOURCC_BC5S: format = GL_COMPRESSED_SIGNED_RG_RGTC2; blockBytes = 16; return true;
+	default: return false;
+	}
+}
 
-	unsigned char header[124];
+// The same for the DXGI_FORMAT of a DX10 header, BC1 to BC7
+bool dxgiFormat(uint32_t dxgi, GLenum & format, size_t & blockBytes)
+{
+	switch (dxgi)
+	{
+	case 71: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; return true;        // BC1_UNORM
+	case 72: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; blockBytes = 8; return true;  // BC1_UNORM_SRGB
+	case 74: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; blockBytes = 16; return true;       // BC2_UNORM
+	case 75: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; blockBytes = 16; return true; // BC2_UNORM_SRGB
+	case 77: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockBytes = 16; return true;       // BC3_UNORM
+	case 78: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; blockBytes = 16; return true; // BC3_UNORM_SRGB
+	case 80: format = GL_COMPRESSED_RED_RGTC1; blockBytes = 8; return true;                 // BC4_UNORM
+	case 81: format = GL_COMPRESSED_SIGNED_RED_RGTC1; blockBytes = 8; return true;          // BC4_SNORM
+	case 83: format = GL_COMPRESSED_RG_RGTC2; blockBytes = 16; return true;                 // BC5_UNORM
+	case 84: format = GL_COMPRESSED_SIGNED_RG_RGTC2; blockBytes = 16; return true;          // BC5_SNORM
+	case 95: format = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; blockBytes = 16; return true;  // BC6H_UF16
+	case 96: format = GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT; blockBytes = 16; return true;    // BC6H_SF16
+	case 98: format = GL_COMPRESSED_RGBA_BPTC_UNORM; blockBytes = 16; return true;          // BC7_UNORM
+	case 99: format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; blockBytes = 16; return true;    // BC7_UNORM_SRGB
+	default: return false;
+	}
+}
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
-		return 0;
+} // namespace
+
+bool ddsFormatSupported(GLenum format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+	case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return GLEW_ARB_texture_compression_bptc;
+	case GL_COMPRESSED_RED_RGTC1:
+	case GL_COMPRESSED_SIGNED_RED_RGTC1:
+	case GL_COMPRESSED_RG_RGTC2:
+	case GL_COMPRESSED_SIGNED_RG_RGTC2:
+		return true; // core since 3.0
+	default:
+		return GLEW_EXT_texture_compression_s3tc;
+	}
+}
+
+size_t DDSLayout::levelSize(unsigned int level) const
+{
+	size_t blocksX = std::max((width >> level) + 3, 4u) / 4;
+	size_t blocksY = std::max((height >> level) + 3, 4u) / 4;
+	return blocksX * blocksY * blockBytes;
+}
+
+size_t DDSLayout::levelOffset(unsigned int layer, unsigned int level) const
+{
+	// Every layer (array element or cube face) holds its whole mip chain before the next one starts
+	size_t chain = 0, offset = 0;
+	for (unsigned int l = 0; l < levels; ++l)
+	{
+		if (l == level)
+			offset = chain;
+		chain += levelSize(l);
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+	return dataOffset + layer * chain + offset;
+}
+
+bool parseDDS(const char * data, size_t size, DDSLayout & layout)
+{
+	if (size < 4 + 124 || memcmp(data, "DDS ", 4) != 0 || readWord(data + 4, DDS_SIZE) != 124)
+		return false;
+	const char * header = data + 4;
+	layout = DDSLayout{};
+	layout.width = readWord(header, DDS_WIDTH);
+	layout.height = readWord(header, DDS_HEIGHT);
+	layout.levels = std::max(readWord(header, DDS_MIPMAPCOUNT), 1u);
+	layout.dataOffset = 4 + 124;
+	uint32_t caps2 = readWord(header, DDS_CAPS2);
+	if ((caps2 & DDSCAPS2_VOLUME) || readWord(header, DDS_DEPTH) > 1)
+		return false; // 3D textures aren't used here
+	if (!(readWord(header, DDS_PF_FLAGS) & DDPF_FOURCC))
+		return false; // only block compressed files
+
+	uint32_t fourCC = readWord(header, DDS_PF_FOURCC);
+	if (fourCC == FOURCC_DX10)
+	{
+		// DDS_HEADER_DXT10: dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2
+		if (size < layout.dataOffset + 20)
+			return false;
+		const char * extended = data + layout.dataOffset;
+		layout.dataOffset += 20;
+		if (!dxgiFormat(readWord(extended, 0), layout.format, layout.blockBytes) || readWord(extended, 1) != DDS_RESOURCE_DIMENSION_TEXTURE2D)
+			return false;
+		layout.cube = (readWord(extended, 2) & DDS_RESOURCE_MISC_TEXTURECUBE) != 0;
+		layout.arraySize = std::max(readWord(extended, 3), 1u);
+		layout.array = layout.arraySize > 1;
 	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
+	else
+	{
+		if (!legacyFormat(fourCC, layout.format, layout.blockBytes))
+			return false;
+		if (caps2 & DDSCAPS2_CUBEMAP)
+		{
+			if ((caps2 & 0xFC00) != 0xFC00)
+				return false; // GL has no cube maps with missing faces
+			layout.cube = true;
+		}
 	}
 
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+	// A full chain ends at 1 x 1, anything claiming more levels is broken
+	unsigned int largest = std::max(layout.width, layout.height);
+	unsigned int maxLevels = 1;
+	while (largest >> maxLevels)
+		++maxLevels;
+	if (layout.width == 0 || layout.height == 0 || layout.levels > maxLevels)
+		return false;
+	if (layout.cube && layout.width != layout.height)
+		return false;
+	layout.layers = layout.arraySize * (layout.cube ? 6 : 1);
+	return layout.levelOffset(layout.layers, 0) <= size;
+}
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
+DDSTexture loadDDSTexture(const char * imagepath, unsigned int firstLevel){
 
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
+	DDSTexture texture;
+	// The levels go to GL straight out of the mapped file, nothing is copied on the way
+	MappedFile file;
+	if (!file.open(imagepath)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return texture;
+	}
+	DDSLayout layout;
+	if (!parseDDS(file.data(), file.size(), layout)){
+		printf("%s is not a DDS file this loader understands\n", imagepath);
+		return texture;
+	}
+	if (!ddsFormatSupported(layout.format) || (layout.cube && layout.array && !GLEW_ARB_texture_cube_map_array)){
+		printf("%s needs a texture format this GL doesn't have\n", imagepath);
+		return texture;
+	}
 
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
+	texture.target = layout.cube ? (layout.array ? GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_CUBE_MAP) : (layout.array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D);
+	texture.firstLevel = std::min(firstLevel, layout.levels - 1);
+	texture.levels = layout.levels - texture.firstLevel;
+	texture.width = std::max(layout.width >> texture.firstLevel, 1u);
+	texture.height = std::max(layout.height >> texture.firstLevel, 1u);
+	texture.layers = layout.arraySize;
+
+	glGenTextures(1, &texture.id);
+	glState().bindTexture(texture.target, texture.id);
+	// A bound unpack buffer would turn the pointers into offsets
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	bool layered = texture.target == GL_TEXTURE_2D_ARRAY || texture.target == GL_TEXTURE_CUBE_MAP_ARRAY;
+	bool immutable = GLEW_ARB_texture_storage;
+	if (immutable){
+		// One allocation for every level, and the levels can't be redefined later
+		if (layered)
+			glTexStorage3D(texture.target, texture.levels, layout.format, texture.width, texture.height, layout.layers);
+		else
+			glTexStorage2D(texture.target, texture.levels, layout.format, texture.width, texture.height);
+	}
 
-	} 
+	for (unsigned int level = 0; level < texture.levels; ++level){
+		unsigned int fileLevel = texture.firstLevel + level;
+		GLsizei width = std::max(layout.width >> fileLevel, 1u);
+		GLsizei height = std::max(layout.height >> fileLevel, 1u);
+		GLsizei size = GLsizei(layout.levelSize(fileLevel));
+		if (layered){
+			// The layers of a level are apart in the file, one upload each
+			if (!immutable)
+				glCompressedTexImage3D(texture.target, level, layout.format, width, height, layout.layers, 0, size * layout.layers, nullptr);
+			for (unsigned int layer = 0; layer < layout.layers; ++layer)
+				glCompressedTexSubImage3D(texture.target, level, 0, 0, layer, width, height, 1, layout.format, size,
+					file.data() + layout.levelOffset(layer, fileLevel));
+			continue;
+		}
+		for (unsigned int face = 0; face < layout.layers; ++face){
+			GLenum target = layout.cube ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+			const char * pixels = file.data() + layout.levelOffset(face, fileLevel);
+			if (immutable)
+				glCompressedTexSubImage2D(target, level, 0, 0, width, height, layout.format, size, pixels);
+			else
+				glCompressedTexImage2D(target, level, layout.format, width, height, 0, size, pixels);
+		}
+	}
 
-	free(buffer); 
+	if (!immutable)
+		glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+	GLint wrap = layout.cube ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+	glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, wrap);
+	glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, texture.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	return texture;
+}
 
-	return textureID;
-}
\ No newline at end of file
+GLuint loadDDS(const char * imagepath){
+	return loadDDSTexture(imagepath).id;
+}
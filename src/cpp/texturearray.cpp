@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+#include "mappedfile.hpp"
+#include "texture.hpp"
+#include "texturearray.hpp"
+#include "texturecompress.hpp"
+
+TextureArrays::TextureArrays(unsigned int initialLayers)
+	: initialLayers_(std::max(initialLayers, 1u))
+{
+	GLint maxLayers{0};
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	if (maxLayers > 0)
+		maxLayers_ = unsigned(maxLayers);
+}
+
+TextureArrays::~TextureArrays()
+{
+	release();
+}
+
+void TextureArrays::release()
+{
+	for (Array & array : arrays_)
+		glDeleteTextures(1, &array.texture);
+	arrays_.clear();
+	if (copyBuffer_)
+		glDeleteBuffers(1, &copyBuffer_);
+	copyBuffer_ = 0;
+	// The shadow copy may still hold the deleted names, which GL can hand out again
+	glState().invalidate();
+}
+
+size_t TextureArrays::levelSize(const Array & array, unsigned int level) const
+{
+	unsigned int width = std::max(array.width >> level, 1u), height = std::max(array.height >> level, 1u);
+	if (!array.blockBytes)
+		return size_t(width) * height * 4;
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * array.blockBytes;
+}
+
+GLuint TextureArrays::allocate(const Array & array, unsigned int capacity) const
+{
+	GLuint texture{0};
+	glGenTextures(1, &texture);
+	glState().bindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	if (GLEW_ARB_texture_storage)
+	{
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels, array.format, array.width, array.height, capacity);
+	}
+	else
+	{
+		for (unsigned int level = 0; level < array.levels; ++level)
+		{
+			GLsizei width = std::max(array.width >> level, 1u), height = std::max(array.height >> level, 1u);
+			if (array.blockBytes)
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format, width, height, capacity, 0,
+					GLsizei(levelSize(array, level) * capacity), nullptr);
+			else
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format, width, height, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.levels - 1);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	return texture;
+}
+
+void TextureArrays::grow(Array & array, unsigned int capacity)
+{
+	GLuint texture{allocate(array, capacity)};
+	for (unsigned int level = 0; level < array.levels; ++level)
+	{
+		GLsizei width = std::max(array.width >> level, 1u), height = std::max(array.height >> level, 1u);
+		if (GLEW_ARB_copy_image)
+		{
+			glCopyImageSubData(array.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+				texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.layers);
+			continue;
+		}
+		// Without it the level goes through a buffer, still without a round trip to the CPU.
+		// glGetTexImage reads every allocated layer, so the buffer has to hold them all.
+		size_t size = levelSize(array, level);
+		if (!copyBuffer_)
+			glGenBuffers(1, &copyBuffer_);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, copyBuffer_);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size * array.capacity, nullptr, GL_STREAM_COPY);
+		glState().bindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		if (array.blockBytes)
+			glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, nullptr);
+		else
+			glGetTexImage(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, copyBuffer_);
+		glState().bindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		if (array.blockBytes)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.layers, array.format,
+				GLsizei(size * array.layers), nullptr);
+		else
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.layers, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glDeleteTextures(1, &array.texture);
+	glState().invalidate();
+	array.texture = texture;
+	array.capacity = capacity;
+}
+
+TextureSlot TextureArrays::reserve(GLenum format, size_t blockBytes, unsigned int width, unsigned int height, unsigned int levels)
+{
+	TextureSlot slot{};
+	for (unsigned int i = 0; i < arrays_.size(); ++i)
+	{
+		Array & array{arrays_[i]};
+		if (array.format != format || array.width != width || array.height != height || array.levels != levels || array.layers == maxLayers_)
+			continue;
+		if (array.layers == array.capacity)
+			grow(array, std::min(array.capacity * 2, maxLayers_));
+		slot.array = i;
+		slot.layer = GLint(array.layers++);
+		return slot;
+	}
+	Array array{format, blockBytes, width, height, levels, 0, 1, std::min(initialLayers_, maxLayers_)};
+	array.texture = allocate(array, array.capacity);
+	slot.array = unsigned(arrays_.size());
+	slot.layer = 0;
+	arrays_.push_back(array);
+	return slot;
+}
+
+TextureSlot TextureArrays::add(const RGBAImage & image)
+{
+	std::vector<RGBAImage> mips{buildMipChain(image)};
+	TextureSlot slot{reserve(GL_RGBA8, 0, image.width, image.height, unsigned(mips.size()))};
+	glState().bindTexture(GL_TEXTURE_2D_ARRAY, texture(slot.array));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (unsigned int level = 0; level < mips.size(); ++level)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, slot.layer, mips[level].width, mips[level].height, 1,
+			GL_RGBA, GL_UNSIGNED_BYTE, mips[level].pixels.data());
+	return slot;
+}
+
+TextureSlot TextureArrays::addBMP(const char * imagepath)
+{
+	BitmapImage bitmap;
+	if (!decodeBMP(imagepath, bitmap))
+		return TextureSlot{};
+	return add(toRGBA(bitmap));
+}
+
+TextureSlot TextureArrays::addDDS(const char * imagepath)
+{
+	MappedFile file;
+	DDSLayout layout;
+	if (!file.open(imagepath) || !parseDDS(file.data(), file.size(), layout) || layout.layers != 1)
+	{
+		printf("%s is no single DDS texture\n", imagepath);
+		return TextureSlot{};
+	}
+	TextureSlot slot{reserve(layout.format, layout.blockBytes, layout.width, layout.height, layout.levels)};
+	glState().bindTexture(GL_TEXTURE_2D_ARRAY, texture(slot.array));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (unsigned int level = 0; level < layout.levels; ++level)
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, slot.layer,
+			std::max(layout.width >> level, 1u), std::max(layout.height >> level, 1u), 1, layout.format,
+			GLsizei(layout.levelSize(level)), file.data() + layout.levelOffset(0, level));
+	return slot;
+}
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "texturecompress.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// sRGB transfer function both ways. Decoding has 256 inputs, encoding is precise enough with 4096 steps.
+struct GammaTables
+{
+	float toLinear[256];
+	uint8_t toSRGB[4096];
+
+	GammaTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; ++i)
+		{
+			float c = i / 4095.0f;
+			float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+			toSRGB[i] = static_cast<uint8_t>(std::lround(s * 255.0f));
+		}
+	}
+};
+
+const GammaTables & gammaTables()
+{
+	static const GammaTables tables;
+	return tables;
+}
+
+// Four floats per texel, colour in linear light, so the levels are filtered from each other without rounding in between
+struct LinearImage
+{
+	unsigned int width{0};
+	unsigned int height{0};
+	std::vector<float> texels;
+};
+
+LinearImage toLinear(const RGBAImage & image)
+{
+	const GammaTables & gamma = gammaTables();
+	LinearImage linear;
+	linear.width = image.width;
+	linear.height = image.height;
+	linear.texels.resize(image.pixels.size());
+	for (size_t i = 0; i < image.pixels.size(); i += 4)
+	{
+		linear.texels[i] = gamma.toLinear[image.pixels[i]];
+		linear.texels[i + 1] = gamma.toLinear[image.pixels[i + 1]];
+		linear.texels[i + 2] = gamma.toLinear[image.pixels[i + 2]];
+		linear.texels[i + 3] = image.pixels[i + 3] / 255.0f;
+	}
+	return linear;
+}
+
+RGBAImage toSRGB(const LinearImage & linear)
+{
+	const GammaTables & gamma = gammaTables();
+	RGBAImage image;
+	image.width = linear.width;
+	image.height = linear.height;
+	image.pixels.resize(linear.texels.size());
+	for (size_t i = 0; i < linear.texels.size(); ++i)
+	{
+		float value = std::clamp(linear.texels[i], 0.0f, 1.0f);
+		image.pixels[i] = i % 4 == 3 ? static_cast<uint8_t>(std::lround(value * 255.0f)) : gamma.toSRGB[std::lround(value * 4095.0f)];
+	}
+	return image;
+}
+
+// 2 x 2 box filter, odd sizes repeat their last row or column
+LinearImage downsample(const LinearImage & source)
+{
+	LinearImage target;
+	target.width = std::max(source.width / 2, 1u);
+	target.height = std::max(source.height / 2, 1u);
+	target.texels.resize(size_t(target.width) * target.height * 4);
+	for (unsigned int y = 0; y < target.height; ++y)
+	{
+		const float * row0 = &source.texels[size_t(std::min(2 * y, source.height - 1)) * source.width * 4];
+		const float * row1 = &source.texels[size_t(std::min(2 * y + 1, source.height - 1)) * source.width * 4];
+		float * out = &target.texels[size_t(y) * target.width * 4];
+		for (unsigned int x = 0; x < target.width; ++x, out += 4)
+		{
+			size_t x0 = size_t(std::min(2 * x, source.width - 1)) * 4;
+			size_t x1 = size_t(std::min(2 * x + 1, source.width - 1)) * 4;
+#ifdef TEXTURE_SSE
+			// One texel, all four channels at once
+			__m128 sum{_mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+				_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)))};
+			_mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+			for (int c = 0; c < 4; ++c)
+				out[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+#endif
+		}
+	}
+	return target;
+}
+
+uint16_t pack565(const float color[3])
+{
+	unsigned int r = static_cast<unsigned int>(std::lround(std::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f));
+	unsigned int g = static_cast<unsigned int>(std::lround(std::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f));
+	unsigned int b = static_cast<unsigned int>(std::lround(std::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f));
+	return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+// The way the GPU expands the endpoints, high bits repeated into the low ones
+void unpack565(uint16_t packed, float color[3])
+{
+	unsigned int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+	color[0] = float(r << 3 | r >> 2);
+	color[1] = float(g << 2 | g >> 4);
+	color[2] = float(b << 3 | b >> 2);
+}
+
+// Nearest of the four colours between the endpoints for every texel, returns the squared error
+float fitIndices(const float colors[16][3], uint16_t endpoint0, uint16_t endpoint1, uint8_t indices[16])
+{
+	float palette[4][3];
+	unpack565(endpoint0, palette[0]);
+	unpack565(endpoint1, palette[1]);
+	for (int c = 0; c < 3; ++c)
+	{
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+	float error = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		float best = 1e30f;
+		for (uint8_t p = 0; p < 4; ++p)
+		{
+			float d0 = colors[i][0] - palette[p][0], d1 = colors[i][1] - palette[p][1], d2 = colors[i][2] - palette[p][2];
+			float distance = d0 * d0 + d1 * d1 + d2 * d2;
+			if (distance < best)
+			{
+				best = distance;
+				indices[i] = p;
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+// Endpoints along the principal axis of the colours, then one least squares refit for the chosen indices
+void encodeColorBlock(const uint8_t texels[16][4], uint8_t * out)
+{
+	float colors[16][3];
+	float mean[3]{0.0f, 0.0f, 0.0f};
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 3; ++c)
+		{
+			colors[i][c] = texels[i][c];
+			mean[c] += colors[i][c] / 16.0f;
+		}
+	float covariance[6]{}; // xx xy xz yy yz zz
+	for (int i = 0; i < 16; ++i)
+	{
+		float d[3]{colors[i][0] - mean[0], colors[i][1] - mean[1], colors[i][2] - mean[2]};
+		covariance[0] += d[0] * d[0];
+		covariance[1] += d[0] * d[1];
+		covariance[2] += d[0] * d[2];
+		covariance[3] += d[1] * d[1];
+		covariance[4] += d[1] * d[2];
+		covariance[5] += d[2] * d[2];
+	}
+	// Power iteration, a few steps are plenty for a 3 x 3 matrix
+	float axis[3]{1.0f, 1.0f, 1.0f};
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[3]{
+			covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+			covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+			covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]};
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f)
+			break; // one colour, any axis will do
+		for (int c = 0; c < 3; ++c)
+			axis[c] = next[c] / length;
+	}
+
+	float low = 1e30f, high = -1e30f;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = (colors[i][0] - mean[0]) * axis[0] + (colors[i][1] - mean[1]) * axis[1] + (colors[i][2] - mean[2]) * axis[2];
+		low = std::min(low, t);
+		high = std::max(high, t);
+	}
+	// Pulled in a little, the extremes are rarely hit exactly after the 565 rounding
+	float inset = (high - low) / 16.0f;
+	float end0[3], end1[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		end0[c] = mean[c] + axis[c] * (high - inset);
+		end1[c] = mean[c] + axis[c] * (low + inset);
+	}
+	uint16_t endpoint0 = pack565(end0), endpoint1 = pack565(end1);
+	uint8_t indices[16];
+	float error = fitIndices(colors, endpoint0, endpoint1, indices);
+
+	// Least squares endpoints for these indices, index weights of endpoint 0 are 1, 0, 2/3, 1/3
+	const float weights[4]{1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3]{}, bx[3]{};
+	for (int i = 0; i < 16; ++i)
+	{
+		float alpha = weights[indices[i]], beta = 1.0f - alpha;
+		aa += alpha * alpha;
+		bb += beta * beta;
+		ab += alpha * beta;
+		for (int c = 0; c < 3; ++c)
+		{
+			ax[c] += alpha * colors[i][c];
+			bx[c] += beta * colors[i][c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) > 1e-6f)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			end0[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+			end1[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+		}
+		uint16_t refit0 = pack565(end0), refit1 = pack565(end1);
+		uint8_t refitIndices[16];
+		float refitError = fitIndices(colors, refit0, refit1, refitIndices);
+		if (refitError < error)
+		{
+			endpoint0 = refit0;
+			endpoint1 = refit1;
+			memcpy(indices, refitIndices, sizeof(indices));
+		}
+	}
+
+	// endpoint0 > endpoint1 selects the four colour mode, swapping them swaps the indices 0/1 and 2/3.
+	// Equal endpoints would be the three colour mode, where index 3 is black, so all texels take index 0.
+	if (endpoint0 < endpoint1)
+	{
+		std::swap(endpoint0, endpoint1);
+		for (uint8_t & index : indices)
+			index ^= 1;
+	}
+	else if (endpoint0 == endpoint1)
+	{
+		memset(indices, 0, sizeof(indices));
+	}
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= uint32_t(indices[i]) << (2 * i);
+	out[0] = uint8_t(endpoint0);
+	out[1] = uint8_t(endpoint0 >> 8);
+	out[2] = uint8_t(endpoint1);
+	out[3] = uint8_t(endpoint1 >> 8);
+	for (int i = 0; i < 4; ++i)
+		out[4 + i] = uint8_t(bits >> (8 * i));
+}
+
+// Eight alpha values between the largest and the smallest, three bit indices
+void encodeAlphaBlock(const uint8_t texels[16][4], uint8_t * out)
+{
+	int high = 0, low = 255;
+	for (int i = 0; i < 16; ++i)
+	{
+		high = std::max<int>(high, texels[i][3]);
+		low = std::min<int>(low, texels[i][3]);
+	}
+	out[0] = uint8_t(high);
+	out[1] = uint8_t(low);
+	uint64_t bits = 0;
+	if (high != low)
+	{
+		int palette[8]{high, low};
+		for (int k = 2; k < 8; ++k)
+			palette[k] = ((8 - k) * high + (k - 1) * low) / 7;
+		for (int i = 0; i < 16; ++i)
+		{
+			int best = 256;
+			uint64_t index = 0;
+			for (int k = 0; k < 8; ++k)
+			{
+				int distance = std::abs(palette[k] - texels[i][3]);
+				if (distance < best)
+				{
+					best = distance;
+					index = k;
+				}
+			}
+			bits |= index << (3 * i);
+		}
+	}
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = uint8_t(bits >> (8 * i));
+}
+
+size_t blockBytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+} // namespace
+
+RGBAImage toRGBA(const BitmapImage & bitmap)
+{
+	RGBAImage image;
+	image.width = bitmap.width;
+	image.height = bitmap.height;
+	image.pixels.resize(size_t(bitmap.width) * bitmap.height * 4);
+	size_t rowSize = bitmap.data.size() / bitmap.height;
+	for (unsigned int y = 0; y < bitmap.height; ++y)
+	{
+		const unsigned char * source = &bitmap.data[y * rowSize];
+		uint8_t * target = &image.pixels[size_t(y) * bitmap.width * 4];
+		for (unsigned int x = 0; x < bitmap.width; ++x)
+		{
+			target[x * 4] = source[x * 3 + 2];
+			target[x * 4 + 1] = source[x * 3 + 1];
+			target[x * 4 + 2] = source[x * 3];
+			target[x * 4 + 3] = 255;
+		}
+	}
+	return image;
+}
+
+std::vector<RGBAImage> buildMipChain(const RGBAImage & image)
+{
+	std::vector<RGBAImage> levels{image};
+	LinearImage current = toLinear(image);
+	while (current.width > 1 || current.height > 1)
+	{
+		current = downsample(current);
+		levels.push_back(toSRGB(current));
+	}
+	return levels;
+}
+
+size_t compressedSize(unsigned int width, unsigned int height, BlockFormat format)
+{
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+unsigned int compressionThreads(unsigned int height, unsigned int threads)
+{
+	if (!threads)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	return std::max(1u, std::min(threads, (height + 3) / 4));
+}
+
+std::vector<uint8_t> compressBlocks(const RGBAImage & image, BlockFormat format, unsigned int threads)
+{
+	unsigned int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+	std::vector<uint8_t> blocks(compressedSize(image.width, image.height, format));
+	size_t bytes = blockBytes(format);
+
+	auto encodeRows = [&](unsigned int firstRow, unsigned int endRow)
+	{
+		uint8_t texels[16][4];
+		for (unsigned int by = firstRow; by < endRow; ++by)
+		{
+			for (unsigned int bx = 0; bx < blocksX; ++bx)
+			{
+				// Blocks over the edge repeat the last row and column
+				for (unsigned int i = 0; i < 16; ++i)
+				{
+					unsigned int x = std::min(bx * 4 + i % 4, image.width - 1);
+					unsigned int y = std::min(by * 4 + i / 4, image.height - 1);
+					memcpy(texels[i], &image.pixels[(size_t(y) * image.width + x) * 4], 4);
+				}
+				uint8_t * out = &blocks[(size_t(by) * blocksX + bx) * bytes];
+				if (format == BlockFormat::BC3)
+				{
+					encodeAlphaBlock(texels, out);
+					out += 8;
+				}
+				encodeColorBlock(texels, out);
+			}
+		}
+	};
+
+	threads = compressionThreads(image.height, threads);
+	std::vector<std::thread> workers;
+	for (unsigned int t = 1; t < threads; ++t)
+		workers.emplace_back(encodeRows, blocksY * t / threads, blocksY * (t + 1) / threads);
+	encodeRows(0, blocksY / threads);
+	for (std::thread & worker : workers)
+		worker.join();
+	return blocks;
+}
+
+bool writeDDS(const char * path, BlockFormat format, unsigned int width, unsigned int height, const std::vector<std::vector<uint8_t>> & levels)
+{
+	// DDS_HEADER as 31 little endian words, the words parseDDS reads
+	const uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000;
+	const uint32_t DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+	const uint32_t DDPF_FOURCC = 0x4;
+	const uint32_t DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+	uint32_t header[31]{};
+	header[0] = 124;
+	header[1] = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header[2] = height;
+	header[3] = width;
+	header[4] = levels.empty() ? 0 : uint32_t(levels[0].size());
+	header[6] = uint32_t(levels.size());
+	header[18] = 32; // pixel format size
+	header[19] = DDPF_FOURCC;
+	memcpy(&header[20], format == BlockFormat::BC1 ? "DXT1" : "DXT5", 4);
+	header[26] = DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	FILE * file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("%s could not be written\n", path);
+		return false;
+	}
+	bool written = fwrite("DDS ", 1, 4, file) == 4 && fwrite(header, 1, sizeof(header), file) == sizeof(header);
+	for (const std::vector<uint8_t> & level : levels)
+		written = written && fwrite(level.data(), 1, level.size(), file) == level.size();
+	return fclose(file) == 0 && written;
+}
+
+bool compressBMP(const char * bmpPath, const char * ddsPath, BlockFormat format)
+{
+	typedef std::chrono::steady_clock Clock;
+	BitmapImage bitmap;
+	if (!decodeBMP(bmpPath, bitmap))
+		return false;
+	Clock::time_point start{Clock::now()};
+	std::vector<RGBAImage> mips{buildMipChain(toRGBA(bitmap))};
+	Clock::time_point filtered{Clock::now()};
+	std::vector<std::vector<uint8_t>> levels;
+	for (const RGBAImage & mip : mips)
+		levels.push_back(compressBlocks(mip, format));
+	Clock::time_point encoded{Clock::now()};
+	bool written = writeDDS(ddsPath, format, bitmap.width, bitmap.height, levels);
+	size_t rgbaBytes = 0, compressedBytes = 0;
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		rgbaBytes += mips[i].pixels.size();
+		compressedBytes += levels[i].size();
+	}
+	// Level 0 has the most rows of blocks, the smaller levels run on fewer threads
+	printf("Compressed %s to %s: %zu levels, %.0f KB (%.1f%% less than RGBA8), mipmaps %.1f ms, %s %.1f ms (%u threads)\n", bmpPath, ddsPath,
+		levels.size(), compressedBytes / 1024.0, 100.0 * (1.0 - double(compressedBytes) / rgbaBytes),
+		std::chrono::duration<double, std::milli>(filtered - start).count(), format == BlockFormat::BC1 ? "BC1" : "BC3",
+		std::chrono::duration<double, std::milli>(encoded - filtered).count(), compressionThreads(bitmap.height, 0));
+	return written;
+}
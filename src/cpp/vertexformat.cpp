@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+#include "glstate.hpp"
+#include "objects.hpp"
+#include "shaderprogram.hpp"
+#include "vertexformat.hpp"
+
+namespace {
+
+inline uint16_t quantizeUnorm16(float value)
+{
+	return static_cast<uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+inline int16_t quantizeSnorm16(float value)
+{
+	return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+inline float signNotZero(float value)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Projects the unit sphere onto an octahedron and unfolds it into the [-1, 1] square
+glm::vec2 octahedralEncode(const glm::vec3 & n)
+{
+	float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+	if (sum == 0.0f)
+		return glm::vec2(0.0f, 0.0f); // meshes without normals
+	glm::vec2 p(n.x / sum, n.y / sum);
+	if (n.z < 0.0f)
+		p = glm::vec2((1.0f - std::fabs(p.y)) * signNotZero(p.x), (1.0f - std::fabs(p.x)) * signNotZero(p.y));
+	return p;
+}
+
+// Same as octDecode in StandardShadingPacked.vertexshader
+glm::vec3 octahedralDecode(const glm::vec2 & e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+// Extent of the values, never zero so it can be divided by
+template <typename Vec>
+void bounds(const Vec * values, size_t count, Vec & bias, Vec & scale)
+{
+	Vec low = count ? values[0] : Vec(0.0f);
+	Vec high = low;
+	for (size_t i = 1; i < count; ++i)
+	{
+		low = glm::min(low, values[i]);
+		high = glm::max(high, values[i]);
+	}
+	bias = low;
+	scale = high - low;
+	for (int c = 0; c < static_cast<int>(sizeof(Vec) / sizeof(float)); ++c)
+		if (scale[c] <= 0.0f)
+			scale[c] = 1.0f;
+}
+
+// Packs the vertices, returns false as soon as one moves further than the quantization allows
+bool packVertices(
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	const VertexQuantization & quantization, MeshBuffers & mesh, std::vector<PackedVertex> & packed
+){
+	bounds(vertices, vertexCount, mesh.positionBias, mesh.positionScale);
+	bounds(uvs, vertexCount, mesh.uvBias, mesh.uvScale);
+	float maxPositionError = quantization.maxPositionError * glm::length(mesh.positionScale);
+	float minNormalCos = std::cos(quantization.maxNormalError);
+
+	packed.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		PackedVertex & vertex = packed[i];
+		glm::vec3 decodedPosition;
+		for (int c = 0; c < 3; ++c)
+		{
+			vertex.position[c] = quantizeUnorm16((vertices[i][c] - mesh.positionBias[c]) / mesh.positionScale[c]);
+			decodedPosition[c] = vertex.position[c] / 65535.0f * mesh.positionScale[c] + mesh.positionBias[c];
+		}
+		vertex.position[3] = 0;
+		glm::vec2 decodedUV;
+		for (int c = 0; c < 2; ++c)
+		{
+			vertex.uv[c] = quantizeUnorm16((uvs[i][c] - mesh.uvBias[c]) / mesh.uvScale[c]);
+			decodedUV[c] = vertex.uv[c] / 65535.0f * mesh.uvScale[c] + mesh.uvBias[c];
+		}
+		glm::vec2 octahedral = octahedralEncode(normals[i]);
+		vertex.normal[0] = quantizeSnorm16(octahedral.x);
+		vertex.normal[1] = quantizeSnorm16(octahedral.y);
+
+		if (glm::length(decodedPosition - vertices[i]) > maxPositionError)
+			return false;
+		if (glm::length(decodedUV - uvs[i]) > quantization.maxUVError)
+			return false;
+		float normalLength = glm::length(normals[i]);
+		if (normalLength > 0.0f)
+		{
+			glm::vec3 decodedNormal = octahedralDecode(glm::vec2(vertex.normal[0] / 32767.0f, vertex.normal[1] / 32767.0f));
+			if (glm::dot(decodedNormal, normals[i] / normalLength) < minNormalCos)
+				return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+size_t vertexSize(VertexFormat format)
+{
+	return format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(FloatVertex);
+}
+
+PreparedMesh prepareMesh(
+	size_t indexCount,
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	const VertexQuantization & quantization,
+	const std::vector<MeshLOD> & lods
+){
+	PreparedMesh prepared;
+	MeshBuffers & mesh = prepared.mesh;
+	mesh.indexCount = static_cast<GLsizei>(indexCount);
+	mesh.vertexCount = vertexCount;
+
+	std::vector<PackedVertex> packed;
+	if (quantization.allowPacked && packVertices(vertices, uvs, normals, vertexCount, quantization, mesh, packed))
+	{
+		mesh.format = VertexFormat::Packed;
+		const unsigned char * bytes = reinterpret_cast<const unsigned char *>(packed.data());
+		prepared.vertexData.assign(bytes, bytes + packed.size() * sizeof(PackedVertex));
+	}
+	else
+	{
+		mesh = MeshBuffers{};
+		mesh.indexCount = static_cast<GLsizei>(indexCount);
+		mesh.vertexCount = vertexCount;
+		prepared.vertexData.resize(vertexCount * sizeof(FloatVertex));
+		FloatVertex * interleaved = reinterpret_cast<FloatVertex *>(prepared.vertexData.data());
+		for (size_t i = 0; i < vertexCount; ++i)
+			interleaved[i] = FloatVertex{vertices[i], uvs[i], normals[i]};
+	}
+	mesh.bounds = computeBounds(vertices, vertexCount);
+	mesh.lods = lods;
+	if (mesh.lods.empty())
+		mesh.lods.push_back(MeshLOD{0, unsigned(indexCount), 0.0f});
+	for (const MeshLOD & lod : mesh.lods)
+		prepared.indexBufferCount = std::max<size_t>(prepared.indexBufferCount, lod.firstIndex + lod.indexCount);
+	return prepared;
+}
+
+void printVertexFormat(const MeshBuffers & mesh)
+{
+	// Three separate float streams used to take 32 bytes per vertex
+	size_t stride = vertexSize(mesh.format);
+	size_t floatBytes = mesh.vertexCount * sizeof(FloatVertex);
+	size_t bytes = mesh.vertexCount * stride;
+	printf("Vertex format: %s, %zu bytes per vertex, %.1f KB instead of %.1f KB (%.0f%% of the bytes)\n",
+		mesh.format == VertexFormat::Packed ? "packed" : "float", stride,
+		bytes / 1024.0, floatBytes / 1024.0, floatBytes ? 100.0 * bytes / floatBytes : 100.0);
+}
+
+void createMeshBuffers(MeshBuffers & mesh, size_t indexBufferCount, const void * vertexData, const unsigned int * indices)
+{
+	size_t stride = vertexSize(mesh.format);
+
+	glGenVertexArrays(1, &mesh.vertexArray);
+	glState().bindVertexArray(mesh.vertexArray);
+	glGenBuffers(1, &mesh.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * stride, vertexData, GL_STATIC_DRAW);
+	// The element buffer binding is part of the VAO state
+	glGenBuffers(1, &mesh.indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+
+	// Same attribute locations as StandardShading.vertexshader: 0 position, 1 uv, 2 normal
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	if (mesh.format == VertexFormat::Packed)
+	{
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, position));
+		glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, uv));
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal));
+	}
+	else
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatVertex, position));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatVertex, uv));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatVertex, normal));
+	}
+	glState().bindVertexArray(0);
+}
+
+MeshBuffers uploadMesh(
+	const unsigned int * indices, size_t indexCount,
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals, size_t vertexCount,
+	const VertexQuantization & quantization,
+	const std::vector<MeshLOD> & lods
+){
+	PreparedMesh prepared = prepareMesh(indexCount, vertices, uvs, normals, vertexCount, quantization, lods);
+	createMeshBuffers(prepared.mesh, prepared.indexBufferCount, prepared.vertexData.data(), indices);
+	printVertexFormat(prepared.mesh);
+	return prepared.mesh;
+}
+
+void deleteMesh(MeshBuffers & mesh)
+{
+	glDeleteBuffers(1, &mesh.vertexBuffer);
+	glDeleteBuffers(1, &mesh.indexBuffer);
+	forgetInstancedVertexArray(mesh.vertexArray);
+	glDeleteVertexArrays(1, &mesh.vertexArray);
+	// The name can come back from glGenVertexArrays, the shadow copy must not think it is bound
+	glState().invalidate();
+	mesh = MeshBuffers{};
+}
+
+void sendMeshUniforms(ShaderProgram & program, const MeshBuffers & mesh)
+{
+	program.set(ShaderProgram::UniformSlot::PositionScale, mesh.positionScale);
+	program.set(ShaderProgram::UniformSlot::PositionBias, mesh.positionBias);
+	program.set(ShaderProgram::UniformSlot::UVScale, mesh.uvScale);
+	program.set(ShaderProgram::UniformSlot::UVBias, mesh.uvBias);
+}
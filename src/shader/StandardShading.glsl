@@ -0,0 +1,30 @@
+// Included by the StandardShading shaders. The permutations (see shaderpermutation.hpp) put their
+// #defines in front of it, without them everything is on, as it always was.
+
+// 1: the material color is sampled from myTextureSampler or myTextureArraySampler, 0: MaterialColor
+#ifndef TEXTURE
+#define TEXTURE 1
+#endif
+
+// 1: specular highlight, 0: ambient and diffuse only
+#ifndef SPECULAR
+#define SPECULAR 1
+#endif
+
+// Lights in LightPosition_worldspace, each with the same color and power
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 1
+#endif
+
+// Light emission properties
+#ifndef LIGHT_COLOR
+#define LIGHT_COLOR vec3(1,1,1)
+// #define LIGHT_COLOR vec3(0.2,0.3,0.4) Uebung 15
+#endif
+
+#ifndef LIGHT_POWER
+#define LIGHT_POWER 5.0
+// #define LIGHT_POWER 50.0 Uebung 15
+#endif
+
+uniform vec3 LightPosition_worldspace[LIGHT_COUNT];